@@ -4,8 +4,10 @@
 #include <vector>
 #include <mutex>
 #include <unordered_map>
+#include "metrics.h"
 
 extern int cntmapsizethreshold;
+struct mm_prune_s;
 typedef struct {
     std::unordered_map<std::string, unsigned long long>* map;
     std::mutex mutex;
@@ -13,6 +15,10 @@ typedef struct {
 typedef struct {
     std::vector<specific_map*> maps; //TODO make array?
     int mapslen;
+    mm_metrics_t metrics; // of this shard; written by the thread that maps it
+    const struct mm_prune_s *prune; // minimizers of the reads, shared by all shards; NULL to map every shard
+    double prune_min; // shards with a smaller estimated overlap with the reads are skipped
+    int numa_node; // the thread that maps the shard runs on this node; -1 to leave it to the scheduler
 } ao_queue;
 
 #endif
\ No newline at end of file
@@ -434,7 +434,7 @@ static void mm_align_pair(void *km, const mm_mapopt_t *opt, int qlen, const uint
 		fprintf(stderr, "\n");
 	}
 #ifdef MANUAL_PROFILING
-	alignment_time += (__rdtsc() - align_start);
+	__sync_fetch_and_add(&alignment_time, __rdtsc() - align_start); // shared by all mapping threads
 #endif
 }
 #endif
@@ -77,15 +77,84 @@ static inline void kseq2bseq(kseq_t *ks, mm_bseq1_t *s, int with_qual, int with_
 	s->l_seq = ks->seq.l;
 }
 
+/*
+ * Batch storage: while a batch is read, the strings of its records are
+ * appended to one growing block and the records hold offsets into it, cast
+ * to pointers. As the name of a record comes first, only qual and comment
+ * can be absent, and their offset is never 0. slab_fix() turns the offsets
+ * into pointers once the block has stopped moving.
+ */
+static inline char *slab_add(kstring_t *slab, const char *s, size_t l)
+{
+	size_t off = slab->l;
+	if (slab->l + l + 1 > slab->m) {
+		slab->m = slab->l + l + 1;
+		slab->m += slab->m >> 1;
+		slab->s = (char*)realloc(slab->s, slab->m);
+	}
+	memcpy(slab->s + slab->l, s, l);
+	slab->s[slab->l + l] = 0;
+	slab->l += l + 1;
+	return (char*)(uintptr_t)off;
+}
+
+static inline void kseq2slab(kseq_t *ks, mm_bseq1_t *s, kstring_t *slab, int with_qual, int with_comment)
+{
+	size_t i;
+	char *seq;
+	if (ks->name.l == 0)
+		fprintf(stderr, "[WARNING]\033[1;31m empty sequence name in the input.\033[0m\n");
+	s->name = slab_add(slab, ks->name.s, ks->name.l);
+	s->seq = slab_add(slab, ks->seq.s, ks->seq.l);
+	for (i = 0, seq = slab->s + (uintptr_t)s->seq; i < ks->seq.l; ++i) // convert U to T
+		if (seq[i] == 'u' || seq[i] == 'U')
+			--seq[i];
+	s->qual = with_qual && ks->qual.l? slab_add(slab, ks->qual.s, ks->qual.l) : 0;
+	s->comment = with_comment && ks->comment.l? slab_add(slab, ks->comment.s, ks->comment.l) : 0;
+	s->l_seq = ks->seq.l;
+}
+
+static void bseq2slab(mm_bseq1_t *s, kstring_t *slab) // moves a record read by kseq2bseq() into the block
+{
+	char *name = s->name, *seq = s->seq, *qual = s->qual, *comment = s->comment;
+	s->name = slab_add(slab, name, strlen(name));
+	s->seq = slab_add(slab, seq, s->l_seq);
+	s->qual = qual? slab_add(slab, qual, s->l_seq) : 0;
+	s->comment = comment? slab_add(slab, comment, strlen(comment)) : 0;
+	free(name); free(seq); free(qual); free(comment);
+}
+
+static void slab_fix(int n, mm_bseq1_t *a, kstring_t *slab)
+{
+	int i;
+	for (i = 0; i < n; ++i) {
+		mm_bseq1_t *s = &a[i];
+		s->name = slab->s + (uintptr_t)s->name;
+		s->seq = slab->s + (uintptr_t)s->seq;
+		if (s->qual) s->qual = slab->s + (uintptr_t)s->qual;
+		if (s->comment) s->comment = slab->s + (uintptr_t)s->comment;
+	}
+	if (n == 0) free(slab->s);
+}
+
+void mm_bseq_free(int n, mm_bseq1_t *a)
+{
+	if (a == 0) return;
+	if (n > 0) free(a[0].name);
+	free(a);
+}
+
 mm_bseq1_t *mm_bseq_read3(mm_bseq_file_t *fp, int64_t chunk_size, int with_qual, int with_comment, int frag_mode, int *n_)
 {
 	int64_t size = 0;
 	int ret;
 	kvec_t(mm_bseq1_t) a = {0,0,0};
+	kstring_t slab = {0,0,0};
 	kseq_t *ks = fp->ks;
 	*n_ = 0;
 	if (fp->s.seq) {
 		kv_resize(mm_bseq1_t, 0, a, 256);
+		bseq2slab(&fp->s, &slab);
 		kv_push(mm_bseq1_t, 0, a, fp->s);
 		size = fp->s.l_seq;
 		memset(&fp->s, 0, sizeof(mm_bseq1_t));
@@ -95,21 +164,23 @@ mm_bseq1_t *mm_bseq_read3(mm_bseq_file_t *fp, int64_t chunk_size, int with_qual,
 		assert(ks->seq.l <= INT32_MAX);
 		if (a.m == 0) kv_resize(mm_bseq1_t, 0, a, 256);
 		kv_pushp(mm_bseq1_t, 0, a, &s);
-		kseq2bseq(ks, s, with_qual, with_comment);
+		kseq2slab(ks, s, &slab, with_qual, with_comment);
 		size += s->l_seq;
 		if (size >= chunk_size) {
 			if (frag_mode && a.a[a.n-1].l_seq < CHECK_PAIR_THRES) {
 				while ((ret = kseq_read(ks)) >= 0) {
 					kseq2bseq(ks, &fp->s, with_qual, with_comment);
-					if (mm_qname_same(fp->s.name, a.a[a.n-1].name)) {
+					if (mm_qname_same(fp->s.name, slab.s + (uintptr_t)a.a[a.n-1].name)) {
+						bseq2slab(&fp->s, &slab);
 						kv_push(mm_bseq1_t, 0, a, fp->s);
 						memset(&fp->s, 0, sizeof(mm_bseq1_t));
-					} else break;
+					} else break; // fp->s keeps its own strings until the next batch
 				}
 			}
 			break;
 		}
 	}
+	slab_fix(a.n, a.a, &slab);
 	if (ret < -1) {
 		if (a.n) fprintf(stderr, "[WARNING]\033[1;31m failed to parse the FASTA/FASTQ record next to '%s'. Continue anyway.\033[0m\n", a.a[a.n-1].name);
 		else fprintf(stderr, "[WARNING]\033[1;31m failed to parse the first FASTA/FASTQ record. Continue anyway.\033[0m\n");
@@ -133,6 +204,7 @@ mm_bseq1_t *mm_bseq_read_frag2(int n_fp, mm_bseq_file_t **fp, int64_t chunk_size
 	int i;
 	int64_t size = 0;
 	kvec_t(mm_bseq1_t) a = {0,0,0};
+	kstring_t slab = {0,0,0};
 	*n_ = 0;
 	if (n_fp < 1) return 0;
 	while (1) {
@@ -149,11 +221,12 @@ mm_bseq1_t *mm_bseq_read_frag2(int n_fp, mm_bseq_file_t **fp, int64_t chunk_size
 		for (i = 0; i < n_fp; ++i) {
 			mm_bseq1_t *s;
 			kv_pushp(mm_bseq1_t, 0, a, &s);
-			kseq2bseq(fp[i]->ks, s, with_qual, with_comment);
+			kseq2slab(fp[i]->ks, s, &slab, with_qual, with_comment);
 			size += s->l_seq;
 		}
 		if (size >= chunk_size) break;
 	}
+	slab_fix(a.n, a.a, &slab);
 	*n_ = a.n;
 	return a.a;
 }
@@ -18,6 +18,13 @@ typedef struct {
 
 mm_bseq_file_t *mm_bseq_open(const char *fn);
 void mm_bseq_close(mm_bseq_file_t *fp);
+/*
+ * A batch returned by mm_bseq_read*() keeps the strings of all its records in
+ * one block, which starts at the name of the first record. Records can be
+ * modified in place, but their strings must not be freed one by one:
+ * mm_bseq_free() releases the whole batch.
+ */
+void mm_bseq_free(int n, mm_bseq1_t *a);
 mm_bseq1_t *mm_bseq_read3(mm_bseq_file_t *fp, int64_t chunk_size, int with_qual, int with_comment, int frag_mode, int *n_);
 mm_bseq1_t *mm_bseq_read2(mm_bseq_file_t *fp, int64_t chunk_size, int with_qual, int frag_mode, int *n_);
 mm_bseq1_t *mm_bseq_read(mm_bseq_file_t *fp, int64_t chunk_size, int with_qual, int *n_);
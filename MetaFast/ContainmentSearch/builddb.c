@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "bseq.h"
+#include "minimap.h"
+#include "mmpriv.h"
+#include "prune.h"
+#include "builddb.h"
+
+typedef struct {
+    std::string src, out, taxid;
+    off_t size;   // of the source file, for scheduling
+    bool rebuild;
+    std::vector<std::string> names; // reference sequences of the shard
+} db_job_t;
+
+static struct option build_db_options[] = {
+    { "force",  no_argument, NULL, 'f' },
+    { "no-seq", no_argument, NULL, 'S' },
+    { NULL, 0, NULL, 0 }
+};
+
+static void build_db_usage() {
+    fprintf(stderr, "Usage: cs build-db [-k <int: k-mer length, default 21>] [-w <int: minimizer window, default 11>] [-t <int: threads, default 1>] [-T <file: translation table, default <mmidir>/translate_sorted.csv>] [-S] [-f] <organism_files> <mmidir>\n");
+    fprintf(stderr, "       -S/--no-seq builds seed-only shards without the reference sequences; cs doesn't need them, but metafast, rm and --build-sketch do\n");
+    fprintf(stderr, "       only shards that are missing, older than their organism file or built with other -k/-w/-S are rebuilt; -f rebuilds all\n");
+    exit(1);
+}
+
+// taxid_<TaxID with '.' replaced by '_'>_genomic.fna.gz -> TaxID; other names give the file name without extensions
+static std::string file_taxid(const std::string &fn) {
+    const std::string pre = "taxid_", suf = "_genomic";
+    std::string base = fn.substr(0, fn.find('.'));
+    if(base.compare(0, pre.size(), pre) == 0 && base.size() > pre.size() + suf.size() &&
+            base.compare(base.size() - suf.size(), suf.size(), suf) == 0) {
+        base = base.substr(pre.size(), base.size() - pre.size() - suf.size());
+        std::replace(base.begin(), base.end(), '_', '.');
+    }
+    return base;
+}
+
+// the sequence names of a prebuilt index; they precede the buckets, so the rest of the file is not read
+static int read_idx_names(const char *fn, std::vector<std::string> &names) {
+    FILE *fp = fopen(fn, "rb");
+    char magic[4], name[256];
+    uint32_t x[5], i, len;
+    int ret = -1;
+    if(!fp)
+        return -1;
+    if(fread(magic, 1, 4, fp) == 4 && strncmp(magic, MM_IDX_MAGIC, 4) == 0 && fread(x, 4, 5, fp) == 5) {
+        for(i = 0; i < x[3]; ++i) {
+            uint8_t l;
+            if(fread(&l, 1, 1, fp) != 1 || fread(name, 1, l, fp) != l || fread(&len, 4, 1, fp) != 1)
+                break;
+            names.push_back(std::string(name, l));
+        }
+        ret = i == x[3]? 0 : -1;
+    }
+    fclose(fp);
+    return ret;
+}
+
+// buckets scale with the genome: about 64 minimizers per bucket, at most the default 2^14 buckets
+static int bucket_bits(off_t size, int w) {
+    int b = 8;
+    int64_t n_mini = (int64_t)size * 2 / (w + 1);
+    while(b < 14 && n_mini >> b > 64)
+        ++b;
+    return b;
+}
+
+static int build_shard(db_job_t &job, int k, int w, int flag, int n_threads) {
+    mm_bseq_file_t *fp = mm_bseq_open(job.src.c_str());
+    mm_idx_t *mi;
+    if(!fp)
+        return -1;
+    // the whole organism goes into one index part: cs maps every part of a shard anyway
+    mi = mm_idx_gen(fp, w, k, bucket_bits(job.size, w), flag, 1<<18, n_threads, UINT64_MAX);
+    mm_bseq_close(fp);
+    if(!mi)
+        return -1;
+    std::string tmp = job.out + ".tmp";
+    FILE *out = fopen(tmp.c_str(), "wb");
+    if(!out) {
+        mm_idx_destroy(mi);
+        return -1;
+    }
+    mm_idx_dump(out, mi);
+    if(fclose(out) != 0 || rename(tmp.c_str(), job.out.c_str()) != 0) { // a crash never leaves a truncated shard behind
+        mm_idx_destroy(mi);
+        return -1;
+    }
+#ifdef LISA_INDEX
+    mm_idx_dump_hash((job.out + "__minimizers_key_value_sorted").c_str(), mi); // as cs names it without -x
+#endif
+    for(uint32_t i = 0; i < mi->n_seq; ++i)
+        job.names.push_back(mi->seq[i].name);
+    mm_idx_destroy(mi);
+    return 0;
+}
+
+int build_db_main(int argc, char *argv[]) {
+    int opt, k = 21, w = 11, n_threads = 1, flag = 0;
+    bool force = false;
+    const char *tr_path = NULL;
+    optind = 1;
+    while((opt = getopt_long(argc, argv, "k:w:t:T:Sf", build_db_options, NULL)) != -1) {
+        switch(opt) {
+        case 'k': k = atoi(optarg); break;
+        case 'w': w = atoi(optarg); break;
+        case 't': n_threads = atoi(optarg); break;
+        case 'T': tr_path = optarg; break;
+        case 'S': flag |= MM_I_NO_SEQ; break;
+        case 'f': force = true; break;
+        default: build_db_usage();
+        }
+    }
+    if(argc != optind + 2 || k < 1 || k > 28 || w < 1 || w > 255 || n_threads < 1)
+        build_db_usage();
+    const std::string srcdir = argv[optind], mmidir = argv[optind + 1];
+    const std::string tr = tr_path? std::string(tr_path) : mmidir + "/translate_sorted.csv";
+    mkdir(mmidir.c_str(), 0755);
+
+    // one job per organism file: X.fna.gz -> X.mmi
+    std::vector<db_job_t> jobs;
+    DIR *inDir = opendir(srcdir.c_str());
+    struct dirent *entry;
+    if(!inDir) {
+        fprintf(stderr, "ERROR: failed to open %s\n", srcdir.c_str());
+        return 1;
+    }
+    while((entry = readdir(inDir)) != NULL) {
+        std::string name = entry->d_name, stem = name;
+        struct stat src_st, out_st;
+        if(name[0] == '.')
+            continue;
+        if(stem.size() > 3 && stem.compare(stem.size() - 3, 3, ".gz") == 0)
+            stem.erase(stem.size() - 3);
+        if(stem.find('.') == std::string::npos)
+            continue;
+        const std::string ext = stem.substr(stem.rfind('.'));
+        if(ext != ".fna" && ext != ".fa" && ext != ".fasta" && ext != ".fq" && ext != ".fastq")
+            continue;
+        db_job_t job;
+        job.src = srcdir + "/" + name;
+        job.out = mmidir + "/" + stem.substr(0, stem.rfind('.')) + ".mmi";
+        job.taxid = file_taxid(name);
+        if(stat(job.src.c_str(), &src_st) != 0)
+            continue;
+        job.size = src_st.st_size;
+        job.rebuild = force || stat(job.out.c_str(), &out_st) != 0 || out_st.st_mtime < src_st.st_mtime;
+        if(!job.rebuild) {
+            int pk, pw, pflag;
+            job.rebuild = mm_idx_read_param(job.out.c_str(), &pk, &pw, &pflag) < 0 || pk != k || pw != w || (pflag & MM_I_NO_SEQ) != flag || read_idx_names(job.out.c_str(), job.names) < 0;
+            if(job.rebuild)
+                job.names.clear();
+        }
+        jobs.push_back(job);
+    }
+    closedir(inDir);
+
+    // largest genomes first, so that the small ones fill up the threads at the end
+    std::vector<db_job_t*> todo;
+    for(auto &job : jobs)
+        if(job.rebuild)
+            todo.push_back(&job);
+    std::sort(todo.begin(), todo.end(), [](const db_job_t *a, const db_job_t *b) { return a->size > b->size; });
+    fprintf(stderr, "%zu organism files, %zu shards to build\n", jobs.size(), todo.size());
+
+    // with fewer shards than threads, the threads left over go to the indexing of each shard
+    const int n_workers = std::max(1, std::min(n_threads, (int)todo.size()));
+    const int threads_per_shard = std::max(1, n_threads / n_workers);
+    std::atomic<size_t> next(0);
+    std::atomic<int> n_failed(0);
+    std::vector<std::thread> workers;
+    for(int i = 0; i < n_workers; ++i) {
+        workers.push_back(std::thread([&]() {
+            size_t j;
+            while((j = next++) < todo.size()) {
+                if(build_shard(*todo[j], k, w, flag, threads_per_shard) < 0) {
+                    fprintf(stderr, "ERROR: failed to index %s into %s\n", todo[j]->src.c_str(), todo[j]->out.c_str());
+                    ++n_failed;
+                } else {
+                    fprintf(stderr, "indexed %s (%zu sequences)\n", todo[j]->out.c_str(), todo[j]->names.size());
+                }
+            }
+        }));
+    }
+    for(auto &t : workers)
+        t.join();
+    if(n_failed > 0)
+        return 1;
+
+    // translation table sorted by accession, as cs merge-joins it with its sorted results
+    std::vector<std::pair<std::string, std::string>> acc2taxid;
+    for(const auto &job : jobs)
+        for(const auto &name : job.names)
+            acc2taxid.push_back(std::make_pair(name, job.taxid));
+    std::sort(acc2taxid.begin(), acc2taxid.end());
+    FILE *fp = fopen(tr.c_str(), "w");
+    if(!fp) {
+        fprintf(stderr, "ERROR: failed to write %s\n", tr.c_str());
+        return 1;
+    }
+    for(const auto &p : acc2taxid)
+        fprintf(fp, "%s %s\n", p.first.c_str(), p.second.c_str());
+    fclose(fp);
+    fprintf(stderr, "wrote %zu sequences to %s\n", acc2taxid.size(), tr.c_str());
+    return 0;
+}
@@ -0,0 +1,11 @@
+#ifndef BUILDDB_H
+#define BUILDDB_H
+
+/*
+ * cs build-db: index every organism file of a directory into its own .mmi
+ * shard and write the translation table that maps the reference sequences
+ * to the TaxIDs in the file names.
+ */
+int build_db_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <string.h>
+#include "khash.h"
+#include "dedup.h"
+
+KHASH_MAP_INIT_STR(dedup, int32_t)
+
+static inline char dedup_comp(char c)
+{
+	switch (c) {
+	case 'A': return 'T'; case 'C': return 'G'; case 'G': return 'C'; case 'T': return 'A';
+	case 'a': return 't'; case 'c': return 'g'; case 'g': return 'c'; case 't': return 'a';
+	default: return c; // N and other codes are their own complement here
+	}
+}
+
+char *mm_dedup_canonical(int n, const mm_bseq1_t *seq, const char **key)
+{
+	size_t tot = 1;
+	char *buf, *p;
+	int i, j;
+	for (i = 0; i < n; ++i) tot += (size_t)seq[i].l_seq + 1;
+	p = buf = (char*)malloc(tot);
+	for (i = 0; i < n; ++i) {
+		int l = seq[i].l_seq;
+		for (j = 0; j < l; ++j) p[j] = dedup_comp(seq[i].seq[l - 1 - j]);
+		p[l] = 0;
+		key[i] = strcmp(p, seq[i].seq) < 0? p : seq[i].seq;
+		p += l + 1;
+	}
+	return buf;
+}
+
+int32_t *mm_dedup_batch(int n, const mm_bseq1_t *seq, const char *const *key)
+{
+	khash_t(dedup) *h;
+	int32_t *dup;
+	int i;
+	dup = (int32_t*)malloc(n * sizeof(int32_t));
+	h = kh_init(dedup);
+	kh_resize(dedup, h, n);
+	for (i = 0; i < n; ++i) {
+		khint_t k;
+		int absent;
+		k = kh_put(dedup, h, key? key[i] : seq[i].seq, &absent); // keys point to the sequences of the batch
+		if (absent) kh_val(h, k) = i, dup[i] = -1;
+		else dup[i] = kh_val(h, k);
+	}
+	kh_destroy(dedup, h);
+	return dup;
+}
+
+typedef struct {
+	char *key;
+	void *val;
+	int32_t prev, next; // doubly linked list, most recently used first
+} lru_slot_t;
+
+struct mm_lru_s {
+	int32_t max_n, n, head, tail;
+	lru_slot_t *a;
+	khash_t(dedup) *h;
+	void (*destroy)(void*);
+};
+
+mm_lru_t *mm_lru_init(int32_t max_n, void (*destroy)(void*))
+{
+	mm_lru_t *c;
+	if (max_n <= 0) return 0;
+	c = (mm_lru_t*)calloc(1, sizeof(mm_lru_t));
+	c->max_n = max_n, c->head = c->tail = -1;
+	c->h = kh_init(dedup);
+	c->destroy = destroy;
+	return c;
+}
+
+void mm_lru_destroy(mm_lru_t *c)
+{
+	int32_t i;
+	if (c == 0) return;
+	for (i = 0; i < c->n; ++i) {
+		free(c->a[i].key);
+		if (c->destroy) c->destroy(c->a[i].val);
+	}
+	free(c->a);
+	kh_destroy(dedup, c->h);
+	free(c);
+}
+
+static void lru_unlink(mm_lru_t *c, int32_t i)
+{
+	lru_slot_t *s = &c->a[i];
+	if (s->prev >= 0) c->a[s->prev].next = s->next;
+	else c->head = s->next;
+	if (s->next >= 0) c->a[s->next].prev = s->prev;
+	else c->tail = s->prev;
+}
+
+static void lru_push_front(mm_lru_t *c, int32_t i)
+{
+	c->a[i].prev = -1, c->a[i].next = c->head;
+	if (c->head >= 0) c->a[c->head].prev = i;
+	c->head = i;
+	if (c->tail < 0) c->tail = i;
+}
+
+void *mm_lru_get(mm_lru_t *c, const char *key)
+{
+	khint_t k;
+	int32_t i;
+	k = kh_get(dedup, c->h, key);
+	if (k == kh_end(c->h)) return 0;
+	i = kh_val(c->h, k);
+	if (c->head != i) {
+		lru_unlink(c, i);
+		lru_push_front(c, i);
+	}
+	return c->a[i].val;
+}
+
+void mm_lru_put(mm_lru_t *c, const char *key, void *val)
+{
+	khint_t k;
+	int32_t i;
+	int absent;
+	if ((k = kh_get(dedup, c->h, key)) != kh_end(c->h)) { // replace the value
+		i = kh_val(c->h, k);
+		if (c->destroy) c->destroy(c->a[i].val);
+		c->a[i].val = val;
+		lru_unlink(c, i);
+		lru_push_front(c, i);
+		return;
+	}
+	if (c->n < c->max_n) { // a free slot
+		if (c->a == 0) c->a = (lru_slot_t*)malloc(c->max_n * sizeof(lru_slot_t));
+		i = c->n++;
+	} else { // evict the least recently used entry
+		i = c->tail;
+		lru_unlink(c, i);
+		kh_del(dedup, c->h, kh_get(dedup, c->h, c->a[i].key));
+		free(c->a[i].key);
+		if (c->destroy) c->destroy(c->a[i].val);
+	}
+	c->a[i].key = strdup(key);
+	c->a[i].val = val;
+	lru_push_front(c, i);
+	k = kh_put(dedup, c->h, c->a[i].key, &absent);
+	kh_val(c->h, k) = i;
+}
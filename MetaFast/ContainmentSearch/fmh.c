@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bseq.h"
+#include "mmpriv.h"
+#include "fmh.h"
+
+extern unsigned char seq_nt4_table[256];
+
+static inline uint64_t fmh_hash64(uint64_t key, uint64_t mask) // same as hash64() in sketch.c; invertible within mask
+{
+	key = (~key + (key << 21)) & mask;
+	key = key ^ key >> 24;
+	key = ((key + (key << 3)) + (key << 8)) & mask;
+	key = key ^ key >> 14;
+	key = ((key + (key << 2)) + (key << 4)) & mask;
+	key = key ^ key >> 28;
+	key = (key + (key << 31)) & mask;
+	return key;
+}
+
+uint64_t mm_fmh_max_hash(int k, uint64_t scaled)
+{
+	uint64_t mask = (1ULL<<2*k) - 1;
+	return scaled > 1? mask / scaled : mask;
+}
+
+void mm_fmh_add(mm_fmh_buf_t *b, int len, const uint8_t *seq, int k, uint64_t max_hash)
+{
+	uint64_t shift1 = 2 * (k - 1), mask = (1ULL<<2*k) - 1, kmer[2] = {0,0};
+	int i, l;
+	for (i = l = 0; i < len; ++i) {
+		int c = seq[i];
+		if (c < 4) {
+			uint64_t h;
+			kmer[0] = (kmer[0] << 2 | c) & mask;           // forward k-mer
+			kmer[1] = (kmer[1] >> 2) | (3ULL^c) << shift1; // reverse k-mer
+			if (++l < k) continue;
+			h = fmh_hash64(kmer[0] < kmer[1]? kmer[0] : kmer[1], mask);
+			if (h > max_hash) continue;
+			if (b->n == b->m) {
+				b->m = b->m? b->m + (b->m>>1) : 1024;
+				b->a = (uint64_t*)realloc(b->a, b->m * sizeof(uint64_t));
+			}
+			b->a[b->n++] = h;
+		} else l = 0;
+	}
+}
+
+void mm_fmh_uniq(mm_fmh_buf_t *b)
+{
+	size_t i, j;
+	if (b->n == 0) return;
+	radix_sort_64(b->a, b->a + b->n);
+	for (i = j = 1; i < b->n; ++i)
+		if (b->a[i] != b->a[j-1])
+			b->a[j++] = b->a[i];
+	b->n = j;
+}
+
+int mm_fmh_file(const char *fn, int k, uint64_t scaled, mm_fmh_buf_t *b)
+{
+	mm_bseq_file_t *fp;
+	mm_bseq1_t *seq;
+	uint8_t *s = 0;
+	int i, j, n_seq, m_s = 0;
+	size_t n_uniq = 0;
+	uint64_t max_hash = mm_fmh_max_hash(k, scaled);
+	if ((fp = mm_bseq_open(fn)) == 0) return -1;
+	while ((seq = mm_bseq_read(fp, 500000000, 0, &n_seq)) != 0) {
+		for (i = 0; i < n_seq; ++i) {
+			if (seq[i].l_seq > m_s) {
+				m_s = seq[i].l_seq;
+				s = (uint8_t*)realloc(s, m_s);
+			}
+			for (j = 0; j < seq[i].l_seq; ++j)
+				s[j] = seq_nt4_table[(uint8_t)seq[i].seq[j]];
+			mm_fmh_add(b, seq[i].l_seq, s, k, max_hash);
+		}
+		mm_bseq_free(n_seq, seq);
+		if (b->n > 2 * n_uniq + (1<<20)) { // keep memory proportional to the sketch, not to the reads
+			mm_fmh_uniq(b);
+			n_uniq = b->n;
+		}
+	}
+	mm_fmh_uniq(b);
+	free(s);
+	mm_bseq_close(fp);
+	return 0;
+}
+
+mm_fmh_t *mm_fmh_idx(const char *fn, int k, uint64_t scaled)
+{
+	mm_idx_reader_t *r;
+	mm_idx_t *mi;
+	mm_fmh_t *s;
+	uint8_t *seq = 0;
+	uint32_t i, m_seq = 0;
+	uint64_t max_hash = mm_fmh_max_hash(k, scaled);
+	if ((r = mm_idx_reader_open(fn, 0, 0)) == 0) return 0;
+	s = (mm_fmh_t*)calloc(1, sizeof(mm_fmh_t));
+	s->k = k, s->scaled = scaled;
+	while ((mi = mm_idx_reader_read(r, 1)) != 0) {
+		if (mi->flag & MM_I_NO_SEQ) {
+			mm_idx_destroy(mi);
+			mm_fmh_destroy(s);
+			s = 0;
+			break;
+		}
+		s->seq = (mm_fmh_seq_t*)realloc(s->seq, (s->n_seq + mi->n_seq) * sizeof(mm_fmh_seq_t));
+		for (i = 0; i < mi->n_seq; ++i) {
+			mm_fmh_seq_t *p = &s->seq[s->n_seq++];
+			mm_fmh_buf_t b = {0,0,0};
+			if (mi->seq[i].len > m_seq) {
+				m_seq = mi->seq[i].len;
+				seq = (uint8_t*)realloc(seq, m_seq);
+			}
+			mm_idx_getseq(mi, i, 0, mi->seq[i].len, seq);
+			mm_fmh_add(&b, mi->seq[i].len, seq, k, max_hash);
+			mm_fmh_uniq(&b);
+			p->name = strdup(mi->seq[i].name);
+			p->n = b.n, p->a = b.a;
+		}
+		mm_idx_destroy(mi);
+	}
+	free(seq);
+	mm_idx_reader_close(r);
+	return s;
+}
+
+int mm_fmh_dump(const char *fn, const mm_fmh_t *s)
+{
+	FILE *fp;
+	uint32_t i;
+	if ((fp = fopen(fn, "wb")) == 0) return -1;
+	fwrite("FMH\1", 1, 4, fp);
+	fwrite(&s->k, 4, 1, fp);
+	fwrite(&s->scaled, 8, 1, fp);
+	fwrite(&s->n_seq, 4, 1, fp);
+	for (i = 0; i < s->n_seq; ++i) {
+		uint32_t l = strlen(s->seq[i].name);
+		fwrite(&l, 4, 1, fp);
+		fwrite(s->seq[i].name, 1, l, fp);
+		fwrite(&s->seq[i].n, 8, 1, fp);
+		fwrite(s->seq[i].a, 8, s->seq[i].n, fp);
+	}
+	return fclose(fp) == 0? 0 : -1;
+}
+
+mm_fmh_t *mm_fmh_load(const char *fn)
+{
+	FILE *fp;
+	char magic[4];
+	mm_fmh_t *s;
+	uint32_t i;
+	int ok = 1;
+	if ((fp = fopen(fn, "rb")) == 0) return 0;
+	if (fread(magic, 1, 4, fp) != 4 || strncmp(magic, "FMH\1", 4) != 0) {
+		fclose(fp);
+		return 0;
+	}
+	s = (mm_fmh_t*)calloc(1, sizeof(mm_fmh_t));
+	ok = fread(&s->k, 4, 1, fp) == 1 && fread(&s->scaled, 8, 1, fp) == 1 && fread(&s->n_seq, 4, 1, fp) == 1;
+	if (ok) s->seq = (mm_fmh_seq_t*)calloc(s->n_seq, sizeof(mm_fmh_seq_t));
+	else s->n_seq = 0;
+	for (i = 0; ok && i < s->n_seq; ++i) {
+		mm_fmh_seq_t *p = &s->seq[i];
+		uint32_t l;
+		ok = fread(&l, 4, 1, fp) == 1;
+		if (!ok) break;
+		p->name = (char*)malloc(l + 1);
+		ok = fread(p->name, 1, l, fp) == l && fread(&p->n, 8, 1, fp) == 1;
+		p->name[l] = 0;
+		if (!ok) break;
+		p->a = (uint64_t*)malloc(p->n * 8);
+		ok = fread(p->a, 8, p->n, fp) == p->n;
+	}
+	fclose(fp);
+	if (!ok) {
+		mm_fmh_destroy(s);
+		return 0;
+	}
+	return s;
+}
+
+void mm_fmh_destroy(mm_fmh_t *s)
+{
+	uint32_t i;
+	if (s == 0) return;
+	for (i = 0; i < s->n_seq; ++i) {
+		free(s->seq[i].name); free(s->seq[i].a);
+	}
+	free(s->seq); free(s);
+}
+
+uint64_t mm_fmh_intersect(uint64_t n1, const uint64_t *a1, uint64_t n2, const uint64_t *a2)
+{
+	uint64_t i = 0, j = 0, cnt = 0;
+	while (i < n1 && j < n2) {
+		if (a1[i] < a2[j]) ++i;
+		else if (a1[i] > a2[j]) ++j;
+		else ++cnt, ++i, ++j;
+	}
+	return cnt;
+}
@@ -0,0 +1,78 @@
+#ifndef MM_FMH_H
+#define MM_FMH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "minimap.h"
+
+#define MM_FMH_SUFFIX ".fmh" // sketch of X.mmi is stored as X.mmi.fmh
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Scaled FracMinHash sketches: the hashes of all canonical k-mers whose hash
+ * value is at most 1/scaled of the hash space, kept sorted and unique. The
+ * containment of a genome in a read set is estimated by the fraction of its
+ * sketch found in the sketch of the reads.
+ */
+
+typedef struct {
+	size_t n, m;
+	uint64_t *a;
+} mm_fmh_buf_t;
+
+typedef struct {
+	char *name;   // reference sequence name
+	uint64_t n;   // number of hashes
+	uint64_t *a;  // sorted hashes
+} mm_fmh_seq_t;
+
+typedef struct {
+	int32_t k;
+	uint64_t scaled;
+	uint32_t n_seq;
+	mm_fmh_seq_t *seq;
+} mm_fmh_t;
+
+uint64_t mm_fmh_max_hash(int k, uint64_t scaled);
+
+/**
+ * Append the sketched k-mers of a sequence to a buffer
+ *
+ * @param b         buffer; hashes are neither sorted nor unique until mm_fmh_uniq()
+ * @param len       length of the sequence
+ * @param seq       sequence in 0/1/2/3 with 4 or larger for ambiguous bases
+ * @param k         k-mer length, at most 31
+ * @param max_hash  from mm_fmh_max_hash()
+ */
+void mm_fmh_add(mm_fmh_buf_t *b, int len, const uint8_t *seq, int k, uint64_t max_hash);
+void mm_fmh_uniq(mm_fmh_buf_t *b);
+
+/**
+ * Sketch all sequences of a FASTA/FASTQ file as one set
+ *
+ * @return 0 on success; -1 if fn can't be opened
+ */
+int mm_fmh_file(const char *fn, int k, uint64_t scaled, mm_fmh_buf_t *b);
+
+/**
+ * Sketch each reference sequence of a prebuilt index file
+ *
+ * @return sketch, or NULL if fn can't be opened or doesn't keep the sequences
+ */
+mm_fmh_t *mm_fmh_idx(const char *fn, int k, uint64_t scaled);
+
+int mm_fmh_dump(const char *fn, const mm_fmh_t *s);
+mm_fmh_t *mm_fmh_load(const char *fn);
+void mm_fmh_destroy(mm_fmh_t *s);
+
+// number of hashes shared by two sorted arrays
+uint64_t mm_fmh_intersect(uint64_t n1, const uint64_t *a1, uint64_t n2, const uint64_t *a2);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
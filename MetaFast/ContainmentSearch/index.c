@@ -45,6 +45,7 @@ Modified Copyright (C) 2021 Intel Corporation
 #include "mmpriv.h"
 #include "kvec.h"
 #include "khash.h"
+#include "placement.h"
 #include <map>
 #include <fstream>
 #include <vector>
@@ -109,11 +110,12 @@ void mm_idx_destroy_mm_hash(mm_idx_t *mi)
 	if (mi->h) kh_destroy(str, (khash_t(str)*)mi->h);
 	if (mi->B) {
 		for (i = 0; i < 1U<<mi->b; ++i) {
-			free(mi->B[i].p);
+			if (!mi->p_pool) free(mi->B[i].p);
 			free(mi->B[i].a.a);
 			kh_destroy(idx, (idxhash_t*)mi->B[i].h);
 		}
 	}
+	free(mi->p_pool); mi->p_pool = 0;
 }
 void mm_idx_destroy_seq(mm_idx_t *mi)
 {
@@ -143,11 +145,12 @@ void mm_idx_destroy(mm_idx_t *mi)
 	if (mi->h) kh_destroy(str, (khash_t(str)*)mi->h);
 	if (mi->B) {
 		for (i = 0; i < 1U<<mi->b; ++i) {
-			free(mi->B[i].p);
+			if (!mi->p_pool) free(mi->B[i].p);
 			free(mi->B[i].a.a);
 			kh_destroy(idx, (idxhash_t*)mi->B[i].h);
 		}
 	}
+	free(mi->p_pool); mi->p_pool = 0;
 	if (mi->I) {
 		for (i = 0; i < mi->n_seq; ++i)
 			free(mi->I[i].a);
@@ -353,6 +356,21 @@ void mm_idx_stat(const mm_idx_t *mi)
 	fprintf(stderr, "minimizer-lookup: %lu dp: %lu rmq: %lu rmq_t1: %lu rmq_t2: %lu rmq_t3: %lu rmq_t4: %lu alignment: %lu \n", minimizer_lookup_time, dp_time, rmq_time, rmq_t1, rmq_t2, rmq_t3, rmq_t4, alignment_time);
 }
 
+int64_t mm_idx_sample_keys(const mm_idx_t *mi, int64_t max_n, uint64_t *keys)
+{ // buckets are selected by the low bits of the hash, so the minimizers of the first buckets are a uniform sample
+	int64_t n = 0;
+	uint32_t i;
+	for (i = 0; i < 1U<<mi->b && n < max_n; ++i) {
+		idxhash_t *h = (idxhash_t*)mi->B[i].h;
+		khint_t k;
+		if (h == 0) continue;
+		for (k = 0; k < kh_end(h) && n < max_n; ++k)
+			if (kh_exist(h, k))
+				keys[n++] = kh_key(h, k)>>1<<mi->b | i;
+	}
+	return n;
+}
+
 int mm_idx_index_name(mm_idx_t *mi)
 {
 	khash_t(str) *h;
@@ -595,9 +613,8 @@ static void *worker_pipeline(void *shared, int step, void *in)
 				mm_sketch(0, t->seq, t->l_seq, p->mi->w, p->mi->k, t->rid, p->mi->flag&MM_I_HPC, &s->a);
 			else if (mm_verbose >= 2)
 				fprintf(stderr, "[WARNING] the length database sequence '%s' is 0\n", t->name);
-			free(t->seq); free(t->name);
 		}
-		free(s->seq); s->seq = 0;
+		mm_bseq_free(s->n_seq, s->seq); s->seq = 0;
 		return s;
     } else if (step == 2) { // dispatch sketch to buckets
         step_t *s = (step_t*)in;
@@ -734,7 +751,7 @@ void mm_idx_dump(FILE *fp, const mm_idx_t *mi)
 	fflush(fp);
 }
 
-mm_idx_t *mm_idx_load(FILE *fp)
+static mm_idx_t *mm_idx_load_core(FILE *fp, int no_seq)
 {
 	char magic[4];
 	uint32_t x[5], i;
@@ -791,13 +808,38 @@ mm_idx_t *mm_idx_load(FILE *fp)
 			kh_val(h, k) = x[1];
 		}
 	}
-	if (!(mi->flag & MM_I_NO_SEQ)) {
-		mi->S = (uint32_t*)malloc((sum_len + 7) / 8 * 4);
+	if (mm_huge_pages) { // move the position arrays into one block that can be put on huge pages
+		uint64_t n_p = 0;
+		for (i = 0; i < 1U<<mi->b; ++i)
+			n_p += mi->B[i].n;
+		if (n_p * 8 >= MM_HUGE_PAGE && (mi->p_pool = (uint64_t*)mm_huge_malloc(n_p * 8)) != 0) {
+			for (i = 0, n_p = 0; i < 1U<<mi->b; ++i) {
+				mm_idx_bucket_t *b = &mi->B[i];
+				memcpy(&mi->p_pool[n_p], b->p, b->n * 8);
+				free(b->p);
+				b->p = &mi->p_pool[n_p];
+				n_p += b->n;
+			}
+		}
+	}
+	if (!(mi->flag & MM_I_NO_SEQ) && no_seq) { // the sequence is the last block of a part
+		mi->flag |= MM_I_NO_SEQ;
+		if (fseeko(fp, (off_t)((sum_len + 7) / 8 * 4), SEEK_CUR) != 0) {
+			mm_idx_destroy(mi);
+			return 0;
+		}
+	} else if (!(mi->flag & MM_I_NO_SEQ)) {
+		mi->S = (uint32_t*)mm_huge_malloc((sum_len + 7) / 8 * 4);
 		fread(mi->S, 4, (sum_len + 7) / 8, fp);
 	}
 	return mi;
 }
 
+mm_idx_t *mm_idx_load(FILE *fp)
+{
+	return mm_idx_load_core(fp, 0);
+}
+
 int64_t mm_idx_is_idx(const char *fn)
 {
 	int fd, is_idx = 0;
@@ -852,7 +894,7 @@ mm_idx_t *mm_idx_reader_read(mm_idx_reader_t *r, int n_threads)
 {
 	mm_idx_t *mi;
 	if (r->is_idx) {
-		mi = mm_idx_load(r->fp.idx);
+		mi = mm_idx_load_core(r->fp.idx, r->opt.flag & MM_I_NO_SEQ);
 		if (mi && mm_verbose >= 2 && (mi->k != r->opt.k || mi->w != r->opt.w || (mi->flag&MM_I_HPC) != (r->opt.flag&MM_I_HPC)))
 			fprintf(stderr, "[WARNING]\033[1;31m Indexing parameters (-k, -w or -H) overridden by parameters used in the prebuilt index.\033[0m\n");
 	} else
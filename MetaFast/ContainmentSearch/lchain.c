@@ -402,7 +402,7 @@ if(enable_vect_dp_chaining){
 
 
 #ifdef MANUAL_PROFILING
-	dp_time += __rdtsc() - align_start;
+	__sync_fetch_and_add(&dp_time, __rdtsc() - align_start); // shared by all mapping threads
 #endif
 	return compact_a(km, n_u, u, n_v, v, a);
 }
@@ -562,7 +562,7 @@ mm128_t *mg_lchain_rmq(int max_dist, int max_dist_inner, int bw, int max_chn_ski
 		return 0;
 	}
 #ifdef MANUAL_PROFILING
-	rmq_time += __rdtsc() -  start;
+	__sync_fetch_and_add(&rmq_time, __rdtsc() - start); // shared by all mapping threads
 #endif
 	return compact_a(km, n_u, u, n_v, v, a);
 }
@@ -46,6 +46,8 @@ Modified Copyright (C) 2021 Intel Corporation
 #include <unistd.h>
 #include <climits>
 #include "main.h"
+#include "prune.h"
+#include "placement.h"
 using namespace std;
 
 
@@ -146,6 +148,7 @@ static ko_longopt_t long_options[] = {
 	{ "chain-skip-scale",ko_required_argument,351 },
 	{ "print-chains",   ko_no_argument,       352 },
 	{ "no-hash-name",   ko_no_argument,       353 },
+	{ "dedup",          ko_optional_argument, 354 },
 	{ "help",           ko_no_argument,       'h' },
 	{ "max-intron-len", ko_required_argument, 'G' },
 	{ "version",        ko_no_argument,       'V' },
@@ -199,6 +202,8 @@ void* start_wrapper(void* arguments) {
 	for(int i = 0; i < args->argc; ++i)
 		printf("argv at %d is %s\n", i, args->argv[i]); */
 	//printf("outtbl pointer %p\n", args->out_table);
+	if ((*args->out_queue)->numa_node >= 0 && mm_numa_bind((*args->out_queue)->numa_node) < 0) // before the index is loaded
+		fprintf(stderr, "[WARNING] failed to bind the shard thread to NUMA node %d\n", (*args->out_queue)->numa_node);
 	start(args->argc, args->argv, args->out_queue);
 	return NULL;
 }
@@ -220,6 +225,7 @@ int start(int argc, char *argv[], ao_queue **out_queue)
 	FILE *fp_help = stderr;
 	mm_idx_reader_t *idx_rdr;
 	mm_idx_t *mi;
+	double t_mt;
 
 	mm_verbose = 3;
 	liftrlimit();
@@ -329,6 +335,10 @@ int start(int argc, char *argv[], ao_queue **out_queue)
 		else if (c == 350) opt.q_occ_frac = atof(o.arg); // --q-occ-frac
 		else if (c == 352) mm_dbg_flag |= MM_DBG_PRINT_CHAIN; // --print-chains
 		else if (c == 353) opt.flag |= MM_F_NO_HASH_NAME; // --no-hash-name
+		else if (c == 354) { // --dedup
+			opt.flag |= MM_F_DEDUP;
+			if (o.arg) opt.dedup_cache = atoi(o.arg);
+		}
 		else if (c == 330) {
 			fprintf(stderr, "[WARNING] \033[1;31m --lj-min-ratio has been deprecated.\033[0m\n");
 		} else if (c == 314) { // --frag
@@ -448,6 +458,7 @@ int start(int argc, char *argv[], ao_queue **out_queue)
 		fprintf(fp_help, "    -Y           use soft clipping for supplementary alignments\n");
 		fprintf(fp_help, "    -t INT       number of threads [%d]\n", n_threads);
 		fprintf(fp_help, "    -K NUM       minibatch size for mapping [500M]\n");
+		fprintf(fp_help, "    --dedup[=INT] score reads with identical or reverse-complementary sequences once; remember INT reads across batches [%d]\n", opt.dedup_cache);
 //		fprintf(fp_help, "    -v INT       verbose level [%d]\n", mm_verbose);
 		fprintf(fp_help, "    --version    show version number\n");
 		fprintf(fp_help, "  Preset:\n");
@@ -481,8 +492,10 @@ int start(int argc, char *argv[], ao_queue **out_queue)
 		fprintf(stderr, "[WARNING]\033[1;31m `-N 0' reduces alignment accuracy. Please use --secondary=no to suppress secondary alignments.\033[0m\n");
 	// klocwork fix
 	assert(n_threads > 0 && n_threads < INT_MAX);
+	t_mt = mm_metrics_clock();
 	while ((mi = mm_idx_reader_read(idx_rdr, n_threads)) != 0) {
 		int ret;
+		if (out_queue) mm_metrics_lap(&(*out_queue)->metrics, MM_MT_INDEX, &t_mt);
 		if ((opt.flag & MM_F_CIGAR) && (mi->flag & MM_I_NO_SEQ)) {
 			fprintf(stderr, "[ERROR] the prebuilt index doesn't contain sequences.\n");
 			mm_idx_destroy(mi);
@@ -532,8 +545,18 @@ int start(int argc, char *argv[], ao_queue **out_queue)
 #endif
 	mm_realtime0 = realtime();
 		if (!(opt.flag & MM_F_FRAG_MODE)) {
-			for (i = o.ind + 1; i < argc; ++i) {
-				ret = mm_map_file(mi, argv[i], &opt, n_threads, out_queue);
+			for (i = o.ind + 1; i < argc; ++i) { // with cs, each query file is a sample with its own queue
+				ao_queue **q = out_queue? out_queue + (i - (o.ind + 1)) : 0;
+				if (q && (*q)->prune) {
+					double ov = mm_prune_overlap((*q)->prune, mi, MM_PRUNE_PROBE);
+					if (mm_verbose >= 3)
+						fprintf(stderr, "[M::%s] estimated %.4f of the index minimizers in %s\n", __func__, ov, argv[i]);
+					if (ov >= 0.0 && ov < (*q)->prune_min) { // too little overlap to be worth mapping
+						fprintf(stderr, "[M::%s] skipped %s for %s: estimated overlap %.4f < %g\n", __func__, argv[o.ind], argv[i], ov, (*q)->prune_min);
+						continue;
+					}
+				}
+				ret = mm_map_file(mi, argv[i], &opt, n_threads, q);
 				if (ret < 0) break;
 			}
 		} else {
@@ -550,6 +573,7 @@ int start(int argc, char *argv[], ao_queue **out_queue)
 			fprintf(stderr, "ERROR: failed to map the query file\n");
 			exit(EXIT_FAILURE);
 		}
+		t_mt = mm_metrics_clock();
 	}
 	n_parts = idx_rdr->n_parts;
 	mm_idx_reader_close(idx_rdr);
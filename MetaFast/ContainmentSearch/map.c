@@ -41,6 +41,8 @@ Modified Copyright (C) 2021 Intel Corporation
 #include "khash.h"
 #include <x86intrin.h>
 #include "addonly_queue.h"
+#include "metrics.h"
+#include "dedup.h"
 
 #define DISABLE_OUTPUT
 
@@ -49,15 +51,22 @@ extern uint64_t minimizer_lookup_time;
 extern uint64_t rmq_time;
 #endif
 
+// reference scores of a read, kept to replay them for later copies of the read
+typedef std::vector<std::pair<std::string, unsigned long long> > dedup_hit_t;
+
 struct mm_tbuf_s {
 	void *km;
 	int rep_len, frag_gap;
+	mm_metrics_t mt;
+	uint32_t weight;   // number of copies of the read being mapped
+	dedup_hit_t **hit; // if not NULL, where to keep the scores of the read being mapped
 };
 
 mm_tbuf_t *mm_tbuf_init(void)
 {
 	mm_tbuf_t *b;
 	b = (mm_tbuf_t*)calloc(1, sizeof(mm_tbuf_t));
+	b->weight = 1;
 	if (!(mm_dbg_flag & 1)) b->km = km_init();
 	return b;
 }
@@ -250,7 +259,7 @@ static mm128_t *collect_seed_hits(void *km, const mm_mapopt_t *opt, int max_occ,
 	kfree(km, m);
 	radix_sort_128x(a, a + (*n_a));
 #ifdef MANUAL_PROFILING
-	minimizer_lookup_time += __rdtsc() - lookup_start;
+	__sync_fetch_and_add(&minimizer_lookup_time, __rdtsc() - lookup_start); // shared by all mapping threads
 #endif
 	return a;
 }
@@ -290,6 +299,7 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 	mm_reg1_t *regs0;
 	km_stat_t kmst;
 	float chn_pen_gap, chn_pen_skip;
+	double t_mt;
 
 	for (i = 0, qlen_sum = 0; i < n_segs; ++i)
 		qlen_sum += qlens[i], n_regs[i] = 0, regs[i] = 0;
@@ -301,10 +311,14 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 	hash ^= __ac_Wang_hash(qlen_sum) + __ac_Wang_hash(opt->seed);
 	hash  = __ac_Wang_hash(hash);
 
+	t_mt = mm_metrics_clock();
 	collect_minimizers(b->km, opt, mi, n_segs, qlens, seqs, &mv);
 	if (opt->q_occ_frac > 0.0f) mm_seed_mz_flt(b->km, &mv, opt->mid_occ, opt->q_occ_frac);
+	mm_metrics_lap(&b->mt, MM_MT_SKETCH, &t_mt);
 	if (opt->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, opt, opt->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
 	else a = collect_seed_hits(b->km, opt, opt->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+	mm_metrics_lap(&b->mt, MM_MT_LOOKUP, &t_mt);
+	b->mt.c[MM_MC_MINIMIZERS] += mv.n, b->mt.c[MM_MC_ANCHORS] += n_a;
 
 	if (mm_dbg_flag & MM_DBG_PRINT_SEED) {
 		fprintf(stderr, "RS\t%d\n", rep_len);
@@ -319,15 +333,19 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 		const int targetMap = std::hash<std::string>{}(name) % (*out_queue)->mapslen;
 		sc_asmaps[targetMap][name] += (unsigned long long)((int)(a[i].x));
 	}
+	if (b->hit) *b->hit = new dedup_hit_t();
 	for(int i = 0; i < (*out_queue)->mapslen; ++i) {
 		if(sc_asmaps[i].empty())
 			continue;
+		b->mt.c[MM_MC_CANDIDATES] += sc_asmaps[i].size();
+		if (b->hit) (*b->hit)->insert((*b->hit)->end(), sc_asmaps[i].begin(), sc_asmaps[i].end());
 		(*out_queue)->maps[i]->mutex.lock();
 		for(const auto& item : sc_asmaps[i]) {
-			(*(*out_queue)->maps[i]->map)[item.first] += item.second;
+			(*(*out_queue)->maps[i]->map)[item.first] += item.second * b->weight; // scores are additive over reads
 		}
 		(*out_queue)->maps[i]->mutex.unlock();
 	}
+	mm_metrics_lap(&b->mt, MM_MT_CAND, &t_mt);
 
 	/*
 	if (is_sr)
@@ -466,6 +484,7 @@ typedef struct {
 	uint32_t *rid_shift;
 	FILE *fp_split, **fp_parts;
 	ao_queue **out_queue;
+	mm_lru_t *dedup_cache; // scores of distinct reads of earlier batches; only used in step 1
 } pipeline_t;
 
 typedef struct {
@@ -475,6 +494,11 @@ typedef struct {
 	int *n_reg, *seg_off, *n_seg, *rep_len, *frag_gap;
 	mm_reg1_t **reg;
 	mm_tbuf_t **buf;
+	int32_t *dup;      // with MM_F_DEDUP: -1 to map, -2 if taken from the cache, or the index of the read with the same key
+	const char **key;  // with MM_F_DEDUP: the read or its reverse complement, whichever is smaller
+	char *key_rc;      // reverse complements that key[] points into
+	uint32_t *mult;    // with MM_F_DEDUP: number of copies of each read to map
+	dedup_hit_t **hit; // with a dedup cache: scores of the mapped reads
 } step_t;
 
 static void worker_for(void *_data, long i, int tid) // kt_for() callback
@@ -485,6 +509,8 @@ static void worker_for(void *_data, long i, int tid) // kt_for() callback
 	double t = 0.0;
 	mm_tbuf_t *b = s->buf[tid];
 	assert(s->n_seg[i] <= MM_MAX_SEG);
+	if (s->dup && s->dup[i] != -1) return; // scored with another copy or by dedup_lookup()
+	if (s->dup) b->weight = s->mult[i], b->hit = s->hit? &s->hit[i] : 0;
 	//klocwork fix
 	memset(&qlens[0], 0, MM_MAX_SEG*sizeof(int));
 	if (mm_dbg_flag & MM_DBG_PRINT_QNAME) {
@@ -597,6 +623,36 @@ static void merge_hits(step_t *s)
 	km_destroy(km);
 }
 
+static void dedup_hit_destroy(void *h)
+{
+	delete (dedup_hit_t*)h;
+}
+
+static void dedup_lookup(step_t *s) // before mapping: replay the scores of reads seen in earlier batches
+{
+	const pipeline_t *p = s->p;
+	int i;
+	for (i = 0; i < s->n_seq; ++i) {
+		const dedup_hit_t *h;
+		if (s->dup[i] != -1 || (h = (const dedup_hit_t*)mm_lru_get(p->dedup_cache, s->key[i])) == 0) continue;
+		for (const auto& item : *h) {
+			const int targetMap = std::hash<std::string>{}(item.first) % (*p->out_queue)->mapslen;
+			(*p->out_queue)->maps[targetMap]->mutex.lock();
+			(*(*p->out_queue)->maps[targetMap]->map)[item.first] += item.second * s->mult[i];
+			(*p->out_queue)->maps[targetMap]->mutex.unlock();
+		}
+		s->dup[i] = -2;
+		++s->buf[0]->mt.c[MM_MC_DEDUP];
+	}
+}
+
+static void dedup_remember(step_t *s) // after mapping: keep the scores of the new sequences
+{
+	int i;
+	for (i = 0; i < s->n_seq; ++i)
+		if (s->hit[i]) mm_lru_put(s->p->dedup_cache, s->key[i], s->hit[i]), s->hit[i] = 0;
+}
+
 static void *worker_pipeline(void *shared, int step, void *in)
 {
 	int i, j, k;
@@ -605,6 +661,7 @@ static void *worker_pipeline(void *shared, int step, void *in)
 		int with_qual = (!!(p->opt->flag & MM_F_OUT_SAM) && !(p->opt->flag & MM_F_NO_QUAL));
 		int with_comment = !!(p->opt->flag & MM_F_COPY_COMMENT);
 		int frag_mode = (p->n_fp > 1 || !!(p->opt->flag & MM_F_FRAG_MODE));
+		double t_mt = mm_metrics_clock();
         step_t *s;
         s = (step_t*)calloc(1, sizeof(step_t));
 		if (p->n_fp > 1) s->seq = mm_bseq_read_frag2(p->n_fp, p->fp, p->mini_batch_size, with_qual, with_comment, &s->n_seq);
@@ -616,6 +673,10 @@ static void *worker_pipeline(void *shared, int step, void *in)
 			s->buf = (mm_tbuf_t**)calloc(p->n_threads, sizeof(mm_tbuf_t*));
 			for (i = 0; i < p->n_threads; ++i)
 				s->buf[i] = mm_tbuf_init();
+			for (i = 0; i < s->n_seq; ++i)
+				s->buf[0]->mt.c[MM_MC_BASES] += s->seq[i].l_seq;
+			s->buf[0]->mt.c[MM_MC_READS] += s->n_seq;
+			mm_metrics_lap(&s->buf[0]->mt, MM_MT_PARSE, &t_mt); // like the mapping metrics, folded into the shard in step 2
 			s->n_reg = (int*)calloc(5 * s->n_seq, sizeof(int));
 			s->seg_off = s->n_reg + s->n_seq; // seg_off, n_seg, rep_len and frag_gap are allocated together with n_reg
 			s->n_seg = s->seg_off + s->n_seq;
@@ -628,17 +689,36 @@ static void *worker_pipeline(void *shared, int step, void *in)
 					s->seg_off[s->n_frag++] = j;
 					j = i;
 				}
+			if ((p->opt->flag & MM_F_DEDUP) && !(p->opt->flag & (MM_F_NO_DIAG|MM_F_NO_DUAL)) && s->n_frag == s->n_seq && p->n_parts == 0) { // no mate pairs and no name-dependent seeds
+				s->key = (const char**)malloc(s->n_seq * sizeof(const char*));
+				s->key_rc = mm_dedup_canonical(s->n_seq, s->seq, s->key); // the scores add up reference positions, which both strands share
+				s->dup = mm_dedup_batch(s->n_seq, s->seq, s->key);
+				s->mult = (uint32_t*)calloc(s->n_seq, sizeof(uint32_t));
+				for (i = 0; i < s->n_seq; ++i)
+					if (s->dup[i] < 0) ++s->mult[i];
+					else ++s->mult[s->dup[i]], ++s->buf[0]->mt.c[MM_MC_DEDUP];
+				if (p->dedup_cache) s->hit = (dedup_hit_t**)calloc(s->n_seq, sizeof(dedup_hit_t*));
+			}
 			return s;
 		} else free(s);
     } else if (step == 1) { // step 1: map
-		if (p->n_parts > 0) merge_hits((step_t*)in);
-		else kt_for(p->n_threads, worker_for, in, ((step_t*)in)->n_frag);
+		step_t *s = (step_t*)in;
+		if (p->n_parts > 0) merge_hits(s);
+		else {
+			if (s->hit) dedup_lookup(s);
+			kt_for(p->n_threads, worker_for, in, s->n_frag);
+			if (s->hit) dedup_remember(s);
+		}
 		return in;
     } else if (step == 2) { // step 2: output
 		void *km = 0;
         step_t *s = (step_t*)in;
 		const mm_idx_t *mi = p->mi;
-		for (i = 0; i < p->n_threads; ++i) mm_tbuf_destroy(s->buf[i]);
+		double t_mt = mm_metrics_clock();
+		for (i = 0; i < p->n_threads; ++i) { // fold the per-thread metrics; steps 2 of different batches never overlap
+			if (p->out_queue) mm_metrics_add(&(*p->out_queue)->metrics, &s->buf[i]->mt);
+			mm_tbuf_destroy(s->buf[i]);
+		}
 		free(s->buf);
 		if ((p->opt->flag & MM_F_OUT_CS) && !(mm_dbg_flag & MM_DBG_NO_KALLOC)) km = km_init();
 		for (k = 0; k < s->n_frag; ++k) {
@@ -682,13 +762,13 @@ static void *worker_pipeline(void *shared, int step, void *in)
 			for (i = seg_st; i < seg_en; ++i) {
 				for (j = 0; j < s->n_reg[i]; ++j) free(s->reg[i][j].p);
 				free(s->reg[i]);
-				free(s->seq[i].seq); free(s->seq[i].name);
-				if (s->seq[i].qual) free(s->seq[i].qual);
-				if (s->seq[i].comment) free(s->seq[i].comment);
 			}
 		}
-		free(s->reg); free(s->n_reg); free(s->seq); // seg_off, n_seg, rep_len and frag_gap were allocated with reg; no memory leak here
+		mm_bseq_free(s->n_seq, s->seq);
+		free(s->dup); free(s->mult); free(s->hit); free(s->key); free(s->key_rc);
+		free(s->reg); free(s->n_reg); // seg_off, n_seg, rep_len and frag_gap were allocated with reg; no memory leak here
 		km_destroy(km);
+		if (p->out_queue) mm_metrics_lap(&(*p->out_queue)->metrics, MM_MT_OUTPUT, &t_mt);
 		if (mm_verbose >= 3)
 			fprintf(stderr, "[M::%s::%.3f*%.2f] mapped %d sequences\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), s->n_seq);
 		free(s);
@@ -730,8 +810,11 @@ int mm_map_file_frag(const mm_idx_t *idx, int n_segs, const char **fn, const mm_
 		pl.fp_split = mm_split_init(opt->split_prefix, idx);
 	pl_threads = n_threads == 1? 1 : (opt->flag&MM_F_2_IO_THREADS)? 3 : 2;
 	pl.out_queue = out_queue;
+	if (opt->flag & MM_F_DEDUP)
+		pl.dedup_cache = mm_lru_init(opt->dedup_cache, dedup_hit_destroy);
 	kt_pipeline(pl_threads, worker_pipeline, &pl, 3);
 
+	mm_lru_destroy(pl.dedup_cache);
 	free(pl.str.s);
 	if (pl.fp_split) fclose(pl.fp_split);
 	for (i = 0; i < pl.n_fp; ++i)
@@ -106,6 +106,7 @@ Modified Copyright (C) 2021 Intel Corporation
 #define MM_F_QSTRAND       (0x100000000LL)
 #define MM_F_NO_INV        (0x200000000LL)
 #define MM_F_NO_HASH_NAME  (0x400000000LL)
+#define MM_F_DEDUP         (0x800000000LL)
 
 #define MM_I_HPC          0x1
 #define MM_I_NO_SEQ       0x2
@@ -152,6 +153,7 @@ typedef struct {
 	uint32_t *S;               // 4-bit packed sequence
 	struct mm_idx_bucket_s *B; // index (hidden)
 	struct mm_idx_intv_s *I;   // intervals (hidden)
+	uint64_t *p_pool;          // if set, the position arrays of all buckets are in this block
 	void *km, *h;
 } mm_idx_t;
 
@@ -238,6 +240,7 @@ typedef struct {
 	int64_t mini_batch_size; // size of a batch of query bases to process in parallel
 	int64_t max_sw_mat;
 	int64_t cap_kalloc;
+	int32_t dedup_cache; // with MM_F_DEDUP, number of distinct reads remembered across batches
 
 	const char *split_prefix;
 } mm_mapopt_t;
@@ -306,7 +309,9 @@ mm_idx_reader_t *mm_idx_reader_open(const char *fn, const mm_idxopt_t *opt, cons
  * this function constructs the index for about mm_idxopt_t::batch_size bases.
  * Importantly, for a huge collection of sequences, this function may only
  * return an index for part of sequences. It needs to be repeatedly called
- * to traverse the entire index/sequence file.
+ * to traverse the entire index/sequence file. If mm_idxopt_t::flag has
+ * MM_I_NO_SEQ, the reference sequences of an index file are skipped and not
+ * loaded, as if the index had been built without them.
  *
  * @param r          index reader
  * @param n_threads  number of threads for constructing index
@@ -6,8 +6,10 @@
 #include <stdbool.h>
 #include <getopt.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <map>
+#include <vector>
 #include <thread>
 #include <chrono>
 #include <fstream>
@@ -15,6 +17,28 @@
 #include <algorithm>
 
 #include "main.h"
+#include "metrics.h"
+#include "fmh.h"
+#include "prune.h"
+#include "catalog.h"
+#include "builddb.h"
+#include "placement.h"
+
+static struct option long_options[] = {
+    { "metrics", required_argument, NULL, 300 },
+    { "dedup",   optional_argument, NULL, 301 },
+    { "sketch",       no_argument,       NULL, 302 },
+    { "build-sketch", no_argument,       NULL, 303 },
+    { "sketch-k",     required_argument, NULL, 304 },
+    { "scaled",       required_argument, NULL, 305 },
+    { "prune",        required_argument, NULL, 306 },
+    { "prune-bits",   required_argument, NULL, 307 },
+    { "numa",         no_argument,       NULL, 308 },
+    { "huge-pages",   no_argument,       NULL, 309 },
+    { "samples",      required_argument, NULL, 310 },
+    { "cache",        required_argument, NULL, 311 },
+    { NULL, 0, NULL, 0 }
+};
 
 int str_ends_with(const char *str, const char *suffix) {
     if (!str || !suffix)
@@ -31,19 +55,328 @@ bool dirfilter(const struct dirent *const entry) {
         entry->d_type == 4); //filter directories
 }
 static void usage(char* myname) {
-    fprintf(stderr, "Usage: %s [-n <int: minimizer-cutoff>] [-b] [-t <int: nuimber of subthreads in minimap>] <mmidir> <readsfile> <translationfile> <outfile>\n", myname);
+    fprintf(stderr, "Usage: %s [-n <int: minimizer-cutoff>] [-b] [-t <int: nuimber of subthreads in minimap>] [--metrics <json: per-stage and per-shard metrics>] [--dedup[=<int: distinct reads remembered across batches>]] [--sketch] [--prune <float: skip shards with a smaller estimated minimizer overlap>] [--prune-bits <int: log2 bitmap size, default 30>] [--numa] [--huge-pages] [--cache <dir: count vectors kept across runs>] <mmidir> <readsfile> <translationfile or metafast-db catalog> <outfile>\n", myname);
+    fprintf(stderr, "       %s [options] --samples <manifest: one \"<readsfile> <outfile>\" per line> <mmidir> <translationfile or metafast-db catalog>\n", myname);
+    fprintf(stderr, "       %s build-db [-k <int>] [-w <int>] [-t <int>] [-T <translationfile>] [-S] [-f] <organism_files> <mmidir>\n", myname);
+    fprintf(stderr, "       %s --build-sketch [--sketch-k <int: k-mer length, default 21>] [--scaled <int: keep 1 in this many k-mers, default 1000>] <mmidir>\n", myname);
     exit(1);
 }
 
+// shards from the largest, each to the NUMA node with the fewest bytes of shards so far
+static std::map<std::string, int> assign_numa_nodes(const char *mmidir, int n_nodes) {
+    std::vector<std::pair<off_t, std::string>> shards;
+    std::vector<off_t> load(n_nodes, 0);
+    std::map<std::string, int> node;
+    DIR *inDir = opendir(mmidir);
+    struct dirent *entry;
+    while((entry = readdir(inDir)) != NULL) {
+        struct stat st;
+        if(dirfilter(entry))
+            continue;
+        std::string fn = std::string(mmidir) + "/" + entry->d_name;
+        if(stat(fn.c_str(), &st) == 0)
+            shards.push_back(std::make_pair(st.st_size, std::string(entry->d_name)));
+    }
+    closedir(inDir);
+    std::sort(shards.rbegin(), shards.rend());
+    for(const auto &shard : shards) {
+        int best = std::min_element(load.begin(), load.end()) - load.begin();
+        load[best] += shard.first;
+        node[shard.second] = best;
+    }
+    return node;
+}
+
+// the samples of a manifest, one "<readsfile> <outfile>" per line; empty lines and lines from '#' on are skipped
+static int read_manifest(const char *fn, std::vector<char*> &reads, std::vector<const char*> &out_paths) {
+    std::ifstream manifest(fn);
+    std::string line;
+    if(!manifest) {
+        fprintf(stderr, "ERROR: failed to open %s\n", fn);
+        return -1;
+    }
+    while(getline(manifest, line)) {
+        std::string rd, out, rest;
+        std::stringstream ls(line.substr(0, line.find('#')));
+        if(!(ls >> rd))
+            continue;
+        if(!(ls >> out) || (ls >> rest)) {
+            fprintf(stderr, "ERROR: expected \"<readsfile> <outfile>\" in %s, got: %s\n", fn, line.c_str());
+            return -1;
+        }
+        FILE *test_exist = fopen(out.c_str(), "w");
+        if(test_exist)
+            fclose(test_exist);
+        reads.push_back(realpath(rd.c_str(), NULL));
+        out_paths.push_back(realpath(out.c_str(), NULL));
+        if(!reads.back() || !out_paths.back()) {
+            fprintf(stderr, "ERROR: failed to resolve %s or %s of %s\n", rd.c_str(), out.c_str(), fn);
+            return -1;
+        }
+    }
+    if(reads.empty()) {
+        fprintf(stderr, "ERROR: no samples in %s\n", fn);
+        return -1;
+    }
+    return 0;
+}
+
+// "<path>:<size>:<mtime>" of a file, which changes whenever the file is rewritten; empty if it can't be stat'ed
+static std::string file_fingerprint(const char *fn) {
+    struct stat st;
+    if(stat(fn, &st) != 0)
+        return "";
+    return std::string(fn) + ":" + std::to_string((long long)st.st_size) + ":" + std::to_string((long long)st.st_mtime);
+}
+
+// the count vector of a shard for a sample is cached in <dir>/<shard>.<FNV-1a of key>.cnt, whose first line is the key
+static std::string cache_path(const char *cache_dir, const char *shard, const std::string &key) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    char hex[17];
+    for(unsigned char c : key)
+        h = (h ^ c) * 0x100000001b3ULL;
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+    return std::string(cache_dir) + "/" + shard + "." + hex + ".cnt";
+}
+
+static int cache_load(const std::string &fn, const std::string &key, std::unordered_map<std::string, unsigned long long> &counts) {
+    std::ifstream in(fn);
+    std::string line, name;
+    unsigned long long cnt;
+    if(!getline(in, line) || line != key) // absent, or a hash collision
+        return -1;
+    while(in >> name >> cnt)
+        counts[name] += cnt;
+    return in.eof()? 0 : -1;
+}
+
+// written to a temporary file first, so that an interrupted run never leaves a truncated vector behind
+static int cache_dump(const std::string &fn, const std::string &key, const ao_queue *q) {
+    std::map<std::string, unsigned long long> counts;
+    for(auto mapStruct : q->maps)
+        for(auto &it : *mapStruct->map)
+            counts[it.first] += it.second;
+    const std::string tmp = fn + ".tmp";
+    std::ofstream out(tmp);
+    out << key << "\n";
+    for(const auto &it : counts)
+        out << it.first << "\t" << it.second << "\n";
+    out.close();
+    if(!out || rename(tmp.c_str(), fn.c_str()) != 0) {
+        remove(tmp.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+// writes the FracMinHash sketch of every X.mmi in mmidir to X.mmi.fmh
+static int build_sketches(const char *mmidir, int k, uint64_t scaled) {
+    DIR *inDir = opendir(mmidir);
+    struct dirent *entry;
+    if(!inDir) {
+        fprintf(stderr, "ERROR: failed to open %s\n", mmidir);
+        return 1;
+    }
+    while((entry = readdir(inDir)) != NULL) {
+        if(dirfilter(entry))
+            continue;
+        std::string inp = std::string(mmidir) + "/" + entry->d_name;
+        std::string out = inp + MM_FMH_SUFFIX;
+        mm_fmh_t *sk = mm_fmh_idx(inp.c_str(), k, scaled);
+        if(!sk) {
+            fprintf(stderr, "ERROR: failed to sketch %s; the index has to keep the reference sequences\n", inp.c_str());
+            return 1;
+        }
+        if(mm_fmh_dump(out.c_str(), sk) < 0) {
+            fprintf(stderr, "ERROR: failed to write %s\n", out.c_str());
+            return 1;
+        }
+        fprintf(stderr, "sketched %u sequences of %s\n", sk->n_seq, inp.c_str());
+        mm_fmh_destroy(sk);
+    }
+    closedir(inDir);
+    return 0;
+}
+
+// containment of each reference sequence: hashes shared with the reads, and its sketch size
+static int search_sketches(const char *mmidir, const char *reads, mm_metrics_t *metrics,
+        std::map<std::string, unsigned long long> &hits, std::map<std::string, unsigned long long> &sizes) {
+    mm_fmh_buf_t rs = {0, 0, 0};
+    int k = 0;
+    uint64_t scaled = 0;
+    double t = mm_metrics_clock();
+    DIR *inDir = opendir(mmidir);
+    struct dirent *entry;
+    int ret = 0;
+    if(!inDir) {
+        fprintf(stderr, "ERROR: failed to open %s\n", mmidir);
+        return -1;
+    }
+    while(ret == 0 && (entry = readdir(inDir)) != NULL) {
+        if(dirfilter(entry))
+            continue;
+        std::string fn = std::string(mmidir) + "/" + entry->d_name + MM_FMH_SUFFIX;
+        mm_fmh_t *sk = mm_fmh_load(fn.c_str());
+        if(!sk) {
+            fprintf(stderr, "ERROR: failed to load %s; build it with --build-sketch\n", fn.c_str());
+            ret = -1;
+            break;
+        }
+        mm_metrics_lap(metrics, MM_MT_INDEX, &t);
+        if(k == 0) { // the reads are sketched with the parameters of the first shard
+            k = sk->k, scaled = sk->scaled;
+            if(mm_fmh_file(reads, k, scaled, &rs) < 0) {
+                fprintf(stderr, "ERROR: failed to open %s\n", reads);
+                ret = -1;
+            }
+            fprintf(stderr, "sketched the reads to %zu hashes (k=%d, scaled=%llu)\n", rs.n, k, (unsigned long long)scaled);
+            mm_metrics_lap(metrics, MM_MT_SKETCH, &t);
+        } else if(sk->k != k || sk->scaled != scaled) {
+            fprintf(stderr, "ERROR: %s was built with other sketch parameters\n", fn.c_str());
+            ret = -1;
+        }
+        for(uint32_t i = 0; ret == 0 && i < sk->n_seq; ++i) {
+            hits[sk->seq[i].name] += mm_fmh_intersect(rs.n, rs.a, sk->seq[i].n, sk->seq[i].a);
+            sizes[sk->seq[i].name] += sk->seq[i].n;
+        }
+        mm_metrics_lap(metrics, MM_MT_LOOKUP, &t);
+        mm_fmh_destroy(sk);
+    }
+    closedir(inDir);
+    free(rs.a);
+    return ret;
+}
+
+// sums the hits of the reference sequences of each taxon and writes the taxa scaled to the top one;
+// with sizes, a taxon scores the fraction of its sketch found in the reads instead
+static void write_results(const char *tr_sorted_path, const char *out_path, const std::map<std::string, unsigned long long> &merged_map,
+        const std::map<std::string, unsigned long long> *sizes) {
+    const char *out_format = "taxid_%s_genomic.fna.gz,%f\n";
+    fprintf(stderr, "len is %ld\n", merged_map.size());
+    double max_hits = 0;
+    std::ifstream trsorted_file(tr_sorted_path);
+    std::string line;
+    std::unordered_map<std::string, unsigned long long> outmap, outsize;
+    std::map<std::string, unsigned long long>::const_iterator it = merged_map.begin();
+    mf_db_t *db = mf_db_is_db(tr_sorted_path)? mf_db_load(tr_sorted_path) : NULL;
+    for(; db && it != merged_map.end(); ++it) { // compiled by metafast-db: look the accessions up instead of joining
+        const int32_t tid = mf_db_acc2taxon(db, it->first.c_str());
+        if(tid < 0)
+            continue;
+        const std::string newKey(mf_db_str(db, db->taxa[tid].taxid));
+        outmap[newKey] += it->second;
+        if(sizes)
+            outsize[newKey] += sizes->at(it->first);
+    }
+    mf_db_destroy(db);
+    while(getline(trsorted_file, line) && it != merged_map.end()) {
+        std::string key;
+        std::stringstream ls(line);
+        getline(ls, key, ' ');
+        const int cmp = it->first.compare(key);
+        if(cmp < 0 && it != merged_map.begin())
+            fprintf(stderr, "ERROR: SORTING IS WRONG, seen %s < %s\n", it->first.c_str(), key.c_str());
+        if(cmp != 0)
+            continue;
+        std::string newKey;
+        getline(ls, newKey, ' ');
+        outmap[newKey] += it->second;
+        if(sizes)
+            outsize[newKey] += sizes->at(it->first);
+        ++it;
+    }
+    std::unordered_map<std::string, double> score;
+    for(const auto& item : outmap) {
+        double sc = sizes? (outsize[item.first]? (double)item.second/outsize[item.first] : 0.0) : (double)item.second;
+        score[item.first] = sc;
+        if(sc > max_hits)
+            max_hits = sc;
+    }
+    std::ofstream outfile(out_path);
+    for(const auto& item : score) {
+        std::string formattedKey(item.first);
+        std::replace(formattedKey.begin(), formattedKey.end(), '.', '_');
+        printf(out_format, formattedKey.c_str(), item.second/max_hits);
+        outfile << "taxid_" << formattedKey << "_genomic.fna.gz," << item.second/max_hits << "\n";
+    }
+    outfile.close();
+    printf("%s\n", out_path);
+}
+
 int main(int argc, char *argv[]) {
     int opt;
     char *n = "3";
     char *t = "1";
     char *one = "1"; //fallback for sequential flag
     bool sequential = false;
+    const char *metrics_path = NULL;
+    char *dedup = NULL; // passed on to minimap as is
+    bool sketch = false, build_sketch = false;
+    int sketch_k = 21;
+    uint64_t scaled = 1000;
+    double prune_min = 0.0;
+    int prune_bits = 30;
+    bool numa = false;
+    const char *manifest_path = NULL;
+    const char *cache_dir = NULL;
 
-    while ((opt = getopt(argc, argv, "bn:t:")) != -1) {
+    if(argc > 1 && strcmp(argv[1], "build-db") == 0)
+        return build_db_main(argc - 1, argv + 1);
+    while ((opt = getopt_long(argc, argv, "bn:t:", long_options, NULL)) != -1) {
         switch (opt) {
+        case 300:
+            metrics_path = optarg;
+            mm_metrics_on = 1;
+            break;
+        case 301:
+            dedup = argv[optind - 1];
+            break;
+        case 302:
+            sketch = true;
+            break;
+        case 303:
+            build_sketch = true;
+            break;
+        case 304:
+            sketch_k = atoi(optarg);
+            if(sketch_k < 1 || sketch_k > 31) {
+                fprintf(stderr, "--sketch-k has to be between 1 and 31, got: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 305:
+            scaled = strtoull(optarg, NULL, 10);
+            if(scaled < 1) {
+                fprintf(stderr, "--scaled has to be a positive number, got: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 306:
+            prune_min = atof(optarg);
+            if(prune_min < 0.0 || prune_min > 1.0) {
+                fprintf(stderr, "--prune has to be between 0 and 1, got: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 307:
+            prune_bits = atoi(optarg);
+            if(prune_bits < 6 || prune_bits > 40) {
+                fprintf(stderr, "--prune-bits has to be between 6 and 40, got: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 308:
+            numa = true;
+            break;
+        case 309:
+            mm_huge_pages = 1; // read by mm_idx_load() in every shard thread
+            break;
+        case 310:
+            manifest_path = optarg;
+            break;
+        case 311:
+            cache_dir = optarg;
+            break;
         case 'b':
             sequential = true;
             break;
@@ -73,29 +406,60 @@ int main(int argc, char *argv[]) {
             usage(argv[0]);
         }
     }
-    if(argc != optind + 4)
+    if(build_sketch) {
+        if(argc != optind + 1)
+            usage(argv[0]);
+        return build_sketches(argv[optind], sketch_k, scaled);
+    }
+    if(argc != optind + (manifest_path? 2 : 4))
         usage(argv[0]);
+    // every sample has its reads and its results; without a manifest, the one on the command line
+    std::vector<char*> reads;
+    std::vector<const char*> out_paths;
+    if(manifest_path && read_manifest(manifest_path, reads, out_paths) < 0)
+        return 1;
     const char *mmidir = realpath(argv[optind++], NULL);
-    char *reads = realpath(argv[optind++], NULL);
+    if(!manifest_path)
+        reads.push_back(realpath(argv[optind++], NULL));
     const char *tr_sorted_path = realpath(argv[optind++], NULL);
-    FILE *test_exist = fopen(argv[optind], "w");
-    fclose(test_exist);
-    const char *out_path = realpath(argv[optind], NULL);
-    if(!mmidir || !reads || !tr_sorted_path || !out_path) {
+    if(!manifest_path) {
+        FILE *test_exist = fopen(argv[optind], "w");
+        fclose(test_exist);
+        out_paths.push_back(realpath(argv[optind], NULL));
+    }
+    const int n_samples = reads.size();
+    if(!mmidir || !reads[0] || !tr_sorted_path || !out_paths[0]) {
         fprintf(stderr, "ERROR: Resolved inputs like this:\n");
         fprintf(stderr, "Found -n %s?, -b set %d?, -t %s?, mmi %s?, reads %s?, tr %s?, out %s?\n",
-            n, sequential, t, mmidir, reads, tr_sorted_path, out_path);
+            n, sequential, t, mmidir, reads[0], tr_sorted_path, out_paths[0]);
         return 1;
     }
     fprintf(stderr, "Found -n %s?, -b set %d?, -t %s?, mmi %s?, reads %s?, tr %s?, out %s?\n",
-            n, sequential, t, mmidir, reads, tr_sorted_path, out_path);
-    const char *out_format = "taxid_%s_genomic.fna.gz,%f\n";
+            n, sequential, t, mmidir, reads[0], tr_sorted_path, out_paths[0]);
+    if(n_samples > 1)
+        fprintf(stderr, "%d samples from %s, each shard is loaded once for all of them\n", n_samples, manifest_path);
     const int mmidirlen = strlen(mmidir);
 
     if(sequential) {
         fprintf(stderr, "Sequential flag set (-b), overriding -t to 1\n");
         t = one;
     }
+    if(sketch) { // the sketches are small enough to be loaded again for every sample
+        mm_metrics_t total_metrics = {};
+        for(int s = 0; s < n_samples; ++s) {
+            std::map<std::string, unsigned long long> hits, sizes;
+            if(search_sketches(mmidir, reads[s], &total_metrics, hits, sizes) < 0)
+                return 1;
+            double merge_start = mm_metrics_clock();
+            write_results(tr_sorted_path, out_paths[s], hits, &sizes);
+            mm_metrics_lap(&total_metrics, MM_MT_MERGE, &merge_start);
+        }
+        if(metrics_path && mm_metrics_dump(metrics_path, &total_metrics, 0, NULL, NULL) < 0) {
+            fprintf(stderr, "ERROR: failed to write metrics to %s\n", metrics_path);
+            return 1;
+        }
+        return 0;
+    }
 
     DIR *inDir = opendir(mmidir);
     struct dirent *entry;
@@ -107,8 +471,28 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "fCnt is %d\n", fCnt);
     inDir = opendir(mmidir);
 
+    std::map<std::string, int> numa_node;
+    if(numa) {
+        const int n_nodes = mm_numa_n_nodes();
+        if(n_nodes > 1)
+            numa_node = assign_numa_nodes(mmidir, n_nodes);
+        fprintf(stderr, "%d NUMA node(s); %s\n", n_nodes, n_nodes > 1 ? "binding the shard threads" : "nothing to bind");
+    }
+
+    mm_metrics_t prune_metrics = {};
     pthread_t threads[fCnt];
-    ao_queue *table_queues[fCnt];
+    std::vector<ao_queue*> table_queues(fCnt * n_samples); // of shard i and sample s at i*n_samples+s
+    std::vector<mm_prune_t*> prune(n_samples, (mm_prune_t*)NULL);
+    std::vector<bool> started(fCnt, false);
+    std::vector<std::string> cache_keys(cache_dir? fCnt * n_samples : 0); // of the count vectors to write back
+    std::vector<std::string> read_fps;
+    if(cache_dir) {
+        mkdir(cache_dir, 0755);
+        for(int s = 0; s < n_samples; ++s)
+            read_fps.push_back(file_fingerprint(reads[s]));
+    }
+    int n_cached = 0;
+    char *shard_names[fCnt];
     
     int i = 0;
     while((entry = readdir(inDir)) != NULL) {
@@ -120,35 +504,88 @@ int main(int argc, char *argv[]) {
         char *inp = (char*) malloc(sizeof(*inp) * inpsize);
         snprintf(inp, inpsize, mmidir[mmidirlen-1] == '/' ? "%s%.0s%s" : "%s%s%s", mmidir, "/", currFile);
         printf("got file %s\n", inp);
+        shard_names[i] = inp;
 
-        char *minimap_argv[] = { "./minimap2", "-n", n, "-t", t, &inp[0], reads, NULL };
-        int minimap_argc = (int)(sizeof(minimap_argv) / sizeof(minimap_argv[0])) - 1;
-        int argv_size = sizeof(char*)*(&(minimap_argv[minimap_argc])-&(minimap_argv[0]));
+        const int mapcnt = atoi(t);
+        std::vector<int> todo; // samples without a cached count vector for this shard
+        for(int s = 0; s < n_samples; ++s) {
+            ao_queue *q = table_queues[i * n_samples + s] = new ao_queue();
+            for(int j = 0; j < mapcnt; ++j){
+                q->maps.push_back(new specific_map());
+                q->maps.back()->map = new std::unordered_map<std::string, unsigned long long>();
+            }
+            q->mapslen = mapcnt;
+            q->prune_min = prune_min;
+            q->numa_node = numa_node.count(currFile) ? numa_node[currFile] : -1;
+            int k, w, flag;
+            if(cache_dir && !read_fps[s].empty() && mm_idx_read_param(inp, &k, &w, &flag) == 0) {
+                // everything the counts depend on; -t, --dedup, --numa and --huge-pages don't change them
+                std::string key = read_fps[s] + " " + file_fingerprint(inp) + " n=" + n + " k=" + std::to_string(k) + " w=" + std::to_string(w);
+                if(prune_min > 0.0)
+                    key += " prune=" + std::to_string(prune_min) + "/" + std::to_string(prune_bits);
+                if(cache_load(cache_path(cache_dir, currFile, key), key, *q->maps[0]->map) == 0) {
+                    ++n_cached;
+                    continue;
+                }
+                q->maps[0]->map->clear();
+                cache_keys[i * n_samples + s] = key;
+            }
+            todo.push_back(s);
+        }
+        if(todo.empty()) { // nothing left to map, so the shard is not even loaded
+            fprintf(stderr, "all samples of %s cached\n", inp);
+            ++i;
+            continue;
+        }
+
+        for(int s : todo) { // the shards share -k/-w, so the first one mapped tells how to sketch the reads
+            int k, w, flag;
+            if(prune_min <= 0.0 || prune[s])
+                continue;
+            double prune_start = mm_metrics_clock();
+            if(mm_idx_read_param(inp, &k, &w, &flag) < 0 || (prune[s] = mm_prune_init(reads[s], k, w, flag & MM_I_HPC, prune_bits, atoi(t))) == NULL) {
+                fprintf(stderr, "ERROR: failed to build the read minimizer bitmap from %s and %s\n", inp, reads[s]);
+                return 1;
+            }
+            mm_metrics_lap(&prune_metrics, MM_MT_SKETCH, &prune_start);
+            fprintf(stderr, "read minimizers of %s set %.4f of the 2^%d bitmap bits\n", reads[s], prune[s]->fill, prune_bits);
+        }
+
+        // minimap maps the shard against the query files in turn, the reads of each sample into the queue of that sample
+        std::vector<char*> minimap_argv = { "./minimap2", "-n", n, "-t", t, &inp[0] };
+        ao_queue **shard_queues = (ao_queue**) malloc(sizeof(*shard_queues) * todo.size());
+        for(size_t j = 0; j < todo.size(); ++j) {
+            minimap_argv.push_back(reads[todo[j]]);
+            shard_queues[j] = table_queues[i * n_samples + todo[j]];
+            shard_queues[j]->prune = prune[todo[j]];
+        }
+        if(dedup)
+            minimap_argv.push_back(dedup);
+        int minimap_argc = minimap_argv.size();
+        minimap_argv.push_back(NULL);
+        int argv_size = sizeof(char*)*minimap_argv.size();
         char **minimap_argv_heap = (char**) malloc(argv_size);
-        memcpy(minimap_argv_heap, minimap_argv, argv_size);
+        memcpy(minimap_argv_heap, minimap_argv.data(), argv_size);
 
         startargs *arguments = (startargs*) malloc(sizeof(*arguments));
         arguments->argc = minimap_argc;
         arguments->argv = minimap_argv_heap;
 
-        const int mapcnt = atoi(t);
-        table_queues[i] = new ao_queue();
-        for(int j = 0; j < mapcnt; ++j){
-            table_queues[i]->maps.push_back(new specific_map());
-            table_queues[i]->maps.back()->map = new std::unordered_map<std::string, unsigned long long>();
-        }
-        table_queues[i]->mapslen = mapcnt;
-        arguments->out_queue = &(table_queues[i]);
+        arguments->out_queue = shard_queues;
 
         fprintf(stderr, "Creating thread %d\n",i);
 
+        started[i] = true;
         if(!sequential)
-            pthread_create(&threads[i++], NULL, start_wrapper, (void *)arguments);
+            pthread_create(&threads[i], NULL, start_wrapper, (void *)arguments);
         else
             start_wrapper(arguments);
+        ++i;
     }
     if(!sequential) {
         for(int i = 0; i < fCnt; i++) {
+            if(!started[i])
+                continue;
             if(pthread_join(threads[i], NULL) != 0)
                 fprintf(stderr, "Error on join thread %d\n",i);
             else
@@ -156,44 +593,51 @@ int main(int argc, char *argv[]) {
         }
     }
     fprintf(stderr, "merging %d queues (REACHED)\n", fCnt);
-
-    std::map<std::string, unsigned long long> merged_map = {};
-    for(int tbl = 0; tbl < fCnt; ++tbl) {
-        for(auto mapStruct : table_queues[tbl]->maps) {
-            for (auto& it: *mapStruct->map) {
-                merged_map[it.first] += it.second;
+    if(cache_dir) {
+        int n_written = 0;
+        for(int tbl = 0; tbl < fCnt; ++tbl) {
+            for(int s = 0; s < n_samples; ++s) {
+                const std::string &key = cache_keys[tbl * n_samples + s];
+                if(key.empty())
+                    continue;
+                const char *shard = strrchr(shard_names[tbl], '/') + 1;
+                if(cache_dump(cache_path(cache_dir, shard, key), key, table_queues[tbl * n_samples + s]) < 0)
+                    fprintf(stderr, "[WARNING] failed to cache the counts of %s in %s\n", shard_names[tbl], cache_dir);
+                else
+                    ++n_written;
             }
         }
+        fprintf(stderr, "%d count vectors from the cache in %s, %d written to it\n", n_cached, cache_dir, n_written);
     }
-    fprintf(stderr, "len is %ld\n", merged_map.size());
-    unsigned long long max_hits = 0;
-    std::ifstream trsorted_file(tr_sorted_path);
-    std::string line;
-    std::unordered_map<std::string, unsigned long long> outmap;
-    std::map<std::string, unsigned long long>::iterator it = merged_map.begin();
-    while(getline(trsorted_file, line) && it != merged_map.end()) {
-        std::string key;
-        std::stringstream ls(line);
-        getline(ls, key, ' ');
-        const int cmp = it->first.compare(key);
-        if(cmp < 0 && it != merged_map.begin())
-            fprintf(stderr, "ERROR: SORTING IS WRONG, seen %s < %s\n", it->first, key);
-        if(cmp != 0)
-            continue;
-        std::string newKey;
-        getline(ls, newKey, ' ');
-        outmap[newKey] += it->second;
-        if(outmap[newKey] > max_hits)
-            max_hits = outmap[newKey];
-        ++it;
+    for(int s = 0; s < n_samples; ++s)
+        mm_prune_destroy(prune[s]);
+    mm_metrics_t total_metrics = prune_metrics;
+    double merge_start = mm_metrics_clock();
+
+    for(int s = 0; s < n_samples; ++s) {
+        std::map<std::string, unsigned long long> merged_map = {};
+        for(int tbl = 0; tbl < fCnt; ++tbl) {
+            for(auto mapStruct : table_queues[tbl * n_samples + s]->maps) {
+                for (auto& it: *mapStruct->map) {
+                    merged_map[it.first] += it.second;
+                }
+            }
+        }
+        write_results(tr_sorted_path, out_paths[s], merged_map, NULL);
     }
-    std::ofstream outfile(out_path);
-    for(const auto& item : outmap) {
-        std::string formattedKey(item.first);
-        std::replace(formattedKey.begin(), formattedKey.end(), '.', '_');
-        printf(out_format, formattedKey.c_str(), (double)item.second/max_hits);
-        outfile << "taxid_" << formattedKey << "_genomic.fna.gz," << (double)item.second/max_hits << "\n";
+    mm_metrics_lap(&total_metrics, MM_MT_MERGE, &merge_start);
+    if(metrics_path) {
+        mm_metrics_t shard_metrics[fCnt];
+        for(int tbl = 0; tbl < fCnt; ++tbl) {
+            shard_metrics[tbl] = table_queues[tbl * n_samples]->metrics;
+            for(int s = 1; s < n_samples; ++s)
+                mm_metrics_add(&shard_metrics[tbl], &table_queues[tbl * n_samples + s]->metrics);
+            mm_metrics_add(&total_metrics, &shard_metrics[tbl]);
+        }
+        if(mm_metrics_dump(metrics_path, &total_metrics, fCnt, shard_names, shard_metrics) < 0) {
+            fprintf(stderr, "ERROR: failed to write metrics to %s\n", metrics_path);
+            return 1;
+        }
     }
-    printf("%s\n", out_path);
     return 0;
 }
\ No newline at end of file
@@ -86,6 +86,7 @@ void mm_mapopt_init(mm_mapopt_t *opt)
 	opt->mini_batch_size = 500000000;
 	opt->max_sw_mat = 100000000;
 	opt->cap_kalloc = 1000000000;
+	opt->dedup_cache = 100000;
 
 	opt->rank_min_len = 500;
 	opt->rank_frac = 0.9f;
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+#include "placement.h"
+
+int mm_huge_pages = 0;
+
+void *mm_huge_malloc(size_t size)
+{
+	void *p;
+	if (!mm_huge_pages || size < MM_HUGE_PAGE) return malloc(size);
+	if (posix_memalign(&p, MM_HUGE_PAGE, size) != 0) return 0;
+#ifdef MADV_HUGEPAGE
+	madvise(p, size, MADV_HUGEPAGE); // a hint; without THP support the block stays on small pages
+#endif
+	return p;
+}
+
+int mm_numa_n_nodes(void)
+{
+#ifdef HAVE_LIBNUMA
+	if (numa_available() >= 0) return numa_max_node() + 1;
+	return 1;
+#else
+	char fn[64];
+	int n = 0;
+	FILE *fp;
+	for (;;) { // nodes are numbered from 0 without gaps on all but exotic machines
+		snprintf(fn, sizeof(fn), "/sys/devices/system/node/node%d/cpulist", n);
+		if ((fp = fopen(fn, "r")) == 0) break;
+		fclose(fp);
+		++n;
+	}
+	return n > 0? n : 1;
+#endif
+}
+
+int mm_numa_bind(int node)
+{
+#ifdef HAVE_LIBNUMA
+	if (numa_available() < 0 || node > numa_max_node()) return -1;
+	if (numa_run_on_node(node) < 0) return -1;
+	numa_set_preferred(node);
+	return 0;
+#else
+	char fn[64], buf[4096], *p = buf;
+	cpu_set_t set;
+	FILE *fp;
+	size_t l;
+	snprintf(fn, sizeof(fn), "/sys/devices/system/node/node%d/cpulist", node);
+	if ((fp = fopen(fn, "r")) == 0) return -1;
+	l = fread(buf, 1, sizeof(buf) - 1, fp);
+	fclose(fp);
+	buf[l] = 0;
+	CPU_ZERO(&set);
+	while (*p >= '0' && *p <= '9') { // e.g. "0-15,32-47"
+		long st, en;
+		st = en = strtol(p, &p, 10);
+		if (*p == '-') en = strtol(p + 1, &p, 10);
+		for (; st <= en && st < CPU_SETSIZE; ++st)
+			CPU_SET(st, &set);
+		if (*p == ',') ++p;
+	}
+	if (CPU_COUNT(&set) == 0) return -1; // a memory-only node
+	// the default local allocation policy then places the pages this thread touches on the node
+	return sched_setaffinity(0, sizeof(cpu_set_t), &set) == 0? 0 : -1;
+#endif
+}
@@ -0,0 +1,48 @@
+#ifndef MM_PLACEMENT_H
+#define MM_PLACEMENT_H
+
+#include <stddef.h>
+
+#define MM_HUGE_PAGE (2UL<<20)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Opt-in placement of the shard indexes. Large index arrays can be put on
+ * 2 MB transparent huge pages to cut TLB misses of the random lookups, and
+ * a shard thread can be bound to a NUMA node, so that the index it loads and
+ * the mapping threads it spawns stay on that node. Binding uses libnuma if
+ * compiled with numa=1 and the CPU lists in /sys/devices/system/node
+ * otherwise.
+ */
+
+extern int mm_huge_pages; // if set, mm_huge_malloc() asks for huge pages
+
+/**
+ * Allocate memory that is freed with free()
+ *
+ * With mm_huge_pages, blocks of at least MM_HUGE_PAGE are aligned to huge
+ * pages and advised with madvise(MADV_HUGEPAGE); smaller ones are malloc()ed.
+ */
+void *mm_huge_malloc(size_t size);
+
+// number of NUMA nodes; 1 if unknown
+int mm_numa_n_nodes(void);
+
+/**
+ * Run the calling thread on the CPUs of a NUMA node
+ *
+ * Threads created afterwards inherit the binding, and memory is allocated
+ * on the node the thread runs on.
+ *
+ * @return 0 on success; -1 if node doesn't exist
+ */
+int mm_numa_bind(int node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
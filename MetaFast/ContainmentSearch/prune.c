@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bseq.h"
+#include "kthread.h"
+#include "mmpriv.h"
+#include "prune.h"
+
+int mm_idx_read_param(const char *fn, int *k, int *w, int *flag)
+{
+	FILE *fp;
+	char magic[4];
+	uint32_t x[5];
+	int ret = -1;
+	if ((fp = fopen(fn, "rb")) == 0) return -1;
+	if (fread(magic, 1, 4, fp) == 4 && strncmp(magic, MM_IDX_MAGIC, 4) == 0 && fread(x, 4, 5, fp) == 5) {
+		*w = x[0], *k = x[1], *flag = x[4];
+		ret = 0;
+	}
+	fclose(fp);
+	return ret;
+}
+
+typedef struct {
+	mm_prune_t *p;
+	const mm_bseq1_t *seq;
+	mm128_v *v; // one per thread
+} prune_shared_t;
+
+static void prune_worker(void *data, long i, int tid)
+{
+	prune_shared_t *s = (prune_shared_t*)data;
+	mm_prune_t *p = s->p;
+	mm128_v *v = &s->v[tid];
+	uint64_t mask = (1ULL<<p->bits) - 1;
+	size_t j;
+	v->n = 0;
+	mm_sketch(0, s->seq[i].seq, s->seq[i].l_seq, p->w, p->k, 0, p->is_hpc, v);
+	for (j = 0; j < v->n; ++j) {
+		uint64_t x = v->a[j].x>>8 & mask;
+		if (!(p->b[x>>6] >> (x&63) & 1)) // skip the atomic when the bit is already set
+			__sync_fetch_and_or(&p->b[x>>6], 1ULL<<(x&63));
+	}
+}
+
+mm_prune_t *mm_prune_init(const char *fn, int k, int w, int is_hpc, int bits, int n_threads)
+{
+	mm_bseq_file_t *fp;
+	mm_bseq1_t *seq;
+	mm_prune_t *p;
+	prune_shared_t s;
+	int i, n_seq;
+	uint64_t j, n_words, n_set = 0;
+	if ((fp = mm_bseq_open(fn)) == 0) return 0;
+	if (n_threads < 1) n_threads = 1;
+	p = (mm_prune_t*)calloc(1, sizeof(mm_prune_t));
+	p->k = k, p->w = w, p->is_hpc = is_hpc, p->bits = bits < 6? 6 : bits;
+	n_words = 1ULL<<(p->bits - 6);
+	p->b = (uint64_t*)calloc(n_words, 8);
+	s.p = p;
+	s.v = (mm128_v*)calloc(n_threads, sizeof(mm128_v));
+	while ((seq = mm_bseq_read(fp, 500000000, 0, &n_seq)) != 0) {
+		s.seq = seq;
+		kt_for(n_threads, prune_worker, &s, n_seq);
+		mm_bseq_free(n_seq, seq);
+	}
+	for (i = 0; i < n_threads; ++i) free(s.v[i].a);
+	free(s.v);
+	mm_bseq_close(fp);
+	for (j = 0; j < n_words; ++j)
+		n_set += __builtin_popcountll(p->b[j]);
+	p->fill = (double)n_set / (n_words * 64);
+	return p;
+}
+
+void mm_prune_destroy(mm_prune_t *p)
+{
+	if (p == 0) return;
+	free(p->b); free(p);
+}
+
+double mm_prune_overlap(const mm_prune_t *p, const mm_idx_t *mi, int64_t max_probe)
+{
+	uint64_t *keys, mask = (1ULL<<p->bits) - 1;
+	int64_t i, n, n_hit = 0;
+	double frac;
+	if (mi->k != p->k || mi->w != p->w || !!(mi->flag & MM_I_HPC) != !!p->is_hpc) return -1.0;
+	keys = (uint64_t*)malloc(max_probe * 8);
+	n = mm_idx_sample_keys(mi, max_probe, keys);
+	for (i = 0; i < n; ++i) {
+		uint64_t x = keys[i] & mask;
+		n_hit += p->b[x>>6] >> (x&63) & 1;
+	}
+	free(keys);
+	if (n == 0) return 0.0;
+	if (p->fill >= 1.0) return 1.0;
+	frac = ((double)n_hit / n - p->fill) / (1.0 - p->fill); // remove the expected false positives
+	return frac > 0.0? frac : 0.0;
+}
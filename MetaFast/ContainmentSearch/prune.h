@@ -0,0 +1,58 @@
+#ifndef MM_PRUNE_H
+#define MM_PRUNE_H
+
+#include <stdint.h>
+#include "minimap.h"
+
+#define MM_PRUNE_PROBE 100000 // index minimizers probed per shard
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bitmap of the minimizers of a read set, used to skip shards that share too
+ * few minimizers with the reads before mapping them. A minimizer sets the bit
+ * at the low bits of its hash; the bitmap is read-only once built, so all
+ * shard threads can probe it without locking.
+ */
+typedef struct mm_prune_s {
+	int k, w, is_hpc, bits;
+	uint64_t *b;   // 1<<bits bits
+	double fill;   // fraction of the bits set, i.e. the false positive rate
+} mm_prune_t;
+
+/**
+ * Read k, w and the flag of a prebuilt index without loading it
+ *
+ * @return 0 on success; -1 if fn is not a prebuilt index
+ */
+int mm_idx_read_param(const char *fn, int *k, int *w, int *flag);
+
+/**
+ * Build the bitmap of the minimizers of a read set
+ *
+ * @param fn         FASTA/FASTQ file
+ * @param k, w       minimizer parameters of the shard indexes
+ * @param is_hpc     homopolymer-compressed minimizers
+ * @param bits       log2 of the bitmap size in bits
+ * @param n_threads  number of threads
+ *
+ * @return bitmap, or NULL if fn can't be opened
+ */
+mm_prune_t *mm_prune_init(const char *fn, int k, int w, int is_hpc, int bits, int n_threads);
+void mm_prune_destroy(mm_prune_t *p);
+
+/**
+ * Estimate the fraction of the minimizers of an index that occur in the reads
+ *
+ * @return fraction corrected for false positives of the bitmap; -1 if the index
+ *         was built with other minimizer parameters
+ */
+double mm_prune_overlap(const mm_prune_t *p, const mm_idx_t *mi, int64_t max_probe);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -911,3 +911,128 @@ mm_reg1_t *mm_align_skeleton(void *km, const mm_mapopt_t *opt, const mm_idx_t *m
 	mm_hit_sort(km, n_regs_, regs, opt->alt_drop);
 	return regs;
 }
+
+/*
+ * Long reads: GACT-style tiled extension. Instead of one DP over the whole
+ * chain, ksw2 extends the alignment one MM_TILE_LEN x MM_TILE_LEN tile at a
+ * time and keeps the path up to MM_TILE_LEN-MM_TILE_OVERLAP bases on either
+ * sequence; the next tile starts there. The DP memory is thus bounded by the
+ * tile, not by the read or the gaps between its seeds.
+ */
+#define MM_TILE_LEN     320
+#define MM_TILE_OVERLAP 128
+
+static int mm_tile_cut(int n_cigar, uint32_t *cigar, int32_t max_q, int32_t max_t, int32_t *q, int32_t *t)
+{ // keeps the path until it has max_q query or max_t reference bases; returns the number of CIGAR operations kept
+	int k;
+	*q = *t = 0;
+	for (k = 0; k < n_cigar && *q < max_q && *t < max_t; ++k) {
+		int32_t op = cigar[k]&0xf, len = cigar[k]>>4;
+		if (op != 2 && len > max_q - *q) len = max_q - *q;
+		if (op != 1 && len > max_t - *t) len = max_t - *t;
+		if (op != 2) *q += len;
+		if (op != 1) *t += len;
+		cigar[k] = len<<4 | op;
+	}
+	return k;
+}
+
+static int32_t mm_tile_extend(void *km, const mm_mapopt_t *opt, const mm_idx_t *mi, const int8_t *mat, int32_t rid, const uint8_t *qseq, int32_t qlen, int32_t q0, int32_t t0, int dir,
+							  uint8_t *qbuf, uint8_t *tbuf, ksw_extz_t *ez, mm_reg1_t *r, int32_t *t_ext)
+{ // extends from (q0,t0) to the end (dir>0) or the start (dir<0) of the sequences; the CIGAR, in the direction of extension, is appended to r
+	int32_t q = 0, t = 0, q_max = dir > 0? qlen - q0 : q0, t_max = dir > 0? (int32_t)mi->seq[rid].len - t0 : t0;
+	while (q < q_max && t < t_max) {
+		int32_t i, ql, tl, cq, ct, n_cigar;
+		int last;
+		ql = q_max - q < MM_TILE_LEN? q_max - q : MM_TILE_LEN;
+		tl = t_max - t < MM_TILE_LEN? t_max - t : MM_TILE_LEN;
+		last = (ql == q_max - q || tl == t_max - t);
+		if (dir > 0) {
+			memcpy(qbuf, qseq + q0 + q, ql);
+			mm_idx_getseq(mi, rid, t0 + t, t0 + t + tl, tbuf);
+		} else {
+			for (i = 0; i < ql; ++i) qbuf[i] = qseq[q0 - q - 1 - i];
+			mm_idx_getseq(mi, rid, t0 - t - tl, t0 - t, tbuf);
+			mm_seq_rev(tl, tbuf);
+		}
+		mm_align_pair(km, opt, ql, qbuf, tl, tbuf, 0, mat, -1, opt->end_bonus, opt->zdrop, KSW_EZ_EXTZ_ONLY | (dir < 0? KSW_EZ_RIGHT : 0), ez);
+		if (ez->n_cigar == 0) break;
+		if (last || ez->zdropped) { // the whole path; the alignment ends here
+			n_cigar = mm_tile_cut(ez->n_cigar, ez->cigar, INT32_MAX, INT32_MAX, &cq, &ct);
+			mm_append_cigar(r, n_cigar, ez->cigar);
+			q += cq, t += ct;
+			break;
+		}
+		n_cigar = mm_tile_cut(ez->n_cigar, ez->cigar, MM_TILE_LEN - MM_TILE_OVERLAP, MM_TILE_LEN - MM_TILE_OVERLAP, &cq, &ct);
+		mm_append_cigar(r, n_cigar, ez->cigar);
+		q += cq, t += ct;
+		if (cq < MM_TILE_LEN - MM_TILE_OVERLAP && ct < MM_TILE_LEN - MM_TILE_OVERLAP) break; // the best path stops inside the tile
+	}
+	*t_ext = t;
+	return q;
+}
+
+mm_reg1_t *mm_align_tiled(void *km, const mm_mapopt_t *opt, const mm_idx_t *mi, int qlen, const char *qstr, int *n_regs_, mm_reg1_t *regs, mm128_t *a, uint64_t *n_aligned)
+{
+	int32_t i, k, n_regs = *n_regs_;
+	uint8_t *qseq0[2], *qbuf, *tbuf;
+	int8_t mat[25];
+	ksw_extz_t ez;
+
+	qseq0[0] = (uint8_t*)kmalloc(km, qlen * 2);
+	qseq0[1] = qseq0[0] + qlen;
+	for (i = 0; i < qlen; ++i) {
+		qseq0[0][i] = seq_nt4_table[(uint8_t)qstr[i]];
+		qseq0[1][qlen - 1 - i] = qseq0[0][i] < 4? 3 - qseq0[0][i] : 4;
+	}
+	qbuf = (uint8_t*)kmalloc(km, MM_TILE_LEN * 2);
+	tbuf = qbuf + MM_TILE_LEN;
+	ksw_gen_simple_mat(5, mat, opt->a, opt->b, opt->sc_ambi);
+	memset(&ez, 0, sizeof(ksw_extz_t));
+
+	for (i = k = 0; i < n_regs; ++i) {
+		mm_reg1_t *r = &regs[i], l;
+		const mm128_t *s = &a[r->as + r->cnt / 2]; // tiles grow from the middle seed of the chain in both directions
+		int32_t rid = s->x<<1>>33, rev = s->x>>63, qe = (int32_t)s->y + 1, re = (int32_t)s->x + 1, ql, tl, qr, tr, n_kept = 1;
+		uint8_t *tseq;
+		if (opt->flag & MM_F_TAXON_ONCE) { // chains are sorted by score; the next one of a taxon is aligned only if the previous ones were dropped
+			int32_t taxon = mi->seq[rid].taxon, j;
+			for (j = 0; j < k && taxon >= 0 && mi->seq[regs[j].rid].taxon != taxon; ++j) { }
+			if (taxon >= 0 && j < k) continue;
+		}
+		++*n_aligned;
+		memset(&l, 0, sizeof(mm_reg1_t));
+		ql = mm_tile_extend(km, opt, mi, mat, rid, qseq0[rev], qlen, qe, re, -1, qbuf, tbuf, &ez, &l, &tl);
+		if (l.p) { // reversed, the left extension comes first
+			uint32_t j, c, n = l.p->n_cigar;
+			for (j = 0; j < n>>1; ++j)
+				c = l.p->cigar[j], l.p->cigar[j] = l.p->cigar[n - 1 - j], l.p->cigar[n - 1 - j] = c;
+			mm_append_cigar(r, n, l.p->cigar);
+			free(l.p);
+		}
+		qr = mm_tile_extend(km, opt, mi, mat, rid, qseq0[rev], qlen, qe, re, 1, qbuf, tbuf, &ez, r, &tr);
+		if (r->p == 0) continue; // nothing aligned around the seed
+		r->rid = rid, r->rev = rev, r->tiled = 1;
+		r->rs = re - tl, r->re = re + tr;
+		if (rev) r->qs = qlen - (qe + qr), r->qe = qlen - (qe - ql);
+		else r->qs = qe - ql, r->qe = qe + qr;
+		tseq = (uint8_t*)kmalloc(km, r->re - r->rs);
+		mm_idx_getseq(mi, rid, r->rs, r->re, tseq);
+		mm_update_extra(r, &qseq0[rev][qe - ql], tseq, mat, opt->q, opt->e, opt->flag & MM_F_EQX);
+		kfree(km, tseq);
+		r->p->dp_score = r->p->dp_max;
+		r->p->dp_max2 = r->blen - r->mlen + r->p->n_ambi; // edits, as the filters report them on short reads
+		if (r->p->dp_max2 > r->blen * opt->max_edit_frac) { // too divergent
+			free(r->p);
+			continue;
+		}
+		mm_filter_regs(opt, qlen, &n_kept, r); // per region, so that --taxa sees only the alignments kept
+		if (n_kept) regs[k++] = *r;
+	}
+	*n_regs_ = k;
+	kfree(km, qseq0[0]);
+	kfree(km, qbuf);
+	kfree(km, ez.cigar);
+	mm_hit_sort(km, n_regs_, regs, opt->alt_drop);
+	return regs;
+}
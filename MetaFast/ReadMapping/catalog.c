@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "kvec.h"
+#include "khash.h"
+#include "kseq.h"
+#include "catalog.h"
+
+KSTREAM_DECLARE(gzFile, gzread)
+KHASH_MAP_INIT_STR(db, uint32_t)
+
+/**********************
+ * Compile a catalog  *
+ **********************/
+
+typedef struct {
+	kstring_t str;          // string pool
+	khash_t(db) *pool;      // string -> offset in str, to store each lineage once
+	khash_t(db) *taxid2id, *acc2id;
+	kvec_t(mf_db_taxon_t) taxa;
+	kvec_t(mf_db_acc_t) acc;
+	kvec_t(char*) keys;     // copies of the hash keys
+} db_build_t;
+
+static const char *build_key(db_build_t *b, const char *s)
+{
+	kv_push(char*, 0, b->keys, strdup(s));
+	return b->keys.a[b->keys.n - 1];
+}
+
+static uint32_t build_str(db_build_t *b, const char *s)
+{
+	khint_t k;
+	int absent;
+	size_t l;
+	if (*s == 0) return 0;
+	k = kh_put(db, b->pool, s, &absent);
+	if (!absent) return kh_val(b->pool, k);
+	l = strlen(s);
+	if (b->str.l + l + 1 > b->str.m) {
+		b->str.m = b->str.l + l + 1;
+		kroundup32(b->str.m);
+		b->str.s = (char*)realloc(b->str.s, b->str.m);
+	}
+	kh_key(b->pool, k) = build_key(b, s);
+	kh_val(b->pool, k) = b->str.l;
+	memcpy(b->str.s + b->str.l, s, l + 1);
+	b->str.l += l + 1;
+	return kh_val(b->pool, k);
+}
+
+static uint32_t build_taxon(db_build_t *b, const char *taxid)
+{
+	khint_t k;
+	int absent;
+	k = kh_put(db, b->taxid2id, taxid, &absent);
+	if (absent) {
+		mf_db_taxon_t t;
+		memset(&t, 0, sizeof(mf_db_taxon_t));
+		t.taxid = build_str(b, taxid);
+		t.rank = -1;
+		kh_key(b->taxid2id, k) = build_key(b, taxid);
+		kh_val(b->taxid2id, k) = b->taxa.n;
+		kv_push(mf_db_taxon_t, 0, b->taxa, t);
+	}
+	return kh_val(b->taxid2id, k);
+}
+
+static mf_db_acc_t *build_acc(db_build_t *b, const char *acc)
+{
+	khint_t k;
+	int absent;
+	k = kh_put(db, b->acc2id, acc, &absent);
+	if (absent) {
+		mf_db_acc_t a;
+		a.name = build_str(b, acc), a.taxon = UINT32_MAX, a.len = 0;
+		kh_key(b->acc2id, k) = build_key(b, acc);
+		kh_val(b->acc2id, k) = b->acc.n;
+		kv_push(mf_db_acc_t, 0, b->acc, a);
+	}
+	return &b->acc.a[kh_val(b->acc2id, k)];
+}
+
+static int build_read_tr(db_build_t *b, const char *fn)
+{ // lines: "<accession> <taxid>"
+	gzFile fp;
+	kstream_t *ks;
+	kstring_t str = {0,0,0};
+	if ((fp = gzopen(fn, "r")) == 0) return -1;
+	ks = ks_init(fp);
+	while (ks_getuntil(ks, KS_SEP_LINE, &str, 0) >= 0) {
+		char *p, *q;
+		for (p = str.s; *p && *p != ' ' && *p != '\t'; ++p) { }
+		if (*p == 0) continue;
+		*p++ = 0;
+		for (q = p; *q && *q != ' ' && *q != '\t' && *q != '\r'; ++q) { }
+		*q = 0;
+		build_acc(b, str.s)->taxon = build_taxon(b, p);
+	}
+	free(str.s);
+	ks_destroy(ks);
+	gzclose(fp);
+	return 0;
+}
+
+static int build_read_info(db_build_t *b, const char *fn)
+{ // tab-delimited: Accession, Length, TaxID, Lineage, TaxID_Lineage; first line is the header
+	gzFile fp;
+	kstream_t *ks;
+	kstring_t str = {0,0,0};
+	int64_t n_lines = 0;
+	if ((fp = gzopen(fn, "r")) == 0) return -1;
+	ks = ks_init(fp);
+	while (ks_getuntil(ks, KS_SEP_LINE, &str, 0) >= 0) {
+		char *fld[5], *p;
+		int i;
+		mf_db_acc_t *a;
+		mf_db_taxon_t *t;
+		if (n_lines++ == 0) continue;
+		for (i = 0, p = fld[0] = str.s; *p && i < 4; ++p)
+			if (*p == '\t' || *p == '\r') *p = 0, fld[++i] = p + 1;
+		if (i < 4) continue;
+		for (p = fld[4]; *p && *p != '\t' && *p != '\r'; ++p) { }
+		*p = 0;
+		a = build_acc(b, fld[0]);
+		a->len = strtoull(fld[1], 0, 10);
+		if (a->taxon == UINT32_MAX) a->taxon = build_taxon(b, fld[2]); // the translation table takes precedence
+		t = &b->taxa.a[a->taxon];
+		if (t->len == 0) t->len = a->len;
+		if (t->tax_lin == 0 && *fld[4]) { // the first lineage of a taxon wins
+			int r;
+			t->name_lin = build_str(b, fld[3]);
+			t->tax_lin = build_str(b, fld[4]);
+			for (p = fld[4], r = 0; *p; ++p) { // rank: last non-empty '|'-separated field
+				if (*p == '|') ++r;
+				else t->rank = r;
+			}
+		}
+	}
+	free(str.s);
+	ks_destroy(ks);
+	gzclose(fp);
+	return 0;
+}
+
+static int build_read_dir(db_build_t *b, const char *dir)
+{ // organism files are named taxid_<TaxID with '.' replaced by '_'>_genomic.fna.gz
+	DIR *d;
+	struct dirent *e;
+	if ((d = opendir(dir)) == 0) return -1;
+	while ((e = readdir(d)) != 0) {
+		const char *pre = "taxid_", *suf = "_genomic.fna.gz";
+		size_t l = strlen(e->d_name), lp = strlen(pre), ls = strlen(suf), i;
+		char *taxid;
+		khint_t k;
+		if (l <= lp + ls || strncmp(e->d_name, pre, lp) != 0 || strcmp(e->d_name + l - ls, suf) != 0) continue;
+		taxid = (char*)malloc(l - lp - ls + 1);
+		for (i = 0; i < l - lp - ls; ++i)
+			taxid[i] = e->d_name[lp + i] == '_'? '.' : e->d_name[lp + i];
+		taxid[i] = 0;
+		k = kh_get(db, b->taxid2id, taxid);
+		if (k != kh_end(b->taxid2id))
+			b->taxa.a[kh_val(b->taxid2id, k)].file = build_str(b, e->d_name);
+		free(taxid);
+	}
+	closedir(d);
+	return 0;
+}
+
+static const char *g_sort_str; // qsort() has no context argument
+
+static int cmp_taxon(const void *a, const void *b)
+{
+	return strcmp(g_sort_str + ((const mf_db_taxon_t*)a)->taxid, g_sort_str + ((const mf_db_taxon_t*)b)->taxid);
+}
+
+static int cmp_acc(const void *a, const void *b)
+{
+	return strcmp(g_sort_str + ((const mf_db_acc_t*)a)->name, g_sort_str + ((const mf_db_acc_t*)b)->name);
+}
+
+static const mf_db_taxon_t *g_sort_taxa;
+
+static int cmp_file(const void *a, const void *b)
+{
+	return strcmp(g_sort_str + g_sort_taxa[*(const uint32_t*)a].file, g_sort_str + g_sort_taxa[*(const uint32_t*)b].file);
+}
+
+int mf_db_compile(const char *fn_out, const char *fn_info, const char *fn_tr, const char *dir_org)
+{
+	db_build_t b;
+	mf_db_hdr_t hdr;
+	uint32_t *old2new = 0, *file = 0, i, n_file = 0;
+	FILE *fp = 0;
+	int ret = -1;
+
+	memset(&b, 0, sizeof(db_build_t));
+	b.pool = kh_init(db);
+	b.taxid2id = kh_init(db);
+	b.acc2id = kh_init(db);
+	b.str.s = (char*)calloc(1, 1), b.str.l = b.str.m = 1; // offset 0: the empty string
+	if (fn_tr && build_read_tr(&b, fn_tr) < 0) goto end_compile;
+	if (build_read_info(&b, fn_info) < 0) goto end_compile;
+	if (dir_org && build_read_dir(&b, dir_org) < 0) goto end_compile;
+	if (b.str.l > UINT32_MAX) {
+		fprintf(stderr, "[ERROR] the catalog strings exceed 4 GB\n");
+		goto end_compile;
+	}
+
+	// sort taxa and accessions for binary search and renumber the taxa of the accessions
+	g_sort_str = b.str.s;
+	for (i = 0; i < b.taxa.n; ++i) b.taxa.a[i].n_acc = i; // temporarily: the old index
+	qsort(b.taxa.a, b.taxa.n, sizeof(mf_db_taxon_t), cmp_taxon);
+	old2new = (uint32_t*)malloc((b.taxa.n + 1) * sizeof(uint32_t));
+	for (i = 0; i < b.taxa.n; ++i) old2new[b.taxa.a[i].n_acc] = i, b.taxa.a[i].n_acc = 0;
+	for (i = 0; i < b.acc.n; ++i) {
+		mf_db_acc_t *a = &b.acc.a[i];
+		a->taxon = old2new[a->taxon];
+		++b.taxa.a[a->taxon].n_acc;
+	}
+	qsort(b.acc.a, b.acc.n, sizeof(mf_db_acc_t), cmp_acc);
+	file = (uint32_t*)malloc((b.taxa.n + 1) * sizeof(uint32_t));
+	for (i = 0; i < b.taxa.n; ++i)
+		if (b.taxa.a[i].file) file[n_file++] = i;
+	g_sort_taxa = b.taxa.a;
+	qsort(file, n_file, sizeof(uint32_t), cmp_file);
+
+	if ((fp = fopen(fn_out, "wb")) == 0) goto end_compile;
+	memset(&hdr, 0, sizeof(mf_db_hdr_t));
+	memcpy(hdr.magic, MF_DB_MAGIC, 4);
+	hdr.n_taxa = b.taxa.n, hdr.n_acc = b.acc.n, hdr.n_file = n_file, hdr.l_str = b.str.l;
+	fwrite(&hdr, sizeof(mf_db_hdr_t), 1, fp);
+	fwrite(b.taxa.a, sizeof(mf_db_taxon_t), b.taxa.n, fp);
+	fwrite(b.acc.a, sizeof(mf_db_acc_t), b.acc.n, fp);
+	fwrite(file, sizeof(uint32_t), n_file, fp);
+	fwrite(b.str.s, 1, b.str.l, fp);
+	ret = fclose(fp) == 0? 0 : -1;
+	if (ret == 0)
+		fprintf(stderr, "[M::%s] %u accessions, %u taxa and %u organism files\n", __func__, hdr.n_acc, hdr.n_taxa, hdr.n_file);
+
+end_compile:
+	free(old2new); free(file);
+	kh_destroy(db, b.pool);
+	kh_destroy(db, b.taxid2id);
+	kh_destroy(db, b.acc2id);
+	for (i = 0; i < b.keys.n; ++i) free(b.keys.a[i]);
+	free(b.keys.a); free(b.taxa.a); free(b.acc.a); free(b.str.s);
+	return ret;
+}
+
+/*******************
+ * Read a catalog  *
+ *******************/
+
+int mf_db_is_db(const char *fn)
+{
+	FILE *fp;
+	char magic[4];
+	int ret;
+	if ((fp = fopen(fn, "rb")) == 0) return 0;
+	ret = fread(magic, 1, 4, fp) == 4 && strncmp(magic, MF_DB_MAGIC, 4) == 0;
+	fclose(fp);
+	return ret;
+}
+
+mf_db_t *mf_db_load(const char *fn)
+{
+	int fd;
+	struct stat st;
+	void *base;
+	const mf_db_hdr_t *hdr;
+	mf_db_t *db;
+	uint64_t size;
+	if ((fd = open(fn, O_RDONLY)) < 0) return 0;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(mf_db_hdr_t)) {
+		close(fd);
+		return 0;
+	}
+	base = mmap(0, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return 0;
+	hdr = (const mf_db_hdr_t*)base;
+	size = sizeof(mf_db_hdr_t) + (uint64_t)hdr->n_taxa * sizeof(mf_db_taxon_t) + (uint64_t)hdr->n_acc * sizeof(mf_db_acc_t)
+		+ (uint64_t)hdr->n_file * sizeof(uint32_t) + hdr->l_str;
+	if (strncmp(hdr->magic, MF_DB_MAGIC, 4) != 0 || size != (uint64_t)st.st_size || hdr->l_str == 0) {
+		munmap(base, st.st_size);
+		return 0;
+	}
+	db = (mf_db_t*)calloc(1, sizeof(mf_db_t));
+	db->base = base, db->size = st.st_size;
+	db->n_taxa = hdr->n_taxa, db->n_acc = hdr->n_acc, db->n_file = hdr->n_file;
+	db->taxa = (mf_db_taxon_t*)((char*)base + sizeof(mf_db_hdr_t));
+	db->acc = (mf_db_acc_t*)(db->taxa + db->n_taxa);
+	db->file = (uint32_t*)(db->acc + db->n_acc);
+	db->str = (char*)(db->file + db->n_file);
+	return db;
+}
+
+void mf_db_destroy(mf_db_t *db)
+{
+	if (db == 0) return;
+	munmap(db->base, db->size);
+	free(db);
+}
+
+int32_t mf_db_acc2taxon(const mf_db_t *db, const char *acc)
+{
+	int64_t lo = 0, hi = (int64_t)db->n_acc - 1;
+	while (lo <= hi) {
+		int64_t mid = (lo + hi) >> 1;
+		int c = strcmp(acc, db->str + db->acc[mid].name);
+		if (c == 0) return db->acc[mid].taxon;
+		if (c < 0) hi = mid - 1;
+		else lo = mid + 1;
+	}
+	return -1;
+}
+
+int32_t mf_db_taxid2taxon(const mf_db_t *db, const char *taxid)
+{
+	int64_t lo = 0, hi = (int64_t)db->n_taxa - 1;
+	while (lo <= hi) {
+		int64_t mid = (lo + hi) >> 1;
+		int c = strcmp(taxid, db->str + db->taxa[mid].taxid);
+		if (c == 0) return mid;
+		if (c < 0) hi = mid - 1;
+		else lo = mid + 1;
+	}
+	return -1;
+}
+
+int32_t mf_db_file2taxon(const mf_db_t *db, const char *fn)
+{
+	const char *p;
+	int64_t lo = 0, hi = (int64_t)db->n_file - 1;
+	if ((p = strrchr(fn, '/')) != 0) fn = p + 1;
+	while (lo <= hi) {
+		int64_t mid = (lo + hi) >> 1;
+		int c = strcmp(fn, db->str + db->taxa[db->file[mid]].file);
+		if (c == 0) return db->file[mid];
+		if (c < 0) hi = mid - 1;
+		else lo = mid + 1;
+	}
+	return -1;
+}
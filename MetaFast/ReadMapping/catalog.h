@@ -0,0 +1,97 @@
+#ifndef MF_CATALOG_H
+#define MF_CATALOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MF_DB_MAGIC  "MFD\1"
+#define MF_DB_SUFFIX ".mfdb"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compiled database catalog, written by `metafast-db compile` and mapped into
+ * memory as is. All integers are little-endian; strings are NUL-terminated
+ * and referred to by their offset in the string pool, where offset 0 is the
+ * empty string.
+ *
+ *   mf_db_hdr_t                  magic and counts
+ *   mf_db_taxon_t[n_taxa]        sorted by TaxID
+ *   mf_db_acc_t[n_acc]           sorted by accession
+ *   uint32_t[n_file]             taxa with an organism file, sorted by file name
+ *   char[l_str]                  string pool
+ */
+
+typedef struct {
+	char magic[4];
+	uint32_t n_taxa, n_acc, n_file;
+	uint64_t l_str;
+} mf_db_hdr_t;
+
+typedef struct {
+	uint64_t len;          // Length column of its first line in db_info, i.e. the organism length
+	uint32_t taxid;        // TaxID, as in the translation table
+	uint32_t name_lin;     // Lineage column of db_info
+	uint32_t tax_lin;      // TaxID_Lineage column of db_info
+	uint32_t file;         // organism file name without the directory; 0 if none
+	uint32_t n_acc;        // number of accessions
+	int32_t rank;          // index of the last non-empty field of tax_lin; -1 if empty
+} mf_db_taxon_t;
+
+typedef struct {
+	uint32_t name;         // accession
+	uint32_t taxon;        // index in taxa[]
+	uint64_t len;          // Length column of db_info; 0 if only in the translation table
+} mf_db_acc_t;
+
+typedef struct {
+	void *base;            // mapped file
+	size_t size;
+	uint32_t n_taxa, n_acc, n_file;
+	mf_db_taxon_t *taxa;
+	mf_db_acc_t *acc;
+	uint32_t *file;
+	char *str;
+} mf_db_t;
+
+/**
+ * Compile the text metadata of a database into a catalog
+ *
+ * @param fn_out    output file
+ * @param fn_info   db_info: Accession, Length, TaxID, Lineage, TaxID_Lineage with a header line
+ * @param fn_tr     translation table "<accession> <taxid>", which takes precedence over the
+ *                  TaxID column of db_info; NULL to use db_info only
+ * @param dir_org   directory of the taxid_<TaxID>_genomic.fna.gz organism files; NULL for none
+ *
+ * @return 0 on success; -1 on I/O errors
+ */
+int mf_db_compile(const char *fn_out, const char *fn_info, const char *fn_tr, const char *dir_org);
+
+// 1 if fn starts with MF_DB_MAGIC; 0 otherwise
+int mf_db_is_db(const char *fn);
+
+/**
+ * Map a catalog into memory
+ *
+ * Pages are mapped copy-on-write, so the strings can be modified in place
+ * without touching the file.
+ *
+ * @return catalog, or NULL if fn can't be opened or is not a catalog
+ */
+mf_db_t *mf_db_load(const char *fn);
+void mf_db_destroy(mf_db_t *db);
+
+static inline const char *mf_db_str(const mf_db_t *db, uint32_t off) { return db->str + off; }
+
+// index in taxa[] by exact name; -1 if absent
+int32_t mf_db_acc2taxon(const mf_db_t *db, const char *acc);
+int32_t mf_db_taxid2taxon(const mf_db_t *db, const char *taxid);
+int32_t mf_db_file2taxon(const mf_db_t *db, const char *fn); // directories in fn are ignored
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
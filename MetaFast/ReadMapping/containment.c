@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kthread.h"
+#include "kalloc.h"
+#include "mmpriv.h"
+#include "containment.h"
+
+/*
+ * Seed selection below is ported from ContainmentSearch/seed.c (minimap2 2.24),
+ * so that the scores computed here are identical to those reported by cs.
+ */
+
+#define MF_MAX_HIGH_OCC 128
+
+typedef struct {
+	uint32_t n, q_pos, q_span;
+	uint32_t flt;
+	const void *cr; // decoded by mm_idx_hit()
+} mf_seed_t;
+
+void mf_csopt_init(mf_csopt_t *opt)
+{
+	memset(opt, 0, sizeof(mf_csopt_t));
+	opt->mid_occ_frac = 2e-4f;
+	opt->q_occ_frac = 0.01f;
+	opt->min_mid_occ = 10;
+	opt->max_mid_occ = 1000000;
+	opt->max_max_occ = 4095;
+	opt->occ_dist = 500;
+}
+
+static int32_t cal_mid_occ(const mm_idx_t *mi, const mf_csopt_t *opt)
+{
+	int32_t mid_occ;
+	mid_occ = mm_idx_cal_max_occ(mi, opt->mid_occ_frac);
+	if (mid_occ < opt->min_mid_occ)
+		mid_occ = opt->min_mid_occ;
+	if (opt->max_mid_occ > opt->min_mid_occ && mid_occ > opt->max_mid_occ)
+		mid_occ = opt->max_mid_occ;
+	return mid_occ;
+}
+
+static void seed_mz_flt(void *km, mm128_v *mv, int32_t q_occ_max, float q_occ_frac)
+{ // drop minimizers that are highly repetitive within the query
+	mm128_t *a;
+	size_t i, j, st;
+	if (mv->n <= (size_t)q_occ_max || q_occ_frac <= 0.0f || q_occ_max <= 0) return;
+	KMALLOC(km, a, mv->n);
+	for (i = 0; i < mv->n; ++i)
+		a[i].x = mv->a[i].x, a[i].y = i;
+	radix_sort_128x(a, a + mv->n);
+	for (st = 0, i = 1; i <= mv->n; ++i) {
+		if (i == mv->n || a[i].x != a[st].x) {
+			int32_t cnt = i - st;
+			if (cnt > q_occ_max && cnt > mv->n * q_occ_frac)
+				for (j = st; j < i; ++j)
+					mv->a[a[j].y].x = 0;
+			st = i;
+		}
+	}
+	kfree(km, a);
+	for (i = j = 0; i < mv->n; ++i)
+		if (mv->a[i].x != 0)
+			mv->a[j++] = mv->a[i];
+	mv->n = j;
+}
+
+static mf_seed_t *seed_collect_all(void *km, const mm_idx_t *mi, const mm128_v *mv, int32_t *n_m_)
+{
+	mf_seed_t *m;
+	size_t i;
+	int32_t k;
+	KMALLOC(km, m, mv->n);
+	for (i = k = 0; i < mv->n; ++i) {
+		const void *cr;
+		mf_seed_t *q;
+		mm128_t *p = &mv->a[i];
+		int t;
+		cr = mm_idx_get(mi, p->x>>8, &t);
+		if (t == 0) continue;
+		q = &m[k++];
+		q->q_pos = (uint32_t)p->y, q->q_span = p->x & 0xff, q->cr = cr, q->n = t, q->flt = 0;
+	}
+	*n_m_ = k;
+	return m;
+}
+
+static void seed_select(void *km, int32_t n, mf_seed_t *a, int len, int max_occ, int max_max_occ, int dist)
+{ // for high-occ minimizers, choose up to max_high_occ in each high-occ streak
+	int32_t i, last0, m;
+	uint64_t *b;
+
+	if (n == 0 || n == 1) return;
+	for (i = m = 0; i < n; ++i)
+		if (a[i].n > (uint32_t)max_occ) ++m;
+	if (m == 0) return;
+	b = (uint64_t*)kmalloc(km, (size_t)m * sizeof(uint64_t));
+	for (i = 0, last0 = -1; i <= n; ++i) {
+		if (i == n || a[i].n <= (uint32_t)max_occ) {
+			if (i - last0 > 1) {
+				int32_t ps = last0 < 0? 0 : (uint32_t)a[last0].q_pos>>1;
+				int32_t pe = i == n? len : (uint32_t)a[i].q_pos>>1;
+				int32_t j, k, st = last0 + 1, en = i;
+				int32_t max_high_occ = (int32_t)((double)(pe - ps) / dist + .499);
+				if (max_high_occ > 0) {
+					if (max_high_occ > MF_MAX_HIGH_OCC)
+						max_high_occ = MF_MAX_HIGH_OCC;
+					for (j = st, k = 0; j < en; ++j, ++k)
+						b[k] = (uint64_t)a[j].n<<32 | j;
+					radix_sort_64(b, b + k); // keys are distinct: the same max_high_occ seeds as the heap in cs
+					for (j = 0; j < k && j < max_high_occ; ++j) a[(uint32_t)b[j]].flt = 1;
+				}
+				for (j = st; j < en; ++j) a[j].flt ^= 1;
+				for (j = st; j < en; ++j)
+					if (a[j].n > (uint32_t)max_max_occ)
+						a[j].flt = 1;
+			}
+			last0 = i;
+		}
+	}
+	kfree(km, b);
+}
+
+static void count1(void *km, const mm_idx_t *mi, const mf_csopt_t *opt, int32_t mid_occ, const mm_bseq1_t *t, uint32_t mult, uint64_t *cnt, mm_metrics_t *mt)
+{
+	mm128_v mv = {0,0,0};
+	mf_seed_t *m;
+	int32_t i, n_m;
+	double t_mt;
+	if (t->l_seq == 0 || mult == 0) return;
+	t_mt = mm_metrics_clock();
+	mm_sketch(km, t->seq, t->l_seq, mi->w, mi->k, 0, mi->flag&MM_I_HPC, &mv);
+	if (opt->q_occ_frac > 0.0f) seed_mz_flt(km, &mv, mid_occ, opt->q_occ_frac);
+	mm_metrics_lap(mt, MM_MT_SKETCH, &t_mt);
+	m = seed_collect_all(km, mi, &mv, &n_m);
+	mm_metrics_lap(mt, MM_MT_LOOKUP, &t_mt);
+	mt->c[MM_MC_MINIMIZERS] += mv.n;
+	if (opt->occ_dist > 0 && opt->max_max_occ > mid_occ) {
+		seed_select(km, n_m, m, t->l_seq, mid_occ, opt->max_max_occ, opt->occ_dist);
+	} else {
+		for (i = 0; i < n_m; ++i)
+			if (m[i].n > (uint32_t)mid_occ)
+				m[i].flt = 1;
+	}
+	for (i = 0; i < n_m; ++i) {
+		uint32_t k;
+		if (m[i].flt) continue;
+		for (k = 0; k < m[i].n; ++k) { // cs adds the reference position of every hit; mirror that
+			uint64_t r = mm_idx_hit(mi, m[i].cr, k);
+			cnt[r>>32] += (uint64_t)mult * ((uint32_t)r >> 1);
+		}
+		mt->c[MM_MC_ANCHORS] += m[i].n;
+	}
+	kfree(km, m);
+	kfree(km, mv.a);
+	mm_metrics_lap(mt, MM_MT_CAND, &t_mt);
+}
+
+typedef struct {
+	const mm_idx_t *mi;
+	const mf_csopt_t *opt;
+	int32_t mid_occ;
+	const mm_bseq1_t *seq;
+	const uint32_t *mult;
+	void **km;
+	uint64_t *cnt; // n_threads rows of mi->n_seq
+	mm_metrics_t *mt; // one per thread
+} count_shared_t;
+
+static void count_worker(void *_data, long i, int tid) // kt_for() callback
+{
+	count_shared_t *s = (count_shared_t*)_data;
+	count1(s->km[tid], s->mi, s->opt, s->mid_occ, &s->seq[i], s->mult? s->mult[i] : 1, s->cnt + (size_t)tid * s->mi->n_seq, &s->mt[tid]);
+}
+
+void mf_cs_count(const mm_idx_t *mi, const mf_csopt_t *opt, int n_seq, const mm_bseq1_t *seq, const uint32_t *mult, int n_threads, uint64_t *cnt, mm_metrics_t *mt)
+{
+	count_shared_t s;
+	uint32_t j;
+	int i;
+	if (n_threads < 1) n_threads = 1;
+	s.mi = mi, s.opt = opt, s.seq = seq, s.mult = mult;
+	s.mid_occ = cal_mid_occ(mi, opt);
+	s.km = (void**)calloc(n_threads, sizeof(void*));
+	for (i = 0; i < n_threads; ++i)
+		s.km[i] = km_init();
+	s.cnt = (uint64_t*)calloc((size_t)n_threads * mi->n_seq, sizeof(uint64_t));
+	s.mt = (mm_metrics_t*)calloc(n_threads, sizeof(mm_metrics_t));
+	kt_for(n_threads, count_worker, &s, n_seq);
+	for (i = 0; i < n_threads; ++i) {
+		const uint64_t *c = s.cnt + (size_t)i * mi->n_seq;
+		for (j = 0; j < mi->n_seq; ++j)
+			cnt[j] += c[j];
+		km_destroy(s.km[i]);
+		mm_metrics_add(mt, &s.mt[i]);
+	}
+	free(s.cnt); free(s.km); free(s.mt);
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] mid_occ = %d; counted %d reads against %d sequence(s)\n", __func__,
+				realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), s.mid_occ, n_seq, mi->n_seq);
+}
@@ -0,0 +1,45 @@
+#ifndef MF_CONTAINMENT_H
+#define MF_CONTAINMENT_H
+
+#include <stdint.h>
+#include "minimap.h"
+#include "bseq.h"
+#include "metrics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// seed-selection parameters of the containment search; defaults match ContainmentSearch/cs
+typedef struct {
+	float mid_occ_frac;  // repetitive-minimizer fraction used to derive mid_occ per shard
+	float q_occ_frac;    // drop query minimizers occurring in more than this fraction of the read
+	int32_t min_mid_occ, max_mid_occ;
+	int32_t max_max_occ; // never use seeds occurring more than this
+	int32_t occ_dist;    // keep one high-occ seed per this many query bases
+} mf_csopt_t;
+
+void mf_csopt_init(mf_csopt_t *opt);
+
+/**
+ * Add the containment score of each reference sequence in one shard
+ *
+ * The score of a sequence is the sum of reference positions over all seed
+ * hits of all reads, exactly as accumulated by ContainmentSearch/cs.
+ *
+ * @param mi         shard index
+ * @param opt        seed-selection parameters
+ * @param n_seq      number of reads
+ * @param seq        reads
+ * @param mult       number of copies of each read; 0 to skip it; NULL for one copy each
+ * @param n_threads  number of worker threads
+ * @param cnt        scores, indexed by reference ID; of size mi->n_seq
+ * @param mt         metrics of this shard; sketching, lookup and scoring are added
+ */
+void mf_cs_count(const mm_idx_t *mi, const mf_csopt_t *opt, int n_seq, const mm_bseq1_t *seq, const uint32_t *mult, int n_threads, uint64_t *cnt, mm_metrics_t *mt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef MM_DEDUP_H
+#define MM_DEDUP_H
+
+#include <stdint.h>
+#include "bseq.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Find reads with identical sequences in a batch
+ *
+ * @param n    number of reads
+ * @param seq  reads
+ * @param key  if not NULL, key[i] is compared instead of seq[i].seq
+ *
+ * @return array of size n: -1 if seq[i] is the first read with its key,
+ *         or the index of that first read otherwise; to be freed by free()
+ */
+int32_t *mm_dedup_batch(int n, const mm_bseq1_t *seq, const char *const *key);
+
+/**
+ * Strand-independent keys: the smaller of each read and its reverse complement
+ *
+ * Minimizers are canonical, so a read and its reverse complement hit the same
+ * reference positions. Counting by those positions may thus share keys across
+ * strands; anything that reports the strand or the read bases may not.
+ *
+ * @param n    number of reads
+ * @param seq  reads
+ * @param key  array of size n, filled with seq[i].seq or its reverse complement
+ *
+ * @return buffer holding the reverse complements; to be freed by free() after key
+ */
+char *mm_dedup_canonical(int n, const mm_bseq1_t *seq, const char **key);
+
+/*
+ * Bounded cache from a read sequence to a mapping result, evicting the least
+ * recently used entry. It is not thread-safe: the pipeline only touches it
+ * from step 1, which never runs for two batches at the same time.
+ */
+struct mm_lru_s;
+typedef struct mm_lru_s mm_lru_t;
+
+mm_lru_t *mm_lru_init(int32_t max_n, void (*destroy)(void*));
+void mm_lru_destroy(mm_lru_t *c);
+
+// returns NULL on a miss; the result stays owned by the cache
+void *mm_lru_get(mm_lru_t *c, const char *key);
+
+// key is copied, val is owned by the cache from now on
+void mm_lru_put(mm_lru_t *c, const char *key, void *val);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
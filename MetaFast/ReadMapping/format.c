@@ -138,6 +138,53 @@ int mm_write_sam_hdr(const mm_idx_t *idx, const char *rg, const char *ver, int a
 	return ret;
 }
 
+int mm_write_hits_hdr(const mm_idx_t *mi, int with_magic)
+{
+	kstring_t str = {0,0,0};
+	mm_hit_blk_t b;
+	uint32_t i;
+	if (with_magic) str_copy(&str, MM_HIT_MAGIC, MM_HIT_MAGIC + 4);
+	b.type = MM_HIT_REFS, b.n = mi? mi->n_seq : 0;
+	str_copy(&str, (const char*)&b, (const char*)(&b + 1));
+	for (i = 0; i < b.n; ++i) {
+		uint32_t x[2];
+		x[0] = mi->seq[i].len, x[1] = strlen(mi->seq[i].name);
+		str_copy(&str, (const char*)x, (const char*)(x + 2));
+		str_copy(&str, mi->seq[i].name, mi->seq[i].name + x[1]);
+	}
+	mm_err_fwrite(str.s, 1, str.l, stdout);
+	free(str.s);
+	return 0;
+}
+
+void mm_hit_rec_set(mm_hit_rec_t *h, const mm_bseq1_t *t, int seg_idx, int n_seg, const mm_reg1_t *r)
+{
+	int flag = n_seg > 1? 0x1 : 0x0;
+	if (r->rev) flag |= 0x10;
+	if (r->parent != r->id) flag |= 0x100;
+	else if (!r->sam_pri) flag |= 0x800;
+	if (n_seg > 1) {
+		if (r->proper_frag) flag |= 0x2;
+		if (seg_idx == 0) flag |= 0x40;
+		else if (seg_idx == n_seg - 1) flag |= 0x80;
+	}
+	h->qid = t->rid;
+	h->rid = r->rid, h->pos = r->rs;
+	h->edits = r->p? r->p->dp_max2 : -1; // as written to the CIGAR by mm_write_sam3()
+	h->qlen = t->l_seq;
+	h->flag = flag, h->mapq = r->mapq;
+	h->dummy = 0;
+}
+
+void mm_write_hits(int n, const mm_hit_rec_t *h)
+{
+	mm_hit_blk_t b;
+	if (n <= 0) return;
+	b.type = MM_HIT_RECS, b.n = n;
+	mm_err_fwrite(&b, sizeof(mm_hit_blk_t), 1, stdout);
+	mm_err_fwrite(h, sizeof(mm_hit_rec_t), n, stdout);
+}
+
 static void write_cs_core(kstring_t *s, const uint8_t *tseq, const uint8_t *qseq, const mm_reg1_t *r, char *tmp, int no_iden, int write_tag)
 {
 	int i, q_off, t_off;
@@ -379,7 +426,10 @@ static void write_sam_cigar(kstring_t *s, int sam_flag, int in_tag, int qlen, co
             /*for (k = 0; k < r->p->n_cigar; ++k)
                 mm_sprintf_lite(s, ",%u", r->p->cigar[k]);*/
 
-            if (r->p->dp_max2 == 0) {
+            if (r->tiled) {
+                for (k = 0; k < r->p->n_cigar; ++k)
+                    mm_sprintf_lite(s, ",%u", r->p->cigar[k]);
+            } else if (r->p->dp_max2 == 0) {
                 mm_sprintf_lite(s, "%d%s", qlen, "M");
             } else{
                 mm_sprintf_lite(s, "%d%s", r->p->dp_max2, "I");   // r->p->dp_max2 = number of Edits from filters
@@ -402,7 +452,10 @@ static void write_sam_cigar(kstring_t *s, int sam_flag, int in_tag, int qlen, co
             printf("read length (qlen): %d\n", qlen);
             printf("mappingStartingPosition: %d\n", r->rs);*/
 
-            if (r->p->dp_max2 == 0) {
+            if (r->tiled) {
+                for (k = 0; k < r->p->n_cigar; ++k)
+                    mm_sprintf_lite(s, "%d%c", r->p->cigar[k]>>4, "MIDNSHP=XB"[r->p->cigar[k]&0xf]);
+            } else if (r->p->dp_max2 == 0) {
                 mm_sprintf_lite(s, "%d%s", qlen, "M");
             } else{
                 mm_sprintf_lite(s, "%d%s", r->p->dp_max2, "I");   // r->p->dp_max2 = number of Edits from filters
@@ -14,6 +14,7 @@
 #include "mmpriv.h"
 #include "kvec.h"
 #include "khash.h"
+#include "catalog.h"
 
 #define idx_hash(a) ((a)>>1)
 #define idx_eq(a, b) ((a)>>1 == (b)>>1)
@@ -31,6 +32,14 @@ typedef struct mm_idx_bucket_s {
 	void *h;     // hash table indexing _p_ and minimizers appearing once
 } mm_idx_bucket_t;
 
+typedef struct mm_idx_pack_s {
+	int32_t b;     // bucket bits; more than mi->b if minimizer>>mi->b doesn't fit in 32 bits
+	uint32_t *bo;  // keys of bucket i are key[bo[i]] to key[bo[i+1]-1]
+	uint32_t *key; // minimizer>>b, sorted in each bucket
+	uint32_t *po;  // positions of key[j] are pos[po[j]] to pos[po[j+1]-1]
+	uint32_t *pos; // packed positions; see mm_idx_t::pos_bits
+} mm_idx_pack_t;
+
 typedef struct {
 	int32_t st, en, max; // max is not used for now
 	int32_t score:30, strand:2;
@@ -65,6 +74,10 @@ void mm_idx_destroy(mm_idx_t *mi)
 			kh_destroy(idx, (idxhash_t*)mi->B[i].h);
 		}
 	}
+	if (mi->P) {
+		free(mi->P->bo); free(mi->P->key); free(mi->P->po); free(mi->P->pos);
+		free(mi->P);
+	}
 	if (mi->I) {
 		for (i = 0; i < mi->n_seq; ++i)
 			free(mi->I[i].a);
@@ -78,13 +91,28 @@ void mm_idx_destroy(mm_idx_t *mi)
 	free(mi->B); free(mi->S); free(mi);
 }
 
-const uint64_t *mm_idx_get(const mm_idx_t *mi, uint64_t minier, int *n)
+static const uint32_t *mm_idx_pack_get(const mm_idx_pack_t *P, uint64_t minier, int *n)
+{
+	uint32_t key = minier >> P->b, i = minier & ((1U<<P->b) - 1);
+	uint32_t lo = P->bo[i], hi = P->bo[i + 1], en = hi;
+	while (lo < hi) { // binary search for the first key >= minier>>b
+		uint32_t mid = lo + ((hi - lo) >> 1);
+		if (P->key[mid] < key) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == en || P->key[lo] != key) return 0;
+	*n = P->po[lo + 1] - P->po[lo];
+	return &P->pos[P->po[lo]];
+}
+
+const void *mm_idx_get(const mm_idx_t *mi, uint64_t minier, int *n)
 {
 	int mask = (1<<mi->b) - 1;
 	khint_t k;
 	mm_idx_bucket_t *b = &mi->B[minier&mask];
 	idxhash_t *h = (idxhash_t*)b->h;
 	*n = 0;
+	if (mi->P) return mm_idx_pack_get(mi->P, minier, n);
 	if (h == 0) return 0;
 	k = kh_get(idx, h, minier>>mi->b<<1);
 	if (k == kh_end(h)) return 0;
@@ -117,6 +145,12 @@ void mm_idx_stat(const mm_idx_t *mi)
 				if (kh_key(h, k)&1) ++n1;
 			}
 	}
+	if (mi->P) {
+		const mm_idx_pack_t *P = mi->P;
+		n = P->bo[1U<<P->b], sum = P->po[n];
+		for (i = 0; i < (uint32_t)n; ++i)
+			if (P->po[i + 1] - P->po[i] == 1) ++n1;
+	}
 	fprintf(stderr, "[M::%s::%.3f*%.2f] distinct minimizers: %d (%.2f%% are singletons); average occurrences: %.3lf; average spacing: %.3lf; total length: %ld\n",
 			__func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), n, 100.0*n1/n, (double)sum / n, (double)len / sum, (long)len);
 }
@@ -168,6 +202,16 @@ int32_t mm_idx_cal_max_occ(const mm_idx_t *mi, float f)
 	uint32_t thres;
 	khint_t *a, k;
 	if (f <= 0.) return INT32_MAX;
+	if (mi->P) {
+		const mm_idx_pack_t *P = mi->P;
+		n = P->bo[1U<<P->b];
+		a = (uint32_t*)malloc(n * 4);
+		for (k = 0; k < n; ++k)
+			a[k] = P->po[k + 1] - P->po[k];
+		thres = ks_ksmall_uint32_t(n, a, (uint32_t)((1. - f) * n)) + 1;
+		free(a);
+		return thres;
+	}
 	for (i = 0; i < 1<<mi->b; ++i)
 		if (mi->B[i].h) n += kh_size((idxhash_t*)mi->B[i].h);
 	a = (uint32_t*)malloc(n * 4);
@@ -247,6 +291,87 @@ static void mm_idx_post(mm_idx_t *mi, int n_threads)
 	kt_for(n_threads, worker_post, mi, 1<<mi->b);
 }
 
+/*****************
+ * Packed layout *
+ *****************/
+
+int mm_idx_pack(mm_idx_t *mi)
+{
+	int32_t b = mi->b, rid_bits, pos_bits;
+	uint32_t i, max_len = 0, n_key = 0, j;
+	uint64_t n_pos = 0, pos_mask;
+	mm_idx_pack_t *P;
+	mm128_t *a;
+
+	if (mi->P) return 0;
+	for (i = 0; i < mi->n_seq; ++i)
+		if (mi->seq[i].len > max_len) max_len = mi->seq[i].len;
+	for (rid_bits = 1; rid_bits < 32 && 1ULL<<rid_bits < mi->n_seq; ++rid_bits);
+	for (pos_bits = 1; pos_bits < 32 && 1ULL<<(pos_bits-1) < max_len; ++pos_bits); // room for pos<<1 | strand
+	if (rid_bits + pos_bits > 32) return -1;
+	for (i = 0; i < 1U<<mi->b; ++i) {
+		idxhash_t *h = (idxhash_t*)mi->B[i].h;
+		if (h == 0) continue;
+		n_key += kh_size(h);
+		n_pos += kh_size(h) + mi->B[i].n; // singletons are not in _p_, and each key with >1 positions has one
+	}
+	if (mi->k * 2 - b > 32) b = mi->k * 2 - 32;
+	if (n_pos > UINT32_MAX || 1ULL<<b > n_key + (1ULL<<mi->b)) return -1; // more new buckets than keys wouldn't save memory
+
+	// keys in the order of the packed buckets; y points back to the hash table entry
+	a = (mm128_t*)malloc((size_t)n_key * sizeof(mm128_t));
+	for (i = j = 0; i < 1U<<mi->b; ++i) {
+		idxhash_t *h = (idxhash_t*)mi->B[i].h;
+		khint_t k;
+		if (h == 0) continue;
+		for (k = 0; k < kh_end(h); ++k) {
+			uint64_t minier;
+			if (!kh_exist(h, k)) continue;
+			minier = kh_key(h, k)>>1<<mi->b | i;
+			a[j].x = (minier & ((1ULL<<b) - 1)) << 32 | minier >> b;
+			a[j++].y = (uint64_t)i<<32 | k;
+		}
+	}
+	radix_sort_128x(a, a + n_key);
+
+	P = (mm_idx_pack_t*)calloc(1, sizeof(mm_idx_pack_t));
+	P->b = b;
+	P->bo = (uint32_t*)calloc((1ULL<<b) + 1, 4);
+	P->key = (uint32_t*)malloc((size_t)n_key * 4);
+	P->po = (uint32_t*)malloc(((size_t)n_key + 1) * 4);
+	P->pos = (uint32_t*)malloc(n_pos * 4);
+	pos_mask = (1ULL<<pos_bits) - 1;
+	for (j = 0, n_pos = 0; j < n_key; ++j) {
+		mm_idx_bucket_t *bkt = &mi->B[a[j].y>>32];
+		idxhash_t *h = (idxhash_t*)bkt->h;
+		khint_t k = (uint32_t)a[j].y;
+		++P->bo[(a[j].x>>32) + 1];
+		P->key[j] = (uint32_t)a[j].x;
+		P->po[j] = n_pos;
+		if (kh_key(h, k)&1) {
+			uint64_t r = kh_val(h, k);
+			P->pos[n_pos++] = (r>>32) << pos_bits | (r & pos_mask);
+		} else {
+			uint64_t *p = &bkt->p[kh_val(h, k)>>32];
+			uint32_t l, n = (uint32_t)kh_val(h, k);
+			for (l = 0; l < n; ++l)
+				P->pos[n_pos++] = (p[l]>>32) << pos_bits | (p[l] & pos_mask);
+		}
+	}
+	P->po[n_key] = n_pos;
+	for (i = 0; i < 1U<<b; ++i)
+		P->bo[i + 1] += P->bo[i];
+	free(a);
+
+	for (i = 0; i < 1U<<mi->b; ++i) {
+		free(mi->B[i].p);
+		kh_destroy(idx, (idxhash_t*)mi->B[i].h);
+		mi->B[i].p = 0, mi->B[i].h = 0, mi->B[i].n = 0;
+	}
+	mi->P = P, mi->pos_bits = pos_bits;
+	return 0;
+}
+
 /******************
  * Generate index *
  ******************/
@@ -407,11 +532,13 @@ mm_idx_t *mm_idx_str(int w, int k, int is_hpc, int bucket_bits, int n, const cha
 		mm_idx_seq_t *p = &mi->seq[i];
 		uint32_t j;
 		if (name && name[i]) {
+			khint_t itr;
 			int absent;
 			p->name = (char*)kmalloc(mi->km, strlen(name[i]) + 1);
 			strcpy(p->name, name[i]);
-			kh_put(str, h, p->name, &absent);
+			itr = kh_put(str, h, p->name, &absent);
 			assert(absent);
+			kh_val(h, itr) = i;
 		}
 		p->offset = sum_len;
 		p->len = strlen(s);
@@ -442,6 +569,7 @@ void mm_idx_dump(FILE *fp, const mm_idx_t *mi)
 	uint64_t sum_len = 0;
 	uint32_t x[5], i;
 
+	assert(mi->P == 0); // a packed index has no hash tables to write
 	x[0] = mi->w, x[1] = mi->k, x[2] = mi->b, x[3] = mi->n_seq, x[4] = mi->flag;
 	fwrite(MM_IDX_MAGIC, 1, 4, fp);
 	fwrite(x, 4, 5, fp);
@@ -634,6 +762,102 @@ int mm_idx_alt_read(mm_idx_t *mi, const char *fn)
 	return n_alt;
 }
 
+static int mm_idx_taxa_read_db(mm_idx_t *mi, const char *fn, int rank)
+{ // same grouping as mm_idx_taxa_read(), with the lineages taken from a compiled catalog
+	int n_taxa = 0, n_seq = 0;
+	uint32_t i;
+	khash_t(str) *h;
+	khint_t k;
+	kvec_t(char*) grps = {0,0,0}; // the keys that aren't catalog strings
+	mf_db_t *db;
+	if ((db = mf_db_load(fn)) == 0) return -1;
+	h = kh_init(str);
+	for (i = 0; i < mi->n_seq; ++i) {
+		const mf_db_taxon_t *t;
+		const char *q;
+		char *grp = 0;
+		int32_t tid;
+		int absent;
+		mi->seq[i].taxon = -1;
+		if ((tid = mf_db_acc2taxon(db, mi->seq[i].name)) < 0) continue;
+		t = &db->taxa[tid];
+		q = mf_db_str(db, t->taxid);
+		if (rank > 0 && t->tax_lin) { // the group is the lineage down to the rank-th clade
+			const char *p;
+			int r = 0;
+			for (p = mf_db_str(db, t->tax_lin); *p && !(*p == '|' && ++r == rank); ++p) { }
+			if (r == rank) q = grp = strndup(mf_db_str(db, t->tax_lin), p - mf_db_str(db, t->tax_lin));
+		}
+		k = kh_put(str, h, q, &absent);
+		if (absent) kh_val(h, k) = n_taxa++;
+		mi->seq[i].taxon = kh_val(h, k), ++n_seq;
+		if (absent && grp) kv_push(char*, 0, grps, grp); // now a key
+		else free(grp);
+	}
+	kh_destroy(str, h);
+	for (i = 0; i < grps.n; ++i) free(grps.a[i]);
+	free(grps.a);
+	mf_db_destroy(db);
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s] assigned %d sequences to %d taxa\n", __func__, n_seq, n_taxa);
+	return n_seq;
+}
+
+int mm_idx_taxa_read(mm_idx_t *mi, const char *fn, int rank)
+{
+	int n_taxa = 0, n_seq = 0;
+	uint32_t i;
+	gzFile fp;
+	kstream_t *ks;
+	kstring_t str = {0,0,0};
+	khash_t(str) *h;
+	khint_t k;
+	kvec_t(char*) keys = {0,0,0}; // the lines are overwritten; the hash keys are copies
+	if (fn && strcmp(fn, "-") && mf_db_is_db(fn)) return mm_idx_taxa_read_db(mi, fn, rank);
+	fp = fn && strcmp(fn, "-")? gzopen(fn, "r") : gzdopen(fileno(stdin), "r");
+	if (fp == 0) return -1;
+	ks = ks_init(fp);
+	if (mi->h == 0) mm_idx_index_name(mi);
+	for (i = 0; i < mi->n_seq; ++i) mi->seq[i].taxon = -1;
+	h = kh_init(str);
+	while (ks_getuntil(ks, KS_SEP_LINE, &str, 0) >= 0) { // Accession, Length, TaxID, Lineage, TaxID_Lineage
+		char *p, *q, *fld[5];
+		int id, n_fld = 0, absent;
+		for (p = q = str.s;; ++p) {
+			if (*p == '\t' || *p == 0) {
+				int c = *p;
+				*p = 0;
+				if (n_fld < 5) fld[n_fld++] = q;
+				if (c == 0) break;
+				q = p + 1;
+			}
+		}
+		if (n_fld < 3 || (id = mm_idx_name2id(mi, fld[0])) < 0) continue;
+		q = fld[2];
+		if (rank > 0 && n_fld >= 5) { // the group is the lineage down to the rank-th clade
+			int r = 0;
+			for (p = fld[4]; *p && !(*p == '|' && ++r == rank); ++p) { }
+			*p = 0;
+			if (r == rank) q = fld[4];
+		}
+		k = kh_put(str, h, q, &absent);
+		if (absent) {
+			kv_push(char*, 0, keys, strdup(q));
+			kh_key(h, k) = keys.a[keys.n - 1], kh_val(h, k) = n_taxa++;
+		}
+		mi->seq[id].taxon = kh_val(h, k), ++n_seq;
+	}
+	kh_destroy(str, h);
+	for (i = 0; i < keys.n; ++i) free(keys.a[i]);
+	free(keys.a);
+	ks_destroy(ks);
+	gzclose(fp);
+	free(str.s);
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s] assigned %d sequences to %d taxa\n", __func__, n_seq, n_taxa);
+	return n_seq;
+}
+
 #define sort_key_bed(a) ((a).st)
 KRADIX_SORT_INIT(bed, mm_idx_intv1_t, sort_key_bed, 4)
 
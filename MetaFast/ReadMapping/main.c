@@ -7,6 +7,7 @@
 #include "mmpriv.h"
 #include "ketopt.h"
 #include "filter.h"
+#include "metrics.h"
 
 #define MM_VERSION "2.17-r974-dirty-SneakySnake"
 
@@ -80,6 +81,16 @@ static ko_longopt_t long_options[] = {
 	{ "min-dp-score",   ko_required_argument, 's' },
 	{ "sam",            ko_no_argument,       'a' },
 	{ "filter",         ko_no_argument,       34600 },
+	{ "metrics",        ko_required_argument, 346 },
+	{ "dedup",          ko_optional_argument, 347 },
+	{ "band-vote",      ko_optional_argument, 348 },
+	{ "taxa",           ko_required_argument, 349 },
+	{ "taxon-rank",     ko_required_argument, 350 },
+	{ "hits-bin",       ko_no_argument,       351 },
+	{ "pipeline-depth", ko_required_argument, 352 },
+	{ "long-read",      ko_no_argument,       353 },
+	{ "seed-evidence",  ko_no_argument,       354 },
+	{ "max-edit-frac",  ko_required_argument, 355 },
 	{ 0, 0, 0 }
 	
 };
@@ -116,7 +127,12 @@ int main(int argc, char *argv[])
 	mm_mapopt_t opt;
 	mm_idxopt_t ipt;
 	int i, c, n_threads = 3, n_parts, old_best_n = -1;
-	char *fnw = 0, *rg = 0, *junc_bed = 0, *s, *alt_list = 0;
+	char *fnw = 0, *rg = 0, *junc_bed = 0, *s, *alt_list = 0, *fn_metrics = 0, *fn_taxa = 0;
+	int taxon_rank = 0;
+	int n_mt_part = 0;
+	char **mt_name = 0;
+	mm_metrics_t mt_total, *mt_part = 0;
+	double t_mt;
 	FILE *fp_help = stderr;
 	mm_idx_reader_t *idx_rdr;
 	mm_idx_t *mi;
@@ -221,6 +237,22 @@ int main(int argc, char *argv[])
 		else if (c == 343) opt.chain_gap_scale = atof(o.arg); // --chain-gap-scale
 		else if (c == 344) alt_list = o.arg; // --alt
 		else if (c == 345) opt.alt_drop = atof(o.arg); // --alt-drop
+		else if (c == 346) fn_metrics = o.arg, mm_metrics_on = 1; // --metrics
+		else if (c == 347) { // --dedup
+			opt.flag |= MM_F_DEDUP;
+			if (o.arg) opt.dedup_cache = atoi(o.arg);
+		}
+		else if (c == 348) { // --band-vote
+			opt.flag |= MM_F_BAND_VOTE;
+			if (o.arg) opt.band_w = atoi(o.arg);
+		}
+		else if (c == 349) fn_taxa = o.arg, opt.flag |= MM_F_TAXON_ONCE; // --taxa
+		else if (c == 350) taxon_rank = atoi(o.arg); // --taxon-rank
+		else if (c == 351) opt.flag |= MM_F_OUT_HITS; // --hits-bin
+		else if (c == 352) opt.pipeline_depth = atoi(o.arg); // --pipeline-depth
+		else if (c == 353) opt.flag |= MM_F_LONG_READ; // --long-read
+		else if (c == 354) opt.flag |= MM_F_SEED_EVIDENCE; // --seed-evidence
+		else if (c == 355) opt.max_edit_frac = (float)atof(o.arg); // --max-edit-frac
 		else if (c == 34600) {
 			filter = o.arg;
 			//printf("Filter-Argument: %s\n", filter);
@@ -310,6 +342,18 @@ int main(int argc, char *argv[])
 		fprintf(fp_help, "    -r NUM       bandwidth used in chaining and DP-based alignment [%d]\n", opt.bw);
 		fprintf(fp_help, "    -n INT       minimal number of minimizers on a chain [%d]\n", opt.min_cnt);
 		fprintf(fp_help, "    -m INT       minimal chaining score (matching bases minus log gap penalty) [%d]\n", opt.min_chain_score);
+		fprintf(fp_help, "    --band-vote[=INT] take candidates from diagonal bands of width INT, ranked by\n");
+		fprintf(fp_help, "                 read bases covered by seeds [-r]\n");
+		fprintf(fp_help, "    --seed-evidence  skip the filter for candidates with at most -r mismatches outside\n");
+		fprintf(fp_help, "                 their seeds, or with minimizers missing that -r edits can't explain\n");
+		fprintf(fp_help, "    --taxa=FILE  stop verifying the candidates of a taxon once one passes the filter;\n");
+		fprintf(fp_help, "                 FILE is a db_info table giving the TaxID of each reference []\n");
+		fprintf(fp_help, "    --taxon-rank=INT  with --taxa, one taxon per clade at the INT-th rank of the\n");
+		fprintf(fp_help, "                 TaxID lineage (7 for species); 0 for TaxIDs [%d]\n", taxon_rank);
+		fprintf(fp_help, "    --long-read  chain the seeds and align the chains tile by tile instead of filtering\n");
+		fprintf(fp_help, "                 read-length windows; set by -x map-pb/map-ont/map-hifi\n");
+		fprintf(fp_help, "    --max-edit-frac=FLOAT  with --long-read, drop alignments with more than FLOAT\n");
+		fprintf(fp_help, "                 edits per aligned base [%g]\n", opt.max_edit_frac);
 //		fprintf(fp_help, "    -T INT       SDUST threshold; 0 to disable SDUST [%d]\n", opt.sdust_thres); // TODO: this option is never used; might be buggy
 		fprintf(fp_help, "    -X           skip self and dual mappings (for the all-vs-all mode)\n");
 		fprintf(fp_help, "    -p FLOAT     min secondary-to-primary score ratio [%g]\n", opt.pri_ratio);
@@ -324,6 +368,7 @@ int main(int argc, char *argv[])
 		fprintf(fp_help, "    -u CHAR      how to find GT-AG. f:transcript strand, b:both strands, n:don't match GT-AG [n]\n");
 		fprintf(fp_help, "  Input/Output:\n");
 		fprintf(fp_help, "    -a           output in the SAM format (PAF by default)\n");
+		fprintf(fp_help, "    --hits-bin   output fixed-width binary records of the accepted locations\n");
 		fprintf(fp_help, "    -o FILE      output alignments to FILE [stdout]\n");
 		fprintf(fp_help, "    -L           write CIGAR with >65535 ops at the CG tag\n");
 		fprintf(fp_help, "    -R STR       SAM read group line in a format like '@RG\\tID:foo\\tSM:bar' []\n");
@@ -334,11 +379,15 @@ int main(int argc, char *argv[])
 		fprintf(fp_help, "    -Y           use soft clipping for supplementary alignments\n");
 		fprintf(fp_help, "    -t INT       number of threads [%d]\n", n_threads);
 		fprintf(fp_help, "    -K NUM       minibatch size for mapping [500M]\n");
+		fprintf(fp_help, "    --pipeline-depth INT  minibatches in flight; with 3 or more, reading and writing\n");
+		fprintf(fp_help, "                 overlap the mapping of other minibatches [2, or 3 with -2]\n");
+		fprintf(fp_help, "    --metrics FILE  write per-stage timers and counters to FILE in JSON\n");
+		fprintf(fp_help, "    --dedup[=INT]   map reads with identical sequences once; remember INT reads across batches [%d]\n", opt.dedup_cache);
 //		fprintf(fp_help, "    -v INT       verbose level [%d]\n", mm_verbose);
 		fprintf(fp_help, "    --version    show version number\n");
 		fprintf(fp_help, "  Preset:\n");
 		fprintf(fp_help, "    -x STR       preset (always applied before other options; see minimap2.1 for details) []\n");
-		fprintf(fp_help, "                 - map-pb/map-ont - PacBio/Nanopore vs reference mapping\n");
+		fprintf(fp_help, "                 - map-pb/map-ont - PacBio/Nanopore vs reference mapping (--long-read)\n");
 		fprintf(fp_help, "                 - ava-pb/ava-ont - PacBio/Nanopore read overlap\n");
 		fprintf(fp_help, "                 - asm5/asm10/asm20 - asm-to-ref mapping, for ~0.1/1/5%% sequence divergence\n");
 		fprintf(fp_help, "                 - splice/splice:hq - long-read/Pacbio-CCS spliced alignment\n");
@@ -363,15 +412,22 @@ int main(int argc, char *argv[])
 	}
 	if (opt.best_n == 0 && (opt.flag&MM_F_CIGAR) && mm_verbose >= 2)
 		fprintf(stderr, "[WARNING]\033[1;31m `-N 0' reduces alignment accuracy. Please use --secondary=no to suppress secondary alignments.\033[0m\n");
+	memset(&mt_total, 0, sizeof(mm_metrics_t));
+	t_mt = mm_metrics_clock();
 	while ((mi = mm_idx_reader_read(idx_rdr, n_threads)) != 0) {
 		int ret;
+		memset(&mm_map_metrics, 0, sizeof(mm_metrics_t));
+		mm_metrics_lap(&mm_map_metrics, MM_MT_INDEX, &t_mt);
 		if ((opt.flag & MM_F_CIGAR) && (mi->flag & MM_I_NO_SEQ)) {
 			fprintf(stderr, "[ERROR] the prebuilt index doesn't contain sequences.\n");
 			mm_idx_destroy(mi);
 			mm_idx_reader_close(idx_rdr);
 			return 1;
 		}
-		if ((opt.flag & MM_F_OUT_SAM) && idx_rdr->n_parts == 1) {
+		if (opt.flag & MM_F_OUT_HITS) {
+			if (opt.split_prefix == 0) mm_write_hits_hdr(mi, idx_rdr->n_parts == 1); // one table per index part
+			else if (idx_rdr->n_parts == 1) mm_write_hits_hdr(0, 1); // the merged table comes from mm_split_merge()
+		} else if ((opt.flag & MM_F_OUT_SAM) && idx_rdr->n_parts == 1) {
 			if (mm_idx_reader_eof(idx_rdr)) {
 				if (opt.split_prefix == 0)
 					ret = mm_write_sam_hdr(mi, rg, MM_VERSION, argc, argv);
@@ -395,6 +451,10 @@ int main(int argc, char *argv[])
 		if (mm_verbose >= 3) mm_idx_stat(mi);
 		if (junc_bed) mm_idx_bed_read(mi, junc_bed, 1);
 		if (alt_list) mm_idx_alt_read(mi, alt_list);
+		if (fn_taxa && mm_idx_taxa_read(mi, fn_taxa, taxon_rank) < 0) {
+			fprintf(stderr, "[ERROR] failed to open file '%s': %s\n", fn_taxa, strerror(errno));
+			return 1;
+		}
 		ret = 0;
 		if (!(opt.flag & MM_F_FRAG_MODE)) {
 			for (i = o.ind + 1; i < argc; ++i) {
@@ -409,12 +469,23 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "ERROR: failed to map the query file\n");
 			exit(EXIT_FAILURE);
 		}
+		mt_part = (mm_metrics_t*)realloc(mt_part, (n_mt_part + 1) * sizeof(mm_metrics_t));
+		mt_name = (char**)realloc(mt_name, (n_mt_part + 1) * sizeof(char*));
+		mt_part[n_mt_part] = mm_map_metrics;
+		mt_name[n_mt_part] = (char*)malloc(strlen(argv[o.ind]) + 16);
+		sprintf(mt_name[n_mt_part], "%s:%d", argv[o.ind], n_mt_part);
+		++n_mt_part;
+		mm_metrics_add(&mt_total, &mm_map_metrics);
+		t_mt = mm_metrics_clock();
 	}
 	n_parts = idx_rdr->n_parts;
 	mm_idx_reader_close(idx_rdr);
 
-	if (opt.split_prefix)
+	if (opt.split_prefix) {
+		memset(&mm_map_metrics, 0, sizeof(mm_metrics_t));
 		mm_split_merge(argc - (o.ind + 1), (const char**)&argv[o.ind + 1], &opt, n_parts);
+		mm_metrics_add(&mt_total, &mm_map_metrics);
+	}
 
 	if (fflush(stdout) == EOF) {
 		perror("[ERROR] failed to write the results");
@@ -428,7 +499,15 @@ int main(int argc, char *argv[])
 			fprintf(stderr, " %s", argv[i]);
 		fprintf(stderr, "\n[M::%s] Real time: %.3f sec; CPU: %.3f sec; Peak RSS: %.3f GB\n", __func__, realtime() - mm_realtime0, cputime(), peakrss() / 1024.0 / 1024.0 / 1024.0);
 	}
-	printf("@ Filter calls: %d", filter_calls);
+	if (fn_metrics) {
+		if (mm_metrics_dump(fn_metrics, &mt_total, n_mt_part, mt_name, mt_part) < 0)
+			fprintf(stderr, "[WARNING]\033[1;31m failed to write metrics to '%s': %s\033[0m\n", fn_metrics, strerror(errno));
+		for (i = 0; i < n_mt_part; ++i) free(mt_name[i]);
+		free(mt_name); free(mt_part);
+	}
+	if (opt.flag & MM_F_OUT_HITS) // keep the binary stream clean
+		fprintf(stderr, "@ Filter calls: %d\n", filter_calls);
+	else printf("@ Filter calls: %d", filter_calls);
 	return 0;
 }
 
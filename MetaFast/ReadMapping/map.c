@@ -2,6 +2,7 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include "kthread.h"
 #include "kvec.h"
 #include "kalloc.h"
@@ -16,6 +17,8 @@
 #include "ksort.h"
 
 #include "filter.h"
+#include "metrics.h"
+#include "dedup.h"
 //////// filters ///////////
 #include "filters/SneakySnake/SneakySnake.h" //changed from including the sneakysnake in this folder... maybe revert if this causes issues
 
@@ -40,6 +43,7 @@
 typedef struct {
     uint64_t seeds;
     uint64_t location;
+    uint64_t x; // strand<<63 | rid<<32 | number of anchors with MM_F_BAND_VOTE, else the last seed's reference position
 } seed_map_entry_t;
 
 #define ks_lt_seed_map_entry(a, b) ((a).seeds < (b).seeds)
@@ -50,7 +54,9 @@ KSORT_INIT(seed_map_sort, seed_map_entry_t, ks_lt_seed_map_entry);
 
 struct mm_tbuf_s {
 	void *km;
+	void *km_reg; // if set, regions and CIGARs are carved from it and released together with the buffer
 	int rep_len, frag_gap;
+	mm_metrics_t mt;
 };
 
 mm_tbuf_t *mm_tbuf_init(void)
@@ -65,6 +71,7 @@ void mm_tbuf_destroy(mm_tbuf_t *b)
 {
 	if (b == 0) return;
 	km_destroy(b->km);
+	km_destroy(b->km_reg);
 	free(b);
 }
 
@@ -131,7 +138,7 @@ typedef struct {
 	uint32_t n;
 	uint32_t q_pos, q_span;
 	uint32_t seg_id:31, is_tandem:1;
-	const uint64_t *cr;
+	const void *cr; // decoded by mm_idx_hit()
 } mm_match_t;
 
 static mm_match_t *collect_matches(void *km, int *_n_m, int max_occ, const mm_idx_t *mi, const mm128_v *mv, int64_t *n_a, int *rep_len, int *n_mini_pos, uint64_t **mini_pos)
@@ -143,7 +150,7 @@ static mm_match_t *collect_matches(void *km, int *_n_m, int max_occ, const mm_id
 	*mini_pos = (uint64_t*)kmalloc(km, mv->n * sizeof(uint64_t));
 	m = (mm_match_t*)kmalloc(km, mv->n * sizeof(mm_match_t));
 	for (i = 0, n_m = 0, *rep_len = 0, *n_a = 0; i < mv->n; ++i) {
-		const uint64_t *cr;
+		const void *cr;
 		mm128_t *p = &mv->a[i];
 		uint32_t q_pos = (uint32_t)p->y, q_span = p->x & 0xff;
 		int t;
@@ -208,7 +215,7 @@ static mm128_t *collect_seed_hits_heap(void *km, const mm_mapopt_t *opt, int max
 
 	for (i = 0, heap_size = 0; i < n_m; ++i) {
 		if (m[i].n > 0) {
-			heap[heap_size].x = m[i].cr[0];
+			heap[heap_size].x = mm_idx_hit(mi, m[i].cr, 0);
 			heap[heap_size].y = (uint64_t)i<<32;
 			++heap_size;
 		}
@@ -236,7 +243,7 @@ static mm128_t *collect_seed_hits_heap(void *km, const mm_mapopt_t *opt, int max
 		// update the heap
 		if ((uint32_t)heap->y < q->n - 1) {
 			++heap[0].y;
-			heap[0].x = m[heap[0].y>>32].cr[(uint32_t)heap[0].y];
+			heap[0].x = mm_idx_hit(mi, m[heap[0].y>>32].cr, (uint32_t)heap[0].y);
 		} else {
 			heap[0] = heap[heap_size - 1];
 			--heap_size;
@@ -269,18 +276,18 @@ static mm128_t *collect_seed_hits(void *km, const mm_mapopt_t *opt, int max_occ,
 	a = (mm128_t*)kmalloc(km, *n_a * sizeof(mm128_t));
 	for (i = 0, *n_a = 0; i < n_m; ++i) {
 		mm_match_t *q = &m[i];
-		const uint64_t *r = q->cr;
 		uint32_t k;
 		for (k = 0; k < q->n; ++k) {
-			int32_t is_self, rpos = (uint32_t)r[k] >> 1;
+			uint64_t r = mm_idx_hit(mi, q->cr, k);
+			int32_t is_self, rpos = (uint32_t)r >> 1;
 			mm128_t *p;
-			if (skip_seed(opt->flag, r[k], q, qname, qlen, mi, &is_self)) continue;
+			if (skip_seed(opt->flag, r, q, qname, qlen, mi, &is_self)) continue;
 			p = &a[(*n_a)++];
-			if ((r[k]&1) == (q->q_pos&1)) { // forward strand
-				p->x = (r[k]&0xffffffff00000000ULL) | rpos;
+			if ((r&1) == (q->q_pos&1)) { // forward strand
+				p->x = (r&0xffffffff00000000ULL) | rpos;
 				p->y = (uint64_t)q->q_span << 32 | q->q_pos >> 1;
 			} else { // reverse strand
-				p->x = 1ULL<<63 | (r[k]&0xffffffff00000000ULL) | rpos;
+				p->x = 1ULL<<63 | (r&0xffffffff00000000ULL) | rpos;
 				p->y = (uint64_t)q->q_span << 32 | (qlen - ((q->q_pos>>1) + 1 - q->q_span) - 1);
 			}
 			p->y |= (uint64_t)q->seg_id << MM_SEED_SEG_SHIFT;
@@ -316,6 +323,112 @@ static mm_reg1_t *align_regs(const mm_mapopt_t *opt, const mm_idx_t *mi, void *k
 	return regs;
 }
 
+static mm_reg1_t *copy_regs(void *km, int n_reg, const mm_reg1_t *reg);
+
+/*
+ * Long reads (MM_F_LONG_READ): a read-length reference window is no use for
+ * them, so the seeds are chained as minimap2 does and each chain is aligned
+ * tile by tile with mm_align_tiled(). Consumes a[]; the regions go to b->km_reg
+ * if it is set.
+ */
+static void map_long(const mm_idx_t *mi, int qlen, const char *seq, int *n_regs, mm_reg1_t **regs, mm_tbuf_t *b, const mm_mapopt_t *opt, uint32_t hash, int rep_len,
+					 int64_t n_a, mm128_t *a, int n_mini_pos, uint64_t *mini_pos)
+{
+	int i, n_regs0, max_gap_ref = opt->max_gap_ref > 0? opt->max_gap_ref : opt->max_gap;
+	uint64_t *u;
+	mm_reg1_t *regs0;
+	double t_mt = mm_metrics_clock();
+
+	a = mm_chain_dp(max_gap_ref, opt->max_gap, opt->bw, opt->max_chain_skip, opt->max_chain_iter, opt->min_cnt, opt->min_chain_score, opt->chain_gap_scale, 0, 1, n_a, a, &n_regs0, &u, b->km);
+	regs0 = mm_gen_regs(b->km, hash, qlen, n_regs0, u, a);
+	b->mt.c[MM_MC_CANDIDATES] += n_regs0;
+	chain_post(opt, max_gap_ref, mi, b->km, qlen, 1, &qlen, &n_regs0, regs0, a);
+	mm_est_err(mi, qlen, n_regs0, regs0, a, n_mini_pos, mini_pos);
+	mm_metrics_lap(&b->mt, MM_MT_CAND, &t_mt);
+
+	regs0 = mm_align_tiled(b->km, opt, mi, qlen, seq, &n_regs0, regs0, a, &b->mt.c[MM_MC_FILTER_CALLS]);
+	if (!(opt->flag & MM_F_ALL_CHAINS)) { // as align_regs()
+		mm_set_parent(b->km, opt->mask_level, n_regs0, regs0, opt->a * 2 + opt->b, opt->flag&MM_F_HARD_MLEVEL, opt->alt_drop);
+		mm_select_sub(b->km, opt->pri_ratio, mi->k*2, opt->best_n, &n_regs0, regs0);
+		mm_set_sam_pri(n_regs0, regs0);
+	}
+	mm_set_mapq(b->km, n_regs0, regs0, opt->min_chain_score, opt->a, rep_len, 0);
+	b->mt.c[MM_MC_FILTER_PASS] += n_regs0;
+	mm_metrics_lap(&b->mt, MM_MT_FILTER, &t_mt);
+
+	if (b->km_reg && n_regs0 > 0) {
+		mm_reg1_t *r = copy_regs(b->km_reg, n_regs0, regs0);
+		for (i = 0; i < n_regs0; ++i) free(regs0[i].p);
+		free(regs0);
+		regs0 = r;
+	} else if (n_regs0 == 0) {
+		free(regs0);
+		regs0 = 0;
+	}
+	*n_regs = n_regs0, *regs = regs0;
+	kfree(b->km, a);
+	kfree(b->km, u);
+}
+
+/*
+ * D-SOFT-like candidate generation: anchors are binned into diagonal bands of
+ * width w on each reference and strand. A band scores the number of distinct
+ * read bases covered by its seeds, so anchors split by an indel, or not
+ * adjacent in a[], still vote for the same location. The bands with at least
+ * min_cnt anchors are written to m[1..n], the return value. The location of a
+ * band is its most frequent diagonal, moved inside the reference if needed.
+ */
+static int collect_band_cands(void *km, const mm_idx_t *mi, int qlen, int64_t n_a, const mm128_t *a, int32_t w, int min_cnt, seed_map_entry_t *m)
+{
+	mm128_t *b;
+	uint64_t *y;
+	int32_t *cnt;
+	int64_t i, j, k;
+	int n = 0;
+	if (n_a == 0) return 0;
+	if (w < 1) w = 1;
+	b = (mm128_t*)kmalloc(km, n_a * sizeof(mm128_t));
+	y = (uint64_t*)kmalloc(km, n_a * sizeof(uint64_t));
+	cnt = (int32_t*)kcalloc(km, w, sizeof(int32_t));
+	for (i = 0; i < n_a; ++i) {
+		int64_t diag = (int64_t)(int32_t)a[i].x - (int32_t)a[i].y, band;
+		band = diag >= 0? diag / w : -((-diag + w - 1) / w);
+		b[i].x = (a[i].x & 0xffffffff00000000ULL) | (uint32_t)(band + 0x80000000LL); // the order of bands is kept
+		b[i].y = (uint64_t)(uint32_t)a[i].y << 32 | (uint64_t)(diag - band * w) << 8 | (a[i].y>>32&0xff);
+	}
+	radix_sort_128x(b, b + n_a);
+	for (i = 0, j = 1; j <= n_a; ++j) {
+		int32_t best = 0, cov = -1, rid, len;
+		int64_t band, diag, loc;
+		uint64_t bases = 0;
+		if (j < n_a && b[j].x == b[i].x) continue;
+		if (j - i < min_cnt) { i = j; continue; }
+		for (k = i; k < j; ++k) y[k - i] = b[k].y;
+		radix_sort_64(y, y + (j - i)); // by the query position
+		for (k = 0; k < j - i; ++k) {
+			int32_t qe = y[k] >> 32, span = y[k] & 0xff, off = y[k] >> 8 & 0xffffff;
+			if (qe - span >= cov) bases += span;
+			else if (qe > cov) bases += qe - cov;
+			if (qe > cov) cov = qe;
+			if (++cnt[off] > cnt[best]) best = off;
+		}
+		for (k = 0; k < j - i; ++k) cnt[y[k] >> 8 & 0xffffff] = 0;
+		rid = b[i].x << 1 >> 33, len = mi->seq[rid].len;
+		if (qlen <= len) {
+			band = (int64_t)(uint32_t)b[i].x - 0x80000000LL;
+			diag = band * w + best;
+			loc = diag < 0? 0 : diag + qlen > len? len - qlen : diag;
+			++n;
+			m[n].seeds = bases;
+			m[n].location = mi->seq[rid].offset + loc;
+			m[n].x = (b[i].x & 0xffffffff00000000ULL) | (uint32_t)(j - i);
+		}
+		i = j;
+	}
+	kfree(km, cnt); kfree(km, y); kfree(km, b);
+	return n;
+}
+
 // Comparison function for location sorting
 int compare(const void *a, const void *b) {
     uint64_t *pa = (uint64_t*)a;
@@ -323,6 +436,319 @@ int compare(const void *a, const void *b) {
     return (*pb > *pa) - (*pb < *pa);  // sort in descending order
 }
 
+static void get_window(const mm_idx_t *mi, uint64_t st, int len, int rev, char *buf)
+{ // reference bases [st,st+len) as a string, reverse-complemented on the reverse strand
+	int l;
+	if (!rev) {
+		for (l = 0; l < len; ++l)
+			buf[l] = "ACGTN"[mm_seq4_get(mi->S, st + l)];
+	} else {
+		for (l = 0; l < len; ++l)
+			buf[l] = "TGCAN"[mm_seq4_get(mi->S, st + len - 1 - l)];
+	}
+}
+
+static int run_filter(mm_tbuf_t *b, int qlen, char *RefSeq, const char *seq, int SSEditThreshold)
+{ // edits between the read and its reference window as --filter estimates them; <0 if rejected
+	int Edits = 0;
+	if (strcmp(filter, "adjacency-filter")==0) {
+		Edits = AdjacencyFilter(qlen, RefSeq, seq, SSEditThreshold, 5, 0);
+		++b->mt.c[MM_MC_FILTER_CALLS];
+	}
+	else if (strcmp(filter, "base-counting")==0) {
+		Edits = baseCounting(qlen, RefSeq, seq, SSEditThreshold, 0);
+		++b->mt.c[MM_MC_FILTER_CALLS];
+	}
+	else if (strcmp(filter, "magnet")==0) {
+		Edits = MAGNET_DC(qlen, RefSeq, seq, SSEditThreshold, 0);
+		++b->mt.c[MM_MC_FILTER_CALLS];
+	}
+	else if (strcmp(filter, "sneakysnake")==0) {
+		Edits = SneakySnake(qlen, RefSeq, seq, SSEditThreshold, qlen, 0, qlen);
+		++b->mt.c[MM_MC_FILTER_CALLS];
+	}
+	else if (strcmp(filter, "hd")==0) {
+		Edits = HD(qlen, RefSeq, seq, SSEditThreshold, 0);
+		++b->mt.c[MM_MC_FILTER_CALLS];
+	}
+	else if (strcmp(filter, "shouji")==0) {
+		Edits = Shouji(qlen, RefSeq, seq, SSEditThreshold, 4, 0);
+		++b->mt.c[MM_MC_FILTER_CALLS];
+	}
+	else if (strcmp(filter, "qgram")==0) {
+		Edits = qgram(qlen, RefSeq, seq, SSEditThreshold, 5);
+		++b->mt.c[MM_MC_FILTER_CALLS];
+	}
+	else if (strcmp(filter, "shd")==0) {
+		Edits = SHD(qlen, RefSeq, seq, SSEditThreshold, 0);
+		++b->mt.c[MM_MC_FILTER_CALLS];
+	}
+	else if (strcmp(filter, "qgram_hash")==0) {
+		Edits = qgram_hash(qlen, RefSeq, seq, SSEditThreshold, 5);
+		++b->mt.c[MM_MC_FILTER_CALLS];
+	}
+	else if (strcmp(filter, "grim_original")==0) {
+		Edits = grim_original(qlen, RefSeq, seq, SSEditThreshold, 5);
+		++b->mt.c[MM_MC_FILTER_CALLS];
+	}
+	else if (strcmp(filter, "grim_original_tweak")==0) {
+		Edits = grim_original_tweak(qlen, RefSeq, seq, SSEditThreshold, 5);
+		++b->mt.c[MM_MC_FILTER_CALLS];
+	}
+	else if (strcmp(filter, "edlib")==0) {
+		EdlibAlignResult resultEdlib = edlibAlign(RefSeq, qlen, seq, qlen, edlibNewAlignConfig(SSEditThreshold, EDLIB_MODE_NW, EDLIB_TASK_DISTANCE, NULL, 0));
+		Edits = resultEdlib.editDistance;
+		edlibFreeAlignResult(resultEdlib);
+		++b->mt.c[MM_MC_FILTER_CALLS];
+	}
+	else if (strcmp(filter, "ksw2")==0) {
+		int8_t score_matrix[25] = { 0,-1,-1,-1,0, -1,0,-1,-1,0, -1,-1,0,-1,0, -1,-1,-1,0,0, 0,0,0,0,0 }; // make alignment score = edit distance
+		uint8_t *ts, *qs, c[256];
+		ksw_extz_t ez;
+		int j;
+		memset(&ez, 0, sizeof(ksw_extz_t));
+		memset(c, 4, 256);
+		c['A'] = c['a'] = 0; c['C'] = c['c'] = 1;
+		c['G'] = c['g'] = 2; c['T'] = c['t'] = 3; // build the encoding table
+		ts = (uint8_t*)malloc(qlen);
+		qs = (uint8_t*)malloc(qlen);
+		for (j = 0; j < qlen; ++j) ts[j] = c[(uint8_t)RefSeq[j]]; // encode to 0/1/2/3
+		for (j = 0; j < qlen; ++j) qs[j] = c[(uint8_t)seq[j]];
+		ksw_extz2_sse(0, qlen, qs, qlen, ts, 5, score_matrix, 0, 1, -1, -1, 0, KSW_EZ_EXTZ_ONLY, &ez);
+		Edits = abs(ez.score);
+		free(ez.cigar); free(ts); free(qs);
+		++b->mt.c[MM_MC_FILTER_CALLS];
+	}
+	return Edits;
+}
+
+/*
+ * Seed evidence of a candidate window at loc on the strand and reference of
+ * cx. The anchors on its diagonal are exact matches, so only the read bases
+ * outside them are compared to get the Hamming distance, which bounds the
+ * edits from above. A read
+ * minimizer with no edit in any of its windows is also a minimizer of the
+ * reference at the same offset, up to the drift of indels; as an edit hides
+ * only minimizers ending within k+2(w-1) bases of each other, the fewest
+ * edits that explain the minimizers without a hit in the band of the
+ * candidate bound the edits from below. Returns the Hamming distance if it is
+ * at most thres, -1 if more than thres edits are needed, and -2 if the seeds
+ * decide neither.
+ */
+static int seed_evidence(void *km, const mm_idx_t *mi, int qlen, const char *RefSeq, const char *seq, int64_t n_a, const mm128_t *a, int n_mini_pos, const uint64_t *mini_pos, uint64_t cx, uint64_t loc, int thres)
+{
+	const mm_idx_seq_t *s = &mi->seq[cx<<1>>33];
+	int64_t D = (int64_t)(loc - s->offset), st = 0, en = n_a, i;
+	int32_t l, j, rev = cx>>63, n_diff = 0, lb = 0, last = -1, span = mi->k + 2 * (mi->w - 1);
+	uint64_t key;
+	uint8_t *f;
+	if ((mi->flag & MM_I_HPC) || thres < 0 || D < 0 || D + qlen > (int64_t)s->len) return -2; // read coordinates differ from the sequence, or the window spans two references
+	key = (cx & 0xffffffff00000000ULL) | (uint32_t)(D > thres? D - thres : 0);
+	while (st < en) { // a[] is sorted by strand, reference and position
+		i = st + (en - st) / 2;
+		if (a[i].x < key) st = i + 1;
+		else en = i;
+	}
+	f = (uint8_t*)kcalloc(km, qlen, 1); // bit 1: base on the diagonal of an anchor; bit 2: minimizer ending here has a hit in the band
+	for (i = st; i < n_a && a[i].x>>32 == cx>>32 && (int32_t)a[i].x <= D + thres + qlen; ++i) {
+		int32_t y = (int32_t)a[i].y, sp = a[i].y>>32&0xff, q = rev? qlen - y + sp - 2 : y; // end of the k-mer on the read
+		int64_t diag = (int32_t)a[i].x - y;
+		if (diag < D - thres || diag > D + thres || q < 0 || q >= qlen) continue;
+		f[q] |= 2;
+		if (diag == D)
+			for (l = q - sp + 1 > 0? q - sp + 1 : 0; l <= q; ++l) f[l] |= 1;
+	}
+	for (l = 0; l < qlen && n_diff <= thres; ++l)
+		if (!(f[l] & 1) && (RefSeq[l] != seq[l] || seq[l] == 'N')) ++n_diff;
+	if (n_diff > thres) {
+		for (j = 0; j < n_mini_pos; ++j) { // mini_pos[] is sorted by the read position
+			int32_t q = (uint32_t)mini_pos[j];
+			if (q < qlen && !(f[q] & 2) && q > last) ++lb, last = q + span - 1;
+		}
+	}
+	kfree(km, f);
+	if (n_diff <= thres) return n_diff;
+	return lb > thres? -1 : -2;
+}
+
+/*
+ * Edits of a candidate window: decided from the seeds with MM_F_SEED_EVIDENCE
+ * if they suffice, by the filter otherwise. <0 if rejected.
+ */
+static int verify_window(mm_tbuf_t *b, const mm_idx_t *mi, const mm_mapopt_t *opt, int qlen, char *RefSeq, const char *seq, int64_t n_a, const mm128_t *a, int n_mini_pos, const uint64_t *mini_pos, uint64_t cx, uint64_t loc)
+{
+	int Edits = -2;
+	if ((opt->flag & MM_F_SEED_EVIDENCE) && !(opt->flag & (MM_F_FOR_ONLY|MM_F_REV_ONLY|MM_F_NO_DIAG|MM_F_NO_DUAL))) { // these drop anchors
+		Edits = seed_evidence(b->km, mi, qlen, RefSeq, seq, n_a, a, n_mini_pos, mini_pos, cx, loc, opt->bw);
+		if (Edits >= 0) ++b->mt.c[MM_MC_SEED_ACCEPT];
+		else if (Edits == -1) ++b->mt.c[MM_MC_SEED_REJECT];
+	}
+	return Edits == -2? run_filter(b, qlen, RefSeq, seq, opt->bw) : Edits;
+}
+
+static void fill_reg(void *km, const mm_idx_t *mi, const mm_mapopt_t *opt, const seed_map_entry_t *c, int qlen, const char *RefSeq, const char *seq, int Edits, mm_reg1_t *r)
+{ // an accepted candidate as the short-read path reports it: the edits of the filter and a two-operation CIGAR
+	uint32_t capacity = 2 + sizeof(mm_extra_t)/4;
+	int32_t l, n_ambi = 0, n_diff = 0, rid = c->x<<1>>33;
+	kroundup32(capacity);
+	memset(r, 0, sizeof(mm_reg1_t));
+	r->p = (mm_extra_t*)kcalloc(km, capacity, 4);
+	r->p->capacity = capacity, r->p->n_cigar = 2;
+	r->p->cigar[0] = Edits<<4 | 0x1, r->p->cigar[1] = (qlen - Edits)<<4;
+	r->p->dp_max2 = Edits;
+	for (l = 0; l < qlen; ++l) {
+		if (RefSeq[l] == 'N' || seq[l] == 'N') ++n_ambi;
+		else if (RefSeq[l] != seq[l]) ++n_diff;
+	}
+	r->blen = qlen - Edits - n_ambi, r->mlen = qlen - Edits - (n_ambi + n_diff), r->p->n_ambi = n_ambi;
+	r->p->dp_max = opt->q + opt->e * (qlen - Edits);
+	r->score = r->score0 = qlen;
+	r->hash = (uint32_t)c->location;
+	r->cnt = (int32_t)(uint32_t)c->x;
+	r->div = -1.0f;
+	r->qs = 0, r->qe = qlen;
+	r->rid = rid, r->rev = c->x>>63;
+	r->rs = (int32_t)(c->location - mi->seq[rid].offset), r->re = r->rs + qlen;
+}
+
+static inline uint64_t cand_pos(const seed_map_entry_t *c) { return c->x>>63<<63 | c->location; } // strand and position in the concatenated references
+
+static int compare_pos(const void *a, const void *b) {
+	uint64_t pa = cand_pos((const seed_map_entry_t*)a), pb = cand_pos((const seed_map_entry_t*)b);
+	return (pa > pb) - (pa < pb);
+}
+
+/*
+ * Paired-end reads: the candidates of each mate come from diagonal bands as
+ * with --band-vote, and only pairs on the same strand of a reference that fit
+ * in opt->max_frag_len are verified, most seeded bases first. worker_for()
+ * hands over the mates on the strand of the fragment, as opt->pe_ori implies,
+ * so on the forward strand the first mate is on the left. The second mate is
+ * only filtered if the first one passes; a filter result is reused across
+ * the pairs of a candidate.
+ */
+static void map_pair(const mm_idx_t *mi, const int *qlens, const char **seqs, int *n_regs, mm_reg1_t **regs, mm_tbuf_t *b, const mm_mapopt_t *opt, const char *qname)
+{
+	int s, i, j, k, n_m[2], n_pairs = 0, n_try = 0, max_pairs = opt->min_cnt >= 1? opt->min_cnt : 2;
+	int64_t max_frag = opt->max_frag_len > 0? opt->max_frag_len : opt->max_gap;
+	seed_map_entry_t *m[2];
+	mm128_t *a[2];
+	int64_t n_a[2];
+	int n_mini_pos[2];
+	uint64_t *mini_pos[2];
+	int *edits[2], *reg_id[2];
+	char *RefSeq;
+	kvec_t(mm128_t) p = {0,0,0};
+	double t_mt = mm_metrics_clock();
+
+	for (s = 0; s < 2; ++s) {
+		mm128_v mv = {0,0,0};
+		int rep_len;
+		n_a[s] = 0;
+		collect_minimizers(b->km, opt, mi, 1, &qlens[s], &seqs[s], &mv);
+		mm_metrics_lap(&b->mt, MM_MT_SKETCH, &t_mt);
+		if (opt->flag & MM_F_HEAP_SORT) a[s] = collect_seed_hits_heap(b->km, opt, opt->mid_occ, mi, qname, &mv, qlens[s], &n_a[s], &rep_len, &n_mini_pos[s], &mini_pos[s]);
+		else a[s] = collect_seed_hits(b->km, opt, opt->mid_occ, mi, qname, &mv, qlens[s], &n_a[s], &rep_len, &n_mini_pos[s], &mini_pos[s]);
+		b->mt.c[MM_MC_MINIMIZERS] += mv.n, b->mt.c[MM_MC_ANCHORS] += n_a[s];
+		mm_metrics_lap(&b->mt, MM_MT_LOOKUP, &t_mt);
+		m[s] = (seed_map_entry_t*)kcalloc(b->km, n_a[s] + 1, sizeof(seed_map_entry_t));
+		n_m[s] = collect_band_cands(b->km, mi, qlens[s], n_a[s], a[s], opt->band_w > 0? opt->band_w : opt->bw, 2, m[s]);
+		qsort(m[s] + 1, n_m[s], sizeof(seed_map_entry_t), compare_pos);
+		edits[s] = (int*)kmalloc(b->km, (n_m[s] + 1) * sizeof(int));
+		reg_id[s] = (int*)kmalloc(b->km, (n_m[s] + 1) * sizeof(int));
+		for (i = 1; i <= n_m[s]; ++i) edits[s][i] = -2, reg_id[s][i] = -1; // -2: not filtered yet
+		regs[s] = 0, n_regs[s] = 0;
+		kfree(b->km, mv.a);
+	}
+
+	// concordant pairs; both lists are sorted by strand and position, so the mates of a first-mate candidate are in a window
+	for (i = 1, k = 1; i <= n_m[0]; ++i) {
+		const seed_map_entry_t *c = &m[0][i];
+		while (k <= n_m[1] && cand_pos(&m[1][k]) + max_frag < cand_pos(c)) ++k;
+		for (j = k; j <= n_m[1] && cand_pos(&m[1][j]) <= cand_pos(c) + max_frag; ++j) {
+			const seed_map_entry_t *d = &m[1][j];
+			uint64_t st, en;
+			mm128_t z;
+			if (c->x>>32 != d->x>>32) continue; // strand and reference
+			if (c->x>>63? d->location > c->location : d->location < c->location) continue; // orientation
+			st = c->location < d->location? c->location : d->location;
+			en = c->location + qlens[0] > d->location + qlens[1]? c->location + qlens[0] : d->location + qlens[1];
+			if (en - st > (uint64_t)max_frag) continue;
+			z.x = c->seeds + d->seeds, z.y = (uint64_t)i << 32 | (uint32_t)j;
+			kv_push(mm128_t, b->km, p, z);
+		}
+	}
+	radix_sort_128x(p.a, p.a + p.n);
+	mm_metrics_lap(&b->mt, MM_MT_CAND, &t_mt);
+
+	RefSeq = (char*)kmalloc(b->km, (qlens[0] > qlens[1]? qlens[0] : qlens[1]) + 1);
+	for (s = 0; s < 2; ++s)
+		regs[s] = (mm_reg1_t*)kcalloc(b->km_reg, p.n < (size_t)max_pairs? p.n : max_pairs, sizeof(mm_reg1_t));
+	for (k = (int)p.n - 1; k >= 0 && n_try < max_pairs; --k) {
+		int c[2];
+		c[0] = p.a[k].y >> 32, c[1] = (uint32_t)p.a[k].y;
+		if (opt->flag & MM_F_TAXON_ONCE) { // a taxon only needs one verified pair
+			int32_t taxon = mi->seq[m[0][c[0]].x<<1>>33].taxon;
+			for (i = 0; i < n_regs[0] && taxon >= 0 && !(regs[0][i].proper_frag && mi->seq[regs[0][i].rid].taxon == taxon); ++i) { }
+			if (taxon >= 0 && i < n_regs[0]) continue;
+		}
+		if (edits[0][c[0]] == -1 || edits[1][c[1]] == -1) continue; // a mate already failed the filter
+		++n_try;
+		++b->mt.c[MM_MC_CANDIDATES];
+		for (s = 0; s < 2; ++s) {
+			const seed_map_entry_t *e = &m[s][c[s]];
+			if (edits[s][c[s]] == -2) {
+				int Edits;
+				RefSeq[qlens[s]] = 0;
+				get_window(mi, e->location, qlens[s], e->x>>63, RefSeq);
+				Edits = verify_window(b, mi, opt, qlens[s], RefSeq, seqs[s], n_a[s], a[s], n_mini_pos[s], mini_pos[s], e->x, e->location);
+				edits[s][c[s]] = Edits >= 0 && opt->bw >= 0 && Edits <= opt->bw? Edits : -1;
+				if (edits[s][c[s]] >= 0) { // kept even if the other mate fails; it may pair with another candidate
+					reg_id[s][c[s]] = n_regs[s];
+					fill_reg(b->km_reg, mi, opt, e, qlens[s], RefSeq, seqs[s], Edits, &regs[s][n_regs[s]++]);
+				}
+			}
+			if (edits[s][c[s]] < 0) break;
+		}
+		if (s < 2) continue;
+		for (s = 0; s < 2; ++s) {
+			mm_reg1_t *r = &regs[s][reg_id[s][c[s]]];
+			r->proper_frag = 1;
+			if (n_pairs == 0) r->sam_pri = 1; // the best pair is primary
+		}
+		++n_pairs;
+	}
+	mm_metrics_lap(&b->mt, MM_MT_FILTER, &t_mt);
+
+	for (s = 0; s < 2; ++s) { // regions outside a passing pair are dropped; the others are secondary to the best pair
+		int pri = -1;
+		for (i = k = 0; i < n_regs[s]; ++i) {
+			if (!regs[s][i].proper_frag) {
+				kfree(b->km_reg, regs[s][i].p);
+				continue;
+			}
+			regs[s][k] = regs[s][i];
+			regs[s][k].id = k;
+			if (regs[s][k].sam_pri) pri = k;
+			++k;
+		}
+		n_regs[s] = k;
+		for (i = 0; i < k; ++i) regs[s][i].parent = pri;
+		b->mt.c[MM_MC_FILTER_PASS] += k;
+		if (k == 0) {
+			kfree(b->km_reg, regs[s]);
+			regs[s] = 0;
+		}
+		kfree(b->km, m[s]);
+		kfree(b->km, a[s]);
+		kfree(b->km, mini_pos[s]);
+		kfree(b->km, edits[s]);
+		kfree(b->km, reg_id[s]);
+	}
+	kfree(b->km, RefSeq);
+	kfree(b->km, p.a);
+}
+
 void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **seqs, int *n_regs, mm_reg1_t **regs, mm_tbuf_t *b, const mm_mapopt_t *opt, const char *qname)
 {
 	int i, rep_len, qlen_sum, n_regs0, n_mini_pos;
@@ -331,7 +757,7 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 	int64_t n_a=0;
 
 
-	uint64_t *u, *mini_pos;
+	uint64_t *u = 0, *mini_pos;
 	mm128_t *a;
 	mm128_v mv = {0,0,0};
 	mm_reg1_t *regs0;
@@ -364,21 +790,13 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 	int sc_mis=-2;
 	int gapo=2;
 	int gape=1;
-	int j, g = sc_mch, bb = sc_mis < 0? sc_mis : -sc_mis; // g>0 and b<0
+	int g = sc_mch, bb = sc_mis < 0? sc_mis : -sc_mis; // g>0 and b<0
 	int8_t mat[25] = { g,bb,bb,bb,0, bb,g,bb,bb,0, bb,bb,g,bb,0, bb,bb,bb,g,0, 0,0,0,0,0 };
 
-	int aa = 0;
-	int bb2 = -1;
-	int8_t score_matrix[25] = { aa,bb2,bb2,bb2,0, bb2,aa,bb2,bb2,0, bb2,bb2,aa,bb2,0, bb2,bb2,bb2,aa,0, 0,0,0,0,0 }; //make alignment score = edit distance
-	int tl;
 	int ql = strlen(seqs[0]);
 	int Edits = 0;
 
-	EdlibAlignResult resultEdlib;
-
-	// only for ksw2
-	ksw_extz_t ez;
-	int8_t *junc;
+	double t_mt;
 
 
 
@@ -392,9 +810,18 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 	hash ^= __ac_Wang_hash(qlen_sum) + __ac_Wang_hash(opt->seed);
 	hash  = __ac_Wang_hash(hash);
 
+	if (n_segs == 2 && !(opt->flag & MM_F_LONG_READ)) {
+		map_pair(mi, qlens, seqs, n_regs, regs, b, opt, qname);
+		return;
+	}
+
+	t_mt = mm_metrics_clock();
 	collect_minimizers(b->km, opt, mi, n_segs, qlens, seqs, &mv);
+	mm_metrics_lap(&b->mt, MM_MT_SKETCH, &t_mt);
 	if (opt->flag & MM_F_HEAP_SORT) a = collect_seed_hits_heap(b->km, opt, opt->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
 	else a = collect_seed_hits(b->km, opt, opt->mid_occ, mi, qname, &mv, qlen_sum, &n_a, &rep_len, &n_mini_pos, &mini_pos);
+	mm_metrics_lap(&b->mt, MM_MT_LOOKUP, &t_mt);
+	b->mt.c[MM_MC_MINIMIZERS] += mv.n, b->mt.c[MM_MC_ANCHORS] += n_a;
 
 	if (mm_dbg_flag & MM_DBG_PRINT_SEED) { // remove if-statement to print seed hits
 		fprintf(stderr, "RS\t%d\n", rep_len);
@@ -404,6 +831,13 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 					// print output: 1)RG name 2)seed 3)strand 4)read | last col important: Nr of zeros = Nr of matching seeds in same reagion
 	}
 
+	if (opt->flag & MM_F_LONG_READ) {
+		map_long(mi, qlens[0], seqs[0], &n_regs[0], &regs[0], b, opt, hash, rep_len, n_a, a, n_mini_pos, mini_pos);
+		kfree(b->km, mv.a);
+		kfree(b->km, mini_pos);
+		return;
+	}
+
 	// ALLOCATE MEMORY for seed_map
 	// uint64_t (*seed_map)[2];
 	// seed_map = (uint64_t(*)[2])calloc(1<<30, sizeof(*seed_map));
@@ -458,7 +892,7 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 	*/
 	// populate r[]
 	mm_reg1_t *r;
-	r = (mm_reg1_t*)calloc(n_a, sizeof(mm_reg1_t));
+	r = (mm_reg1_t*)kcalloc(b->km_reg, n_a < locations_per_read? n_a : locations_per_read, sizeof(mm_reg1_t)); // at most one region per verified candidate
 
 	// uint64_t (*seed_map)[2];
 	// seed_map = malloc(n_a * sizeof(*seed_map)); // Allocate memory for the 2D array
@@ -474,7 +908,10 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 	// KSORT_INIT(seed_map_sort, seed_map_entry_t, ks_lt_seed_map_entry);
 
 	seed_map_entry_t* seed_map;
-	seed_map = (seed_map_entry_t*)calloc(n_a, sizeof(seed_map_entry_t));
+	int band_vote = !!(opt->flag & MM_F_BAND_VOTE);
+	seed_map = (seed_map_entry_t*)kcalloc(b->km, n_a + 1, sizeof(seed_map_entry_t));
+	char *ref_win = (char*)kmalloc(b->km, qlens[0] + 1); // reference window of a candidate; on the heap, as a long read would overflow the stack
+	ref_win[qlens[0]] = 0;
 
 
 
@@ -482,11 +919,16 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 
 	if (n_segs >= 1) { // uni-segment
 		//////////////////////////////////////////////////////////////////
-		if (n_a>2) {
+		if (band_vote && n_a > 0) {
+			int n_band = collect_band_cands(b->km, mi, qlens[0], n_a, a, opt->band_w > 0? opt->band_w : opt->bw, MIN_SEED_NUM_PER_READ, seed_map);
+			qsort(seed_map + 1, n_band, sizeof(*seed_map), compare);
+			mm_metrics_lap(&b->mt, MM_MT_CAND, &t_mt);
+		}
+		if (n_a>2 || (band_vote && n_a > 0)) {
 			// uint64_t (*seed_map)[2];
 			// seed_map = malloc(n_a * sizeof(*seed_map)); // Allocate memory for the 2D array
 			
-			for (i = 1; i < n_a; ++i){
+			for (i = 1; i < n_a && !band_vote; ++i){
 				// if (Accepted<MAX_NUM_MAPPING_LOCATION_PER_READ){
 					if ((i<n_a) && (((int32_t)a[i].y - (int32_t)a[i-1].y) - ((int32_t)a[i].x - (int32_t)a[i-1].x) ==0)) {
 						if (Seed_Num == 1) {
@@ -504,6 +946,7 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 						mapEndPos = (mapStartPos + (uint64_t)qlens[0]);
 
 						seed_map[i].location = (uint64_t)mapStartPos;
+						seed_map[i].x = a[i-1].x; // travels with the location through the sort below
 						// seed_map[i][1] = (uint64_t)mappingStartingPosition;
 
 						if (i<n_a) {
@@ -519,7 +962,10 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 			}
 			
 			// mergesort(seed_map, n_a, sizeof(*seed_map), compare);
-			qsort(seed_map, n_a, sizeof(*seed_map), compare);
+			if (!band_vote) {
+				qsort(seed_map, n_a, sizeof(*seed_map), compare);
+				mm_metrics_lap(&b->mt, MM_MT_CAND, &t_mt);
+			}
 			// ks_heapmake_heap // ksmall
 
 			// ks_heapmake_seed_map_sort(n_a, seed_map);
@@ -537,9 +983,15 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 			}
 
 
-			for (int i = 1; i <= locations_per_read; ++i){ // consider best N mapping locations per read
+			for (int i = 1; i <= locations_per_read && i <= n_a; ++i){ // consider best N mapping locations per read
 				
 				if (((uint64_t)seed_map[i].seeds >= (uint64_t)MIN_SEED_NUM_PER_READ)) {
+					uint64_t cx = seed_map[i].x; // strand and reference of the candidate
+					if (opt->flag & MM_F_TAXON_ONCE) { // a taxon only needs one verified location
+						int32_t taxon = mi->seq[cx<<1>>33].taxon, k;
+						for (k = 0; k < Accepted && taxon >= 0 && mi->seq[r[k].rid].taxon != taxon; ++k) { }
+						if (taxon >= 0 && k < Accepted) continue;
+					}
 
 					// fprintf(stderr,"mapStartPos BEFORE: %d\n",mapStartPos);
 					// fprintf(stderr,"mapEndPos BEFORE: %d\n\n",mapEndPos);
@@ -553,93 +1005,11 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 					// fprintf(stderr,"mapEndPos AFTER: %d\n\n",mapEndPos);
 
 					MappedReadNo=MappedReadNo+1;
+					++b->mt.c[MM_MC_CANDIDATES];
 
-					char RefSeq[qlens[0]];
-						if ((a[i-1].x>>63)==0) {
-							for (uint64_t mapSeqI = mapStartPos; mapSeqI < mapEndPos; ++mapSeqI)
-								RefSeq[mapSeqI-(mapStartPos)]="ACGTN"[mm_seq4_get(mi->S, mapSeqI)];
-						} 
-						else{
-							int ttttt=0;
-							for (uint64_t mapSeqI = mapEndPos-1 ; mapSeqI >= mapStartPos; mapSeqI=mapSeqI-1) {
-								RefSeq[ttttt]="TGCAN"[mm_seq4_get(mi->S, mapSeqI)];
-								ttttt=ttttt+1;
-							}
-						}
-						
-						// ================= CALL FILTERS ==========================
-						//printf("FILTER_CALLED");
-
-						if (strcmp(filter, "adjacency-filter")==0) {
-							Edits = AdjacencyFilter(qlens[0], RefSeq, seqs[0], SSEditThreshold, 5, 0);
-							filter_calls++;
-						}
-						else if (strcmp(filter, "base-counting")==0) {
-							Edits = baseCounting(qlens[0], RefSeq, seqs[0], SSEditThreshold, 0);
-							filter_calls++;
-						}
-						else if (strcmp(filter, "magnet")==0) {
-							Edits = MAGNET_DC(qlens[0], RefSeq, seqs[0], SSEditThreshold, 0);
-							filter_calls++;
-						}
-						else if (strcmp(filter, "sneakysnake")==0) {
-							Edits = SneakySnake(qlens[0], RefSeq, seqs[0], SSEditThreshold, qlens[0], 0, qlens[0]);
-							filter_calls++;
-						}
-						else if (strcmp(filter, "hd")==0) {
-							Edits = HD(qlens[0], RefSeq, seqs[0], SSEditThreshold, 0);
-							filter_calls = filter_calls + 1;
-						}
-						else if (strcmp(filter, "shouji")==0) {
-							Edits = Shouji(qlens[0], RefSeq, seqs[0], SSEditThreshold, 4, 0);
-							filter_calls++;
-						}
-						else if (strcmp(filter, "qgram")==0) {
-							Edits = qgram(qlens[0], RefSeq, seqs[0], SSEditThreshold, 5);
-							filter_calls++;
-						}
-						else if (strcmp(filter, "shd")==0) {
-							Edits = SHD(qlens[0], RefSeq, seqs[0], SSEditThreshold, 0);
-							filter_calls++;
-						}
-						else if (strcmp(filter, "qgram_hash")==0) {
-							Edits = qgram_hash(qlens[0], RefSeq, seqs[0], SSEditThreshold, 5);
-							filter_calls++;
-						}
-						else if (strcmp(filter, "grim_original")==0) {
-							Edits = grim_original(qlens[0], RefSeq, seqs[0], SSEditThreshold, 5);
-							filter_calls++;
-						}
-						else if (strcmp(filter, "grim_original_tweak")==0) {
-							Edits = grim_original_tweak(qlens[0]  , RefSeq  , seqs[0]  , SSEditThreshold, 5);
-							filter_calls++;
-						}
-						else if (strcmp(filter, "edlib")==0) {
-							resultEdlib = edlibAlign(RefSeq,  qlens[0],       seqs[0],    qlens[0],       edlibNewAlignConfig(SSEditThreshold, EDLIB_MODE_NW, EDLIB_TASK_DISTANCE, NULL, 0) );
-							Edits = resultEdlib.editDistance;
-							filter_calls++;
-						}
-						else if (strcmp(filter, "ksw2")==0) {
-							uint8_t *ts, *qs, c[256];
-							tl =strlen(RefSeq);
-							memset(&ez, 0, sizeof(ksw_extz_t));
-							memset(c, 4, 256);
-							c['A'] = c['a'] = 0; c['C'] = c['c'] = 1;
-							c['G'] = c['g'] = 2; c['T'] = c['t'] = 3; // build the encoding table
-							ts = (uint8_t*)malloc(tl);
-							qs = (uint8_t*)malloc(ql);
-							for (j = 0; j < tl; ++j) ts[j] = c[(uint8_t)RefSeq[j]]; // encode to 0/1/2/3
-							for (j = 0; j < ql; ++j) qs[j] = c[(uint8_t)seqs[0][j]];
-
-							//ksw_extz2_sse(void *km,   int qlen,   const uint8_t *query,   int tlen,   const uint8_t *target,  int8_t m,   const int8_t *mat,  int8_t q,   int8_t e,    int w,   int zdrop,  int end_bonus,  int flag             , ksw_extz_t *ez)
-								ksw_extz2_sse(0       ,   ql      ,   qs                  ,   tl      ,   ts                   ,  5       ,   score_matrix     ,  0       ,   1       ,    -1   ,   -1        ,  0            , KSW_EZ_EXTZ_ONLY     , &ez);
-							Edits = abs(ez.score);
-
-							//free(ez.cigar);
-							free(ts); free(qs);
-							filter_calls++;
-						}
-						// ================= END CALL FILTERS ==========================
+					char *RefSeq = ref_win;
+						get_window(mi, mapStartPos, qlens[0], cx>>63, RefSeq);
+						Edits = n_segs == 1? verify_window(b, mi, opt, qlens[0], RefSeq, seqs[0], n_a, a, n_mini_pos, mini_pos, cx, mapStartPos) : run_filter(b, qlens[0], RefSeq, seqs[0], SSEditThreshold);
 
 
 						if(Edits > -1){
@@ -662,14 +1032,14 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 										if (ri->p == 0) {
 											uint32_t capacity = n_cigar + sizeof(mm_extra_t)/4;
 											kroundup32(capacity);
-											ri->p = (mm_extra_t*)calloc(capacity, 4);
+											ri->p = (mm_extra_t*)kcalloc(b->km_reg, capacity, 4);
 											ri->p->capacity = capacity;
 											ri->p->n_cigar = n_cigar;
 											ri->p->dp_max2 = Edits;
 										} else if (ri->p->n_cigar + ri->p->n_cigar + sizeof(mm_extra_t)/4 > ri->p->capacity) {
 											ri->p->capacity = ri->p->n_cigar + ri->p->n_cigar + sizeof(mm_extra_t)/4;
 											kroundup32(ri->p->capacity);
-											ri->p = (mm_extra_t*)realloc(ri->p, ri->p->capacity * 4);
+											ri->p = (mm_extra_t*)krealloc(b->km_reg, ri->p, ri->p->capacity * 4);
 											ri->p->dp_max2 = Edits;
 										}
 										p = ri->p;
@@ -697,17 +1067,18 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 									ri->id = Accepted;
 									ri->parent = Accepted;
 									ri->score = ri->score0 = ql; //TODO
-									ri->hash = (uint32_t)a[i].x;
-									ri->cnt = (int32_t)Seed_Num;
-									ri->as = a[i].y >> 32;
+									ri->hash = band_vote? (uint32_t)seed_map[i].location : (uint32_t)a[i].x;
+									ri->cnt = band_vote? (int32_t)(uint32_t)cx : (int32_t)seed_map[i].seeds;
+									ri->as = band_vote? 0 : a[i].y >> 32;
 									ri->div = -1.0f;
 									ri->qs = 0;
 									ri->qe = ql;
-									ri->rs = mappingStartingPosition;
+									ri->rs = (int32_t)(mapStartPos - mi->seq[cx<<1>>33].offset);
 									//ri->re = mapEndPos;
-									ri->rev = a[i-1].x>>63;
-									ri->rid = a[i-1].x<<1>>33;
+									ri->rev = cx>>63;
+									ri->rid = cx<<1>>33;
 									Accepted++;
+									++b->mt.c[MM_MC_FILTER_PASS];
 								// }
 							}
 
@@ -727,6 +1098,7 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 		}
 
 
+		mm_metrics_lap(&b->mt, MM_MT_FILTER, &t_mt);
 		/////////
 		int32_t max_score=0;
 		int TMP_ID_PARENT_PRI=0;
@@ -761,8 +1133,10 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 			}
 		}
 
-		// if (Accepted<MAX_NUM_MAPPING_LOCATION_PER_READ)
-		    r = (mm_reg1_t*)realloc(r, (Accepted) * sizeof(mm_reg1_t));
+		if (Accepted == 0) {
+			kfree(b->km_reg, r);
+			r = 0;
+		}
 
 		n_regs[0] = Accepted, regs[0] = r;
 
@@ -870,7 +1244,8 @@ void mm_map_frag(const mm_idx_t *mi, int n_segs, const int *qlens, const char **
 	kfree(b->km, a);
 	kfree(b->km, u);
 	kfree(b->km, mini_pos);
-	free(seed_map);
+	kfree(b->km, seed_map);
+	kfree(b->km, ref_win);
 
 	if (b->km) {
 		km_stat(b->km, &kmst);
@@ -901,11 +1276,19 @@ typedef struct {
 	const mm_mapopt_t *opt;
 	mm_bseq_file_t **fp;
 	const mm_idx_t *mi;
-	kstring_t str;
+
+	int n_mem_seq, mem_off;
+	mm_bseq1_t *mem_seq; // if set, map these in-memory records instead of reading fp
 
 	int n_parts;
 	uint32_t *rid_shift;
 	FILE *fp_split, **fp_parts;
+
+	mm_metrics_t mt; // only modified in step 2
+	mm_lru_t *dedup_cache; // results of distinct reads of earlier batches; only used in step 1
+
+	pthread_mutex_t buf_lock;
+	kvec_t(mm_tbuf_t**) free_buf; // thread buffers of finished batches, taken by step 0 and given back by step 2
 } pipeline_t;
 
 typedef struct {
@@ -915,6 +1298,9 @@ typedef struct {
 	int *n_reg, *seg_off, *n_seg, *rep_len, *frag_gap;
 	mm_reg1_t **reg;
 	mm_tbuf_t **buf;
+	int32_t *dup; // with MM_F_DEDUP: -1 to map, -2 if taken from the cache, or the index of the read with the same sequence
+	int n_out;
+	kstring_t *out; // SAM/PAF lines of consecutive ranges of fragments, formatted in step 1 and written in order in step 2
 } step_t;
 
 static void worker_for(void *_data, long i, int tid) // kt_for() callback
@@ -924,6 +1310,7 @@ static void worker_for(void *_data, long i, int tid) // kt_for() callback
 	const char *qseqs[MM_MAX_SEG];
 	mm_tbuf_t *b = s->buf[tid];
 	assert(s->n_seg[i] <= MM_MAX_SEG);
+	if (s->dup && s->dup[i] != -1) return; // filled by dedup_replay() or dedup_lookup()
 	if (mm_dbg_flag & MM_DBG_PRINT_QNAME)
 		fprintf(stderr, "QR\t%s\t%d\t%d\n", s->seq[off].name, tid, s->seq[off].l_seq);
 	for (j = 0; j < s->n_seg[i]; ++j) {
@@ -960,12 +1347,75 @@ static void worker_for(void *_data, long i, int tid) // kt_for() callback
 
 }
 
+typedef struct {
+	int n_reg, rep_len, frag_gap;
+	mm_reg1_t *reg;
+} dedup_hit_t;
+
+static mm_reg1_t *copy_regs(void *km, int n_reg, const mm_reg1_t *reg) // km==NULL for malloc()
+{
+	mm_reg1_t *r;
+	int j;
+	if (n_reg == 0) return 0;
+	r = (mm_reg1_t*)kmalloc(km, n_reg * sizeof(mm_reg1_t));
+	memcpy(r, reg, n_reg * sizeof(mm_reg1_t));
+	for (j = 0; j < n_reg; ++j) {
+		if (reg[j].p == 0) continue;
+		r[j].p = (mm_extra_t*)kmalloc(km, reg[j].p->capacity * 4);
+		memcpy(r[j].p, reg[j].p, reg[j].p->capacity * 4);
+	}
+	return r;
+}
+
+static void dedup_hit_destroy(void *_h)
+{
+	dedup_hit_t *h = (dedup_hit_t*)_h;
+	int j;
+	for (j = 0; j < h->n_reg; ++j) free(h->reg[j].p);
+	free(h->reg); free(h);
+}
+
+static void dedup_lookup(step_t *s) // before mapping: take reads seen in earlier batches from the cache
+{
+	int i;
+	mm_lru_t *c = s->p->dedup_cache;
+	if (c == 0) return;
+	for (i = 0; i < s->n_seq; ++i) {
+		const dedup_hit_t *h;
+		if (s->dup[i] != -1 || (h = (const dedup_hit_t*)mm_lru_get(c, s->seq[i].seq)) == 0) continue;
+		s->n_reg[i] = h->n_reg, s->rep_len[i] = h->rep_len, s->frag_gap[i] = h->frag_gap;
+		s->reg[i] = copy_regs(s->buf[0]->km_reg, h->n_reg, h->reg);
+		s->dup[i] = -2;
+		++s->buf[0]->mt.c[MM_MC_DEDUP];
+	}
+}
+
+static void dedup_replay(step_t *s) // after mapping: copy results to duplicates and remember the new sequences
+{
+	int i;
+	mm_lru_t *c = s->p->dedup_cache;
+	for (i = 0; i < s->n_seq; ++i) {
+		int32_t d = s->dup[i];
+		if (d >= 0) {
+			s->n_reg[i] = s->n_reg[d], s->rep_len[i] = s->rep_len[d], s->frag_gap[i] = s->frag_gap[d];
+			s->reg[i] = copy_regs(s->buf[0]->km_reg, s->n_reg[d], s->reg[d]);
+			++s->buf[0]->mt.c[MM_MC_DEDUP];
+		} else if (d == -1 && c) {
+			dedup_hit_t *h = (dedup_hit_t*)malloc(sizeof(dedup_hit_t));
+			h->n_reg = s->n_reg[i], h->rep_len = s->rep_len[i], h->frag_gap = s->frag_gap[i];
+			h->reg = copy_regs(0, s->n_reg[i], s->reg[i]); // outlives the batch
+			mm_lru_put(c, s->seq[i].seq, h);
+		}
+	}
+}
+
 static void merge_hits(step_t *s)
 {
 	int f, i, k0, k, max_seg = 0, *n_reg_part, *rep_len_part, *frag_gap_part, *qlens;
 	void *km;
 	FILE **fp = s->p->fp_parts;
 	const mm_mapopt_t *opt = s->p->opt;
+	double t_mt = mm_metrics_clock();
 
 	km = km_init();
 	for (f = 0; f < s->n_frag; ++f)
@@ -1015,6 +1465,7 @@ static void merge_hits(step_t *s)
 	}
 	free(qlens);
 	km_destroy(km);
+	mm_metrics_lap(&s->buf[0]->mt, MM_MT_MERGE, &t_mt); // folded in step 2 with the mapping metrics
 }
 
 static inline const mm_reg1_t *get_sam_pri(int n_regs, const mm_reg1_t *regs){
@@ -1026,6 +1477,146 @@ static inline const mm_reg1_t *get_sam_pri(int n_regs, const mm_reg1_t *regs){
 	return NULL;
 }
 
+static mm_bseq1_t *slice_mem_seqs(pipeline_t *p, int frag_mode, int *n_) // in-memory counterpart of mm_bseq_read3()
+{
+	int64_t size = 0;
+	int st = p->mem_off, en = st;
+	mm_bseq1_t *a;
+	*n_ = 0;
+	if (st >= p->n_mem_seq) return 0;
+	while (en < p->n_mem_seq && size < p->mini_batch_size)
+		size += p->mem_seq[en++].l_seq;
+	if (frag_mode) // don't split a fragment across two batches
+		while (en < p->n_mem_seq && mm_qname_same(p->mem_seq[en-1].name, p->mem_seq[en].name))
+			++en;
+	a = (mm_bseq1_t*)malloc((en - st) * sizeof(mm_bseq1_t));
+	memcpy(a, &p->mem_seq[st], (en - st) * sizeof(mm_bseq1_t)); // shallow copies; the strings stay owned by the caller
+	p->mem_off = en;
+	*n_ = en - st;
+	return a;
+}
+
+static void append_line(kstring_t *out, const kstring_t *str) // str and a newline, as mm_err_puts() wrote it
+{
+	if (out->l + str->l + 2 > out->m) {
+		out->m = out->l + str->l + 2;
+		out->m += out->m >> 1;
+		out->s = (char*)realloc(out->s, out->m);
+	}
+	memcpy(out->s + out->l, str->s, str->l);
+	out->l += str->l;
+	out->s[out->l++] = '\n';
+	out->s[out->l] = 0;
+}
+
+static void format_frag(const step_t *s, int k, void *km, kstring_t *str, kstring_t *out) // appends the lines of fragment k to out
+{
+	const mm_idx_t *mi = s->p->mi;
+	const int flag = s->p->opt->flag;
+	int i, j, seg_st = s->seg_off[k], seg_en = s->seg_off[k] + s->n_seg[k];
+	for (i = seg_st; i < seg_en; ++i) {
+		const mm_bseq1_t *t = &s->seq[i];
+		if (s->n_reg[i] > 0) { // the query has at least one hit
+			for (j = 0; j < s->n_reg[i]; ++j) {
+				const mm_reg1_t *r = &s->reg[i][j];
+				assert(!r->sam_pri || r->id == r->parent);
+				if ((flag & MM_F_NO_PRINT_2ND) && r->id != r->parent)
+					continue;
+				if (flag & MM_F_OUT_SAM)
+					mm_write_sam3(str, mi, t, i - seg_st, j, s->n_seg[k], &s->n_reg[seg_st], (const mm_reg1_t*const*)&s->reg[seg_st], km, flag, s->rep_len[i], 0);
+				else
+					mm_write_paf3(str, mi, t, r, km, flag, s->rep_len[i]);
+				append_line(out, str);
+			}
+		} else if ((flag & MM_F_PAF_NO_HIT) || ((flag & MM_F_OUT_SAM) && !(flag & MM_F_SAM_HIT_ONLY))) { // output an empty hit, if requested
+			if (flag & MM_F_OUT_SAM)
+				mm_write_sam3(str, mi, t, i - seg_st, -1, s->n_seg[k], &s->n_reg[seg_st], (const mm_reg1_t*const*)&s->reg[seg_st], km, flag, s->rep_len[i], 0);
+			else
+				mm_write_paf3(str, mi, t, 0, 0, flag, s->rep_len[i]);
+			append_line(out, str);
+		}
+	}
+}
+
+static void worker_format(void *_data, long i, int tid) // kt_for() callback; formats the i-th range of fragments
+{
+	step_t *s = (step_t*)_data;
+	int k, st = (int)((int64_t)s->n_frag * i / s->n_out), en = (int)((int64_t)s->n_frag * (i + 1) / s->n_out);
+	void *km = 0;
+	kstring_t str = {0,0,0};
+	if ((s->p->opt->flag & MM_F_OUT_CS) && !(mm_dbg_flag & MM_DBG_NO_KALLOC)) km = km_init();
+	for (k = st; k < en; ++k)
+		format_frag(s, k, km, &str, &s->out[i]);
+	km_destroy(km);
+	free(str.s);
+}
+
+static mm_tbuf_t **get_bufs(pipeline_t *p) // n_threads buffers of a finished batch, or new ones
+{
+	mm_tbuf_t **buf = 0;
+	int i;
+	pthread_mutex_lock(&p->buf_lock);
+	if (p->free_buf.n > 0) buf = kv_pop(p->free_buf);
+	pthread_mutex_unlock(&p->buf_lock);
+	if (buf == 0) {
+		buf = (mm_tbuf_t**)calloc(p->n_threads, sizeof(mm_tbuf_t*));
+		for (i = 0; i < p->n_threads; ++i)
+			buf[i] = mm_tbuf_init();
+	}
+	for (i = 0; i < p->n_threads; ++i)
+		if (buf[i]->km && p->n_parts == 0) // merge_hits() keeps malloc(): hit.c frees dropped CIGARs one by one
+			buf[i]->km_reg = km_init();
+	return buf;
+}
+
+static void put_bufs(pipeline_t *p, mm_tbuf_t **buf) // releases the regions and CIGARs of the batch; the scratch pools stay warm for the next one
+{
+	int i;
+	for (i = 0; i < p->n_threads; ++i) {
+		mm_tbuf_t *b = buf[i];
+		km_destroy(b->km_reg);
+		b->km_reg = 0;
+		memset(&b->mt, 0, sizeof(mm_metrics_t));
+		if (b->km) {
+			km_stat_t kmst;
+			km_stat(b->km, &kmst);
+			if (kmst.largest > 1U<<28) { // don't hold on to the peak of a batch of very long reads
+				km_destroy(b->km);
+				b->km = km_init();
+			}
+		}
+	}
+	pthread_mutex_lock(&p->buf_lock);
+	kv_push(mm_tbuf_t**, 0, p->free_buf, buf);
+	pthread_mutex_unlock(&p->buf_lock);
+}
+
+static void pipeline_init(pipeline_t *p)
+{
+	memset(p, 0, sizeof(pipeline_t));
+	pthread_mutex_init(&p->buf_lock, 0);
+}
+
+static void pipeline_destroy(pipeline_t *p)
+{
+	size_t i;
+	int j;
+	for (i = 0; i < p->free_buf.n; ++i) {
+		for (j = 0; j < p->n_threads; ++j)
+			mm_tbuf_destroy(p->free_buf.a[i][j]);
+		free(p->free_buf.a[i]);
+	}
+	kv_destroy(p->free_buf);
+	pthread_mutex_destroy(&p->buf_lock);
+}
+
+static int pipeline_depth(const mm_mapopt_t *opt, int n_threads, int with_io) // with_io: input is read from files
+{
+	if (opt->pipeline_depth > 0) return opt->pipeline_depth;
+	if (n_threads == 1) return 1;
+	return with_io && (opt->flag & MM_F_2_IO_THREADS)? 3 : 2;
+}
+
 static void *worker_pipeline(void *shared, int step, void *in){
 	int i, j, k;
     pipeline_t *p = (pipeline_t*)shared;
@@ -1033,17 +1624,23 @@ static void *worker_pipeline(void *shared, int step, void *in){
 		int with_qual = (!!(p->opt->flag & MM_F_OUT_SAM) && !(p->opt->flag & MM_F_NO_QUAL));
 		int with_comment = !!(p->opt->flag & MM_F_COPY_COMMENT);
 		int frag_mode = (p->n_fp > 1 || !!(p->opt->flag & MM_F_FRAG_MODE));
+		double t_mt = mm_metrics_clock();
         step_t *s;
         s = (step_t*)calloc(1, sizeof(step_t));
-		if (p->n_fp > 1) s->seq = mm_bseq_read_frag2(p->n_fp, p->fp, p->mini_batch_size, with_qual, with_comment, &s->n_seq);
+		if (p->mem_seq) s->seq = slice_mem_seqs(p, frag_mode, &s->n_seq);
+		else if (p->n_fp > 1) s->seq = mm_bseq_read_frag2(p->n_fp, p->fp, p->mini_batch_size, with_qual, with_comment, &s->n_seq);
 		else s->seq = mm_bseq_read3(p->fp[0], p->mini_batch_size, with_qual, with_comment, frag_mode, &s->n_seq);
 		if (s->seq) {
 			s->p = p;
 			for (i = 0; i < s->n_seq; ++i)
 				s->seq[i].rid = p->n_processed++;
-			s->buf = (mm_tbuf_t**)calloc(p->n_threads, sizeof(mm_tbuf_t*));
-			for (i = 0; i < p->n_threads; ++i)
-				s->buf[i] = mm_tbuf_init();
+			s->buf = get_bufs(p);
+			if (!p->mem_seq) { // in-memory records have been counted by the caller that parsed them
+				for (i = 0; i < s->n_seq; ++i)
+					s->buf[0]->mt.c[MM_MC_BASES] += s->seq[i].l_seq;
+				s->buf[0]->mt.c[MM_MC_READS] += s->n_seq;
+			}
+			mm_metrics_lap(&s->buf[0]->mt, MM_MT_PARSE, &t_mt); // like the mapping metrics, folded into p->mt in step 2
 			s->n_reg = (int*)calloc(5 * s->n_seq, sizeof(int));
 			s->seg_off = s->n_reg + s->n_seq; // seg_off, n_seg, rep_len and frag_gap are allocated together with n_reg
 			s->n_seg = s->seg_off + s->n_seq;
@@ -1056,19 +1653,42 @@ static void *worker_pipeline(void *shared, int step, void *in){
 					s->seg_off[s->n_frag++] = j;
 					j = i;
 				}
+			if ((p->opt->flag & MM_F_DEDUP) && !(p->opt->flag & (MM_F_NO_DIAG|MM_F_NO_DUAL)) && s->n_frag == s->n_seq && p->n_parts == 0) // no mate pairs and no name-dependent seeds
+				s->dup = mm_dedup_batch(s->n_seq, s->seq, 0); // exact sequences: the regions are copied to the duplicates as they are
 			return s;
 		} else free(s);
     } else if (step == 1) { // step 1: map
-		if (p->n_parts > 0) merge_hits((step_t*)in);
-		else kt_for(p->n_threads, worker_for, in, ((step_t*)in)->n_frag);
+		step_t *s = (step_t*)in;
+		if (p->n_parts > 0) merge_hits(s);
+		else {
+			if (s->dup) dedup_lookup(s);
+			kt_for(p->n_threads, worker_for, in, s->n_frag);
+			if (s->dup) dedup_replay(s);
+		}
+		if (!(p->opt->split_prefix && p->n_parts == 0) && !(p->opt->flag & MM_F_OUT_HITS) && s->n_frag > 0) { // SAM/PAF lines are formatted by all threads, not by the output step
+			s->n_out = s->n_frag < p->n_threads * 4? s->n_frag : p->n_threads * 4; // more ranges than threads to even out their lengths
+			s->out = (kstring_t*)calloc(s->n_out, sizeof(kstring_t));
+			kt_for(p->n_threads, worker_format, in, s->n_out);
+		}
 		return in;
     } else if (step == 2) { // step 2: output
-		void *km = 0;
         step_t *s = (step_t*)in;
-		const mm_idx_t *mi = p->mi;
-		for (i = 0; i < p->n_threads; ++i) mm_tbuf_destroy(s->buf[i]);
-		free(s->buf);
-		if ((p->opt->flag & MM_F_OUT_CS) && !(mm_dbg_flag & MM_DBG_NO_KALLOC)) km = km_init();
+		mm_hit_rec_t *hits = 0;
+		int m, n_hits = 0;
+		double t_mt = mm_metrics_clock();
+		for (i = 0; i < p->n_threads; ++i) { // fold the per-thread metrics; steps 2 of different batches never overlap
+			filter_calls += (int)s->buf[i]->mt.c[MM_MC_FILTER_CALLS];
+			mm_metrics_add(&p->mt, &s->buf[i]->mt);
+		}
+		for (i = 0; i < s->n_out; ++i) { // one write per range instead of one per line
+			mm_err_fwrite(s->out[i].s, 1, s->out[i].l, stdout);
+			free(s->out[i].s);
+		}
+		free(s->out);
+		if (p->opt->flag & MM_F_OUT_HITS) { // records of a batch go out in one write
+			for (i = 0, m = 0; i < s->n_seq; ++i) m += s->n_reg[i];
+			hits = (mm_hit_rec_t*)malloc((m > 0? m : 1) * sizeof(mm_hit_rec_t));
+		}
 		for (k = 0; k < s->n_frag; ++k) {  //going over the reads, read by read
 			int seg_st = s->seg_off[k], seg_en = s->seg_off[k] + s->n_seg[k];
 			for (i = seg_st; i < seg_en; ++i) {
@@ -1087,48 +1707,33 @@ static void *worker_pipeline(void *shared, int step, void *in){
 					}
 				}
 
-				else if (s->n_reg[i] > 0) { // the query has at least one hit
+				else if (p->opt->flag & MM_F_OUT_HITS) { // accepted locations only; unmapped reads leave no record
 					for (j = 0; j < s->n_reg[i]; ++j) {
-						mm_reg1_t *r = &s->reg[i][j];
-
-						assert(!r->sam_pri || r->id == r->parent);
-						if ((p->opt->flag & MM_F_NO_PRINT_2ND) && r->id != r->parent)
+						if ((p->opt->flag & MM_F_NO_PRINT_2ND) && s->reg[i][j].id != s->reg[i][j].parent)
 							continue;
-						if (p->opt->flag & MM_F_OUT_SAM)
-							mm_write_sam3(&p->str, mi, t, i - seg_st, j, s->n_seg[k], &s->n_reg[seg_st], (const mm_reg1_t*const*)&s->reg[seg_st], km, p->opt->flag, s->rep_len[i], 0);
-						else
-							mm_write_paf3(&p->str, mi, t, r, km, p->opt->flag, s->rep_len[i]);
-						mm_err_puts(p->str.s);
-
-
-					}
-
-				}
-
-				else if ((p->opt->flag & MM_F_PAF_NO_HIT) || ((p->opt->flag & MM_F_OUT_SAM) && !(p->opt->flag & MM_F_SAM_HIT_ONLY))) { // output an empty hit, if requested
-					if (p->opt->flag & MM_F_OUT_SAM){
-						mm_write_sam3(&p->str, mi, t, i - seg_st, -1, s->n_seg[k], &s->n_reg[seg_st], (const mm_reg1_t*const*)&s->reg[seg_st], km, p->opt->flag, s->rep_len[i], 0);
-					}
-					else{
-						mm_write_paf3(&p->str, mi, t, 0, 0, p->opt->flag, s->rep_len[i]);
+						mm_hit_rec_set(&hits[n_hits++], t, i - seg_st, s->n_seg[k], &s->reg[i][j]);
 					}
-					mm_err_puts(p->str.s);
-
-
 				}
 
-
 			}
 			for (i = seg_st; i < seg_en; ++i) {
-				for (j = 0; j < s->n_reg[i]; ++j) free(s->reg[i][j].p);
-				free(s->reg[i]);
+				if (s->buf[0]->km_reg == 0) {
+					for (j = 0; j < s->n_reg[i]; ++j) free(s->reg[i][j].p);
+					free(s->reg[i]);
+				}
+				if (p->mem_seq) continue;
 				free(s->seq[i].seq); free(s->seq[i].name);
 				if (s->seq[i].qual) free(s->seq[i].qual);
 				if (s->seq[i].comment) free(s->seq[i].comment);
 			}
 		}
-		free(s->reg); free(s->n_reg); free(s->seq); // seg_off, n_seg, rep_len and frag_gap were allocated with reg; no memory leak here
-		km_destroy(km);
+		if (hits) {
+			mm_write_hits(n_hits, hits);
+			free(hits);
+		}
+		put_bufs(p, s->buf);
+		free(s->reg); free(s->n_reg); free(s->seq); free(s->dup); // seg_off, n_seg, rep_len and frag_gap were allocated with reg; no memory leak here
+		mm_metrics_lap(&p->mt, MM_MT_OUTPUT, &t_mt);
 		if (mm_verbose >= 3)
 			fprintf(stderr, "[M::%s::%.3f*%.2f] mapped %d sequences\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), s->n_seq);
 		free(s);
@@ -1156,26 +1761,32 @@ static mm_bseq_file_t **open_bseqs(int n, const char **fn)
 
 int mm_map_file_frag(const mm_idx_t *idx, int n_segs, const char **fn, const mm_mapopt_t *opt, int n_threads)
 {
-	int i, pl_threads;
+	int i;
 	pipeline_t pl;
 	if (n_segs < 1) return -1;
-	memset(&pl, 0, sizeof(pipeline_t));
+	pipeline_init(&pl);
 	pl.n_fp = n_segs;
 	pl.fp = open_bseqs(pl.n_fp, fn);
-	if (pl.fp == 0) return -1;
+	if (pl.fp == 0) {
+		pipeline_destroy(&pl);
+		return -1;
+	}
 	pl.opt = opt, pl.mi = idx;
 	pl.n_threads = n_threads > 1? n_threads : 1;
 	pl.mini_batch_size = opt->mini_batch_size;
 	if (opt->split_prefix)
 		pl.fp_split = mm_split_init(opt->split_prefix, idx);
-	pl_threads = n_threads == 1? 1 : (opt->flag&MM_F_2_IO_THREADS)? 3 : 2;
-	kt_pipeline(pl_threads, worker_pipeline, &pl, 3);
+	if (opt->flag & MM_F_DEDUP)
+		pl.dedup_cache = mm_lru_init(opt->dedup_cache, dedup_hit_destroy);
+	kt_pipeline(pipeline_depth(opt, n_threads, 1), worker_pipeline, &pl, 3);
+	mm_metrics_add(&mm_map_metrics, &pl.mt);
 
-	free(pl.str.s);
+	mm_lru_destroy(pl.dedup_cache);
 	if (pl.fp_split) fclose(pl.fp_split);
 	for (i = 0; i < pl.n_fp; ++i)
 		mm_bseq_close(pl.fp[i]);
 	free(pl.fp);
+	pipeline_destroy(&pl);
 	return 0;
 }
 
@@ -1184,16 +1795,41 @@ int mm_map_file(const mm_idx_t *idx, const char *fn, const mm_mapopt_t *opt, int
 	return mm_map_file_frag(idx, 1, &fn, opt, n_threads);
 }
 
+int mm_map_seqs(const mm_idx_t *idx, int n_seq, mm_bseq1_t *seq, const mm_mapopt_t *opt, int n_threads)
+{
+	pipeline_t pl;
+	if (n_seq < 1) return -1;
+	pipeline_init(&pl);
+	pl.mem_seq = seq, pl.n_mem_seq = n_seq;
+	pl.opt = opt, pl.mi = idx;
+	pl.n_threads = n_threads > 1? n_threads : 1;
+	pl.mini_batch_size = opt->mini_batch_size;
+	if (opt->split_prefix)
+		pl.fp_split = mm_split_init(opt->split_prefix, idx);
+	if (opt->flag & MM_F_DEDUP)
+		pl.dedup_cache = mm_lru_init(opt->dedup_cache, dedup_hit_destroy);
+	kt_pipeline(pipeline_depth(opt, n_threads, 0), worker_pipeline, &pl, 3); // no reader thread needed by default; the input is already in memory
+	mm_metrics_add(&mm_map_metrics, &pl.mt);
+
+	mm_lru_destroy(pl.dedup_cache);
+	if (pl.fp_split) fclose(pl.fp_split);
+	pipeline_destroy(&pl);
+	return 0;
+}
+
 int mm_split_merge(int n_segs, const char **fn, const mm_mapopt_t *opt, int n_split_idx)
 {
 	int i;
 	pipeline_t pl;
 	mm_idx_t *mi;
 	if (n_segs < 1 || n_split_idx < 1) return -1;
-	memset(&pl, 0, sizeof(pipeline_t));
+	pipeline_init(&pl);
 	pl.n_fp = n_segs;
 	pl.fp = open_bseqs(pl.n_fp, fn);
-	if (pl.fp == 0) return -1;
+	if (pl.fp == 0) {
+		pipeline_destroy(&pl);
+		return -1;
+	}
 	pl.opt = opt;
 	pl.mini_batch_size = opt->mini_batch_size;
 
@@ -1204,19 +1840,22 @@ int mm_split_merge(int n_segs, const char **fn, const mm_mapopt_t *opt, int n_sp
 	if (pl.mi == 0) {
 		free(pl.fp_parts);
 		free(pl.rid_shift);
+		pipeline_destroy(&pl);
 		return -1;
 	}
 	for (i = n_split_idx - 1; i > 0; --i)
 		pl.rid_shift[i] = pl.rid_shift[i - 1];
 	for (pl.rid_shift[0] = 0, i = 1; i < n_split_idx; ++i)
 		pl.rid_shift[i] += pl.rid_shift[i - 1];
-	if (opt->flag & MM_F_OUT_SAM)
+	if (opt->flag & MM_F_OUT_HITS)
+		mm_write_hits_hdr(pl.mi, 0); // the magic was written with the first index part
+	else if (opt->flag & MM_F_OUT_SAM)
 		for (i = 0; i < (int32_t)pl.mi->n_seq; ++i)
 			printf("@SQ\tSN:%s\tLN:%d\n", pl.mi->seq[i].name, pl.mi->seq[i].len);
 
 	kt_pipeline(2, worker_pipeline, &pl, 3);
+	mm_metrics_add(&mm_map_metrics, &pl.mt);
 
-	free(pl.str.s);
 	mm_idx_destroy(mi);
 	free(pl.rid_shift);
 	for (i = 0; i < n_split_idx; ++i)
@@ -1225,6 +1864,7 @@ int mm_split_merge(int n_segs, const char **fn, const mm_mapopt_t *opt, int n_sp
 	for (i = 0; i < pl.n_fp; ++i)
 		mm_bseq_close(pl.fp[i]);
 	free(pl.fp);
+	pipeline_destroy(&pl);
 	mm_split_rm_tmp(opt->split_prefix, n_split_idx);
 	return 0;
 }
@@ -0,0 +1,873 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#include "bseq.h"
+#include "minimap.h"
+#include "mmpriv.h"
+#include "ketopt.h"
+#include "kvec.h"
+#include "khash.h"
+#include "kseq.h"
+#include "filter.h"
+#include "containment.h"
+#include "metrics.h"
+#include "dedup.h"
+#include "catalog.h"
+
+/*
+ * metafast: containment search, reference selection and read mapping in one
+ * process. The reads are loaded once, the shard indexes in <mmi_dir> are
+ * scored like ContainmentSearch/cs does, the selected references are taken
+ * straight from the resident shards and the reads are then mapped with the
+ * same engine and options as `rm -ax sr --secondary=yes`. Nothing is written
+ * to disk apart from the SAM stream (and the containment table with -C).
+ *
+ * With --converge, the containment search scores the reads in random chunks
+ * and stops once the selected taxa have not changed for a number of chunks;
+ * the mapping stage still maps every read.
+ *
+ * With --server, the catalog and shards are loaded once and each sample
+ * arriving on a UNIX socket is processed in a forked child, which shares the
+ * resident shards copy-on-write and streams its SAM back over the connection.
+ */
+
+#define MM_VERSION "2.17-r974-dirty-SneakySnake"
+#define MF_REQUEST_TIMEOUT 10 // seconds the server waits for the job line of a connection
+
+KSTREAM_DECLARE(gzFile, gzread)
+KHASH_MAP_INIT_STR(str, int32_t)
+
+typedef struct {
+	char *taxid, *taxlin; // taxlin: TaxID_Lineage column of db_info; NULL if absent
+	uint64_t cnt;
+	double score;
+	int hit, sel;
+} mf_taxon_t;
+
+typedef struct {
+	int32_t n_taxa, m_taxa;
+	mf_taxon_t *taxa;
+	khash_t(str) *taxid2id; // taxid -> index in taxa[]
+	khash_t(str) *acc2id;   // accession -> index in taxa[]
+	kvec_t(char*) acc;      // keys of acc2id
+	mf_db_t *db;            // compiled catalog; if set, taxa[] follows db->taxa[] and both hashes are unused
+} mf_catalog_t;
+
+typedef struct {
+	kvec_t(mm_idx_t*) idx;
+	kvec_t(char*) name;      // "<file>:<part>" of each shard index
+	kvec_t(mm_metrics_t) mt; // loading time of each shard index
+} mf_shards_t;
+
+typedef struct {
+	float cutoff;
+	int strain_level;
+	int n_threads, max_jobs, help;
+	int converge;                  // stop scoring after this many chunks without a change of the selection; 0 to score all reads
+	int64_t chunk_size, min_sample; // in reads
+	int taxon_rank;                // with --taxa: group references by this rank of the TaxID lineage; 0 for TaxIDs
+	const char *fn_cs_out, *fn_sock, *fn_metrics, *fn_taxa;
+	mf_csopt_t cso;
+	mm_idxopt_t ipt;
+	mm_mapopt_t opt;
+} mf_opt_t;
+
+static ko_longopt_t long_options[] = {
+	{ "filter",         ko_required_argument, 300 },
+	{ "server",         ko_required_argument, 301 },
+	{ "metrics",        ko_required_argument, 302 },
+	{ "dedup",          ko_optional_argument, 303 },
+	{ "converge",       ko_required_argument, 304 },
+	{ "chunk-size",     ko_required_argument, 305 },
+	{ "min-sample",     ko_required_argument, 306 },
+	{ "band-vote",      ko_optional_argument, 307 },
+	{ "taxa",           ko_required_argument, 308 },
+	{ "taxon-rank",     ko_required_argument, 309 },
+	{ "hits-bin",       ko_no_argument,       310 },
+	{ "pipeline-depth", ko_required_argument, 311 },
+	{ "long-read",      ko_no_argument,       312 },
+	{ "seed-evidence",  ko_no_argument,       313 },
+	{ "max-edit-frac",  ko_required_argument, 314 },
+	{ "strain-level",   ko_no_argument,       'S' },
+	{ "cutoff",         ko_required_argument, 'c' },
+	{ "help",           ko_no_argument,       'h' },
+	{ 0, 0, 0 }
+};
+
+static inline int64_t mm_parse_num(const char *str) // as in main.c
+{
+	double x;
+	char *p;
+	x = strtod(str, &p);
+	if (*p == 'G' || *p == 'g') x *= 1e9;
+	else if (*p == 'M' || *p == 'm') x *= 1e6;
+	else if (*p == 'K' || *p == 'k') x *= 1e3;
+	return (int64_t)(x + .499);
+}
+
+static int32_t catalog_taxon(mf_catalog_t *c, const char *taxid)
+{
+	khint_t k;
+	int absent;
+	k = kh_put(str, c->taxid2id, taxid, &absent);
+	if (absent) {
+		mf_taxon_t *t;
+		if (c->n_taxa == c->m_taxa) {
+			c->m_taxa = c->m_taxa? c->m_taxa<<1 : 1024;
+			c->taxa = (mf_taxon_t*)realloc(c->taxa, c->m_taxa * sizeof(mf_taxon_t));
+		}
+		t = &c->taxa[c->n_taxa];
+		memset(t, 0, sizeof(mf_taxon_t));
+		t->taxid = strdup(taxid);
+		kh_key(c->taxid2id, k) = t->taxid;
+		kh_val(c->taxid2id, k) = c->n_taxa++;
+	}
+	return kh_val(c->taxid2id, k);
+}
+
+static int catalog_read_translation(mf_catalog_t *c, const char *fn)
+{ // lines: "<accession> <taxid>"
+	gzFile fp;
+	kstream_t *ks;
+	kstring_t str = {0,0,0};
+	fp = gzopen(fn, "r");
+	if (fp == 0) return -1;
+	ks = ks_init(fp);
+	while (ks_getuntil(ks, KS_SEP_LINE, &str, 0) >= 0) {
+		char *p, *q;
+		int32_t tid;
+		khint_t k;
+		int absent;
+		for (p = str.s; *p && *p != ' ' && *p != '\t'; ++p) { }
+		if (*p == 0) continue;
+		*p++ = 0;
+		for (q = p; *q && *q != ' ' && *q != '\t' && *q != '\r'; ++q) { }
+		*q = 0;
+		tid = catalog_taxon(c, p);
+		k = kh_put(str, c->acc2id, str.s, &absent);
+		if (absent) {
+			kv_push(char*, 0, c->acc, strdup(str.s));
+			kh_key(c->acc2id, k) = c->acc.a[c->acc.n - 1];
+		}
+		kh_val(c->acc2id, k) = tid;
+	}
+	free(str.s);
+	ks_destroy(ks);
+	gzclose(fp);
+	return 0;
+}
+
+static int catalog_read_dbinfo(mf_catalog_t *c, const char *fn)
+{ // tab-delimited: Accession, Length, TaxID, Lineage, TaxID_Lineage; first line is the header
+	gzFile fp;
+	kstream_t *ks;
+	kstring_t str = {0,0,0};
+	int64_t n_lines = 0;
+	fp = gzopen(fn, "r");
+	if (fp == 0) return -1;
+	ks = ks_init(fp);
+	while (ks_getuntil(ks, KS_SEP_LINE, &str, 0) >= 0) {
+		char *fields[5], *p;
+		int i;
+		khint_t k;
+		if (n_lines++ == 0) continue;
+		for (i = 0, p = fields[0] = str.s; *p && i < 5; ++p)
+			if (*p == '\t' || *p == '\r') *p = 0, fields[++i] = p + 1;
+		if (i < 4) continue;
+		k = kh_get(str, c->taxid2id, fields[2]);
+		if (k == kh_end(c->taxid2id)) continue; // not in the translation table; never scored
+		if (c->taxa[kh_val(c->taxid2id, k)].taxlin == 0)
+			c->taxa[kh_val(c->taxid2id, k)].taxlin = strdup(fields[4]);
+	}
+	free(str.s);
+	ks_destroy(ks);
+	gzclose(fp);
+	return 0;
+}
+
+static int catalog_read_db(mf_catalog_t *c, const char *fn)
+{ // the strings stay in the mapped catalog
+	uint32_t i;
+	if ((c->db = mf_db_load(fn)) == 0) return -1;
+	c->n_taxa = c->m_taxa = c->db->n_taxa;
+	c->taxa = (mf_taxon_t*)calloc(c->n_taxa, sizeof(mf_taxon_t));
+	for (i = 0; i < c->db->n_taxa; ++i) {
+		const mf_db_taxon_t *t = &c->db->taxa[i];
+		c->taxa[i].taxid = c->db->str + t->taxid;
+		c->taxa[i].taxlin = t->tax_lin? c->db->str + t->tax_lin : 0;
+	}
+	return 0;
+}
+
+static void catalog_destroy(mf_catalog_t *c)
+{
+	size_t j;
+	int32_t i;
+	if (c->db) {
+		free(c->taxa);
+		mf_db_destroy(c->db);
+		return;
+	}
+	kh_destroy(str, c->acc2id);
+	for (j = 0; j < c->acc.n; ++j) free(c->acc.a[j]);
+	free(c->acc.a);
+	kh_destroy(str, c->taxid2id);
+	for (i = 0; i < c->n_taxa; ++i) {
+		free(c->taxa[i].taxid);
+		free(c->taxa[i].taxlin);
+	}
+	free(c->taxa);
+}
+
+static inline int32_t catalog_acc2id(const mf_catalog_t *c, const char *acc)
+{
+	khint_t k;
+	if (c->db) return mf_db_acc2taxon(c->db, acc);
+	k = kh_get(str, c->acc2id, acc);
+	return k == kh_end(c->acc2id)? -1 : kh_val(c->acc2id, k);
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+	return strcmp(*(char*const*)a, *(char*const*)b);
+}
+
+static char **list_shards(const char *dir, int *n_)
+{ // *.mmi files in dir, sorted so that runs are reproducible
+	DIR *d;
+	struct dirent *e;
+	kvec_t(char*) a = {0,0,0};
+	*n_ = 0;
+	if ((d = opendir(dir)) == 0) return 0;
+	while ((e = readdir(d)) != 0) {
+		size_t l = strlen(e->d_name), ld = strlen(dir);
+		char *fn;
+		if (e->d_name[0] == '.' || l < 4 || strcmp(e->d_name + l - 4, ".mmi") != 0) continue;
+		fn = (char*)malloc(ld + l + 2);
+		sprintf(fn, ld > 0 && dir[ld-1] == '/'? "%s%s" : "%s/%s", dir, e->d_name);
+		kv_push(char*, 0, a, fn);
+	}
+	closedir(d);
+	qsort(a.a, a.n, sizeof(char*), cmp_str);
+	*n_ = a.n;
+	return a.a;
+}
+
+static int load_shard(const char *fn, int n_threads, mf_shards_t *shards)
+{
+	mm_idx_reader_t *r;
+	mm_idxopt_t ipt;
+	mm_mapopt_t opt;
+	mm_idx_t *mi;
+	int part = 0;
+	double t_mt = mm_metrics_clock();
+	mm_set_opt(0, &ipt, &opt);
+	r = mm_idx_reader_open(fn, &ipt, 0);
+	if (r == 0) return -1;
+	if (!r->is_idx) {
+		fprintf(stderr, "[ERROR] '%s' is not a minimap2 index\n", fn);
+		mm_idx_reader_close(r);
+		return -1;
+	}
+	while ((mi = mm_idx_reader_read(r, n_threads)) != 0) {
+		mm_metrics_t mt;
+		char *name;
+		memset(&mt, 0, sizeof(mm_metrics_t));
+		if (mm_idx_pack(mi) < 0 && mm_verbose >= 3) // the shards are only looked up from now on
+			fprintf(stderr, "[M::%s] kept the hash tables of '%s:%d': positions don't fit in 32 bits\n", __func__, fn, part);
+		mm_metrics_lap(&mt, MM_MT_INDEX, &t_mt);
+		name = (char*)malloc(strlen(fn) + 16);
+		sprintf(name, "%s:%d", fn, part++);
+		kv_push(mm_idx_t*, 0, shards->idx, mi);
+		kv_push(char*, 0, shards->name, name);
+		kv_push(mm_metrics_t, 0, shards->mt, mt);
+	}
+	mm_idx_reader_close(r);
+	return 0;
+}
+
+static int load_shards(const char *dir, int n_threads, mf_shards_t *shards)
+{
+	char **fn;
+	int i, n_fn, ret = 0;
+	fn = list_shards(dir, &n_fn);
+	if (n_fn == 0) {
+		fprintf(stderr, "[ERROR] no .mmi files found in '%s'\n", dir);
+		return -1;
+	}
+	for (i = 0; i < n_fn; ++i) {
+		if (ret == 0 && load_shard(fn[i], n_threads, shards) < 0) {
+			fprintf(stderr, "[ERROR] failed to load shard '%s'\n", fn[i]);
+			ret = -1;
+		}
+		free(fn[i]);
+	}
+	free(fn);
+	if (ret == 0 && mm_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] loaded %ld shard index(es)\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), (long)shards->idx.n);
+	return ret;
+}
+
+static void count_shards(mf_catalog_t *c, const mf_shards_t *shards, const mf_csopt_t *cso, int n_seq, const mm_bseq1_t *seq, const uint32_t *mult, int n_threads, mm_metrics_t *mt)
+{ // add to the counts of c; mt[j]: metrics of shard j
+	size_t j;
+	for (j = 0; j < shards->idx.n; ++j) {
+		const mm_idx_t *mi = shards->idx.a[j];
+		uint64_t *cnt;
+		uint32_t k;
+		double t_mt;
+		cnt = (uint64_t*)calloc(mi->n_seq, sizeof(uint64_t));
+		mf_cs_count(mi, cso, n_seq, seq, mult, n_threads, cnt, &mt[j]);
+		t_mt = mm_metrics_clock();
+		for (k = 0; k < mi->n_seq; ++k) {
+			int32_t tid;
+			if (cnt[k] == 0 || (tid = catalog_acc2id(c, mi->seq[k].name)) < 0) continue;
+			c->taxa[tid].cnt += cnt[k];
+			c->taxa[tid].hit = 1;
+			++mt[j].c[MM_MC_CANDIDATES];
+		}
+		free(cnt);
+		mm_metrics_lap(&mt[j], MM_MT_MERGE, &t_mt);
+	}
+}
+
+
+static void count_reads(mf_catalog_t *c, const mf_shards_t *shards, const mf_opt_t *mo, int n_seq, const mm_bseq1_t *seq, mm_metrics_t *mt)
+{
+	uint32_t *mult = 0;
+	int i;
+	if (mo->opt.flag & MM_F_DEDUP) { // containment scores are additive: score each distinct read once, weighted by its copies
+		const char **key = (const char**)malloc((size_t)n_seq * sizeof(const char*));
+		char *rc = mm_dedup_canonical(n_seq, seq, key); // the counts don't depend on the strand
+		int32_t *dup = mm_dedup_batch(n_seq, seq, key);
+		mult = (uint32_t*)calloc(n_seq, sizeof(uint32_t));
+		for (i = 0; i < n_seq; ++i)
+			++mult[dup[i] < 0? i : dup[i]];
+		free(dup); free(key); free(rc);
+	}
+	count_shards(c, shards, &mo->cso, n_seq, seq, mult, mo->n_threads, mt);
+	free(mult);
+}
+
+static int cmp_taxon_score(const void *a, const void *b)
+{
+	const mf_taxon_t *x = *(const mf_taxon_t*const*)a, *y = *(const mf_taxon_t*const*)b;
+	return x->score < y->score? 1 : x->score > y->score? -1 : strcmp(x->taxid, y->taxid);
+}
+
+static int select_taxa(mf_catalog_t *c, const mf_opt_t *mo)
+{ // normalize by the top score, apply the cutoff and keep one strain per species
+	khash_t(str) *species;
+	kvec_t(char*) keys = {0,0,0}; // of species
+	mf_taxon_t **a;
+	uint64_t max_cnt = 0;
+	int32_t i, n = 0, n_sel = 0;
+	for (i = 0; i < c->n_taxa; ++i)
+		if (c->taxa[i].cnt > max_cnt) max_cnt = c->taxa[i].cnt;
+	for (i = 0; i < c->n_taxa; ++i)
+		c->taxa[i].sel = 0;
+	if (max_cnt == 0) return 0;
+	a = (mf_taxon_t**)malloc(c->n_taxa * sizeof(mf_taxon_t*));
+	for (i = 0; i < c->n_taxa; ++i) {
+		mf_taxon_t *t = &c->taxa[i];
+		if (!t->hit) continue;
+		t->score = (double)t->cnt / max_cnt;
+		if (t->score >= mo->cutoff) a[n++] = t;
+	}
+	qsort(a, n, sizeof(mf_taxon_t*), cmp_taxon_score); // the best-scoring strain represents its species
+	species = kh_init(str);
+	for (i = 0; i < n; ++i) {
+		mf_taxon_t *t = a[i];
+		if (!mo->strain_level && t->taxlin) { // species taxid is the second to last field of the lineage
+			char *p, *q;
+			khint_t k;
+			int absent;
+			p = strrchr(t->taxlin, '|');
+			if (p && p != t->taxlin) {
+				for (q = p - 1; q > t->taxlin && *q != '|'; --q) { }
+				if (*q == '|') ++q;
+				if (q < p) {
+					*p = 0; // temporarily terminate the lineage at the species
+					k = kh_put(str, species, q, &absent);
+					if (absent) {
+						kv_push(char*, 0, keys, strdup(q));
+						kh_key(species, k) = keys.a[keys.n - 1];
+					}
+					*p = '|';
+					if (!absent) continue;
+				}
+			}
+		}
+		t->sel = 1, ++n_sel;
+	}
+	kh_destroy(str, species);
+	for (i = 0; i < (int32_t)keys.n; ++i) free(keys.a[i]);
+	free(keys.a);
+	free(a);
+	return n_sel;
+}
+
+static int score_converge(mf_catalog_t *c, const mf_shards_t *shards, const mf_opt_t *mo, int n_seq, const mm_bseq1_t *seq, mm_metrics_t *mt, int *n_sel)
+{ // score random chunks of reads until the selection is stable; return the number of reads scored
+	mm_bseq1_t *a;
+	uint8_t *sel;
+	int i, n_done = 0, n_stable = 0;
+	a = (mm_bseq1_t*)malloc(n_seq * sizeof(mm_bseq1_t));
+	memcpy(a, seq, n_seq * sizeof(mm_bseq1_t)); // shallow copies; the order of seq[] is kept for mapping
+	srand48(11);
+	for (i = n_seq - 1; i > 0; --i) { // Fisher-Yates shuffle
+		int j = (int)(drand48() * (i + 1));
+		mm_bseq1_t t = a[i];
+		a[i] = a[j], a[j] = t;
+	}
+	sel = (uint8_t*)calloc(c->n_taxa, 1);
+	*n_sel = 0;
+	while (n_done < n_seq) {
+		int n = n_seq - n_done < mo->chunk_size? n_seq - n_done : (int)mo->chunk_size, changed = 0;
+		count_reads(c, shards, mo, n, &a[n_done], mt);
+		n_done += n;
+		*n_sel = select_taxa(c, mo);
+		for (i = 0; i < c->n_taxa; ++i)
+			if (sel[i] != c->taxa[i].sel)
+				sel[i] = c->taxa[i].sel, changed = 1;
+		n_stable = changed? 0 : n_stable + 1;
+		if (mm_verbose >= 4)
+			fprintf(stderr, "[M::%s] %d reads scored; %d taxa selected%s\n", __func__, n_done, *n_sel, changed? "" : " (unchanged)");
+		if (n_stable >= mo->converge && n_done >= mo->min_sample) break;
+	}
+	free(sel); free(a);
+	return n_done;
+}
+
+static int write_containment(const mf_catalog_t *c, const char *fn)
+{ // same format as the ContainmentSearch/cs output table
+	FILE *fp;
+	int32_t i;
+	if ((fp = fopen(fn, "w")) == 0) return -1;
+	for (i = 0; i < c->n_taxa; ++i) {
+		const mf_taxon_t *t = &c->taxa[i];
+		char *p;
+		if (!t->hit) continue;
+		fputs("taxid_", fp);
+		for (p = t->taxid; *p; ++p)
+			fputc(*p == '.'? '_' : *p, fp);
+		fprintf(fp, "_genomic.fna.gz,%f\n", t->score);
+	}
+	fclose(fp);
+	return 0;
+}
+
+static mm_idx_t *build_reference(const mf_catalog_t *c, int n_shards, mm_idx_t **shards, int w, int k)
+{ // index the selected sequences, decoded from the packed sequences kept in the shards
+	kstring_t buf = {0,0,0}; // the decoded sequences, NULL-terminated one after another
+	kvec_t(size_t) off = {0,0,0};
+	kvec_t(const char*) seq = {0,0,0};
+	kvec_t(const char*) name = {0,0,0};
+	khash_t(str) *seen;
+	mm_idx_t *ref;
+	int i;
+	size_t j;
+	seen = kh_init(str);
+	for (i = 0; i < n_shards; ++i) {
+		const mm_idx_t *mi = shards[i];
+		uint32_t rid;
+		for (rid = 0; rid < mi->n_seq; ++rid) {
+			int32_t tid, absent, l, x;
+			uint8_t *s;
+			if ((tid = catalog_acc2id(c, mi->seq[rid].name)) < 0 || !c->taxa[tid].sel) continue;
+			kh_put(str, seen, mi->seq[rid].name, &absent);
+			if (!absent) continue; // the same accession in several shards
+			if (mi->flag & MM_I_NO_SEQ) {
+				fprintf(stderr, "[ERROR] shard index without sequences; rebuild it without --idx-no-seq\n");
+				free(buf.s); free(off.a); free(name.a);
+				kh_destroy(str, seen);
+				return 0;
+			}
+			if (buf.l + mi->seq[rid].len + 1 > buf.m) {
+				buf.m = buf.l + mi->seq[rid].len + 1;
+				kroundup32(buf.m);
+				buf.s = (char*)realloc(buf.s, buf.m);
+			}
+			s = (uint8_t*)buf.s + buf.l;
+			l = mm_idx_getseq(mi, rid, 0, mi->seq[rid].len, s);
+			for (x = 0; x < l; ++x)
+				s[x] = "ACGTN"[s[x]];
+			s[l] = 0;
+			kv_push(size_t, 0, off, buf.l);
+			kv_push(const char*, 0, name, mi->seq[rid].name);
+			buf.l += (size_t)l + 1;
+		}
+	}
+	kh_destroy(str, seen);
+	for (j = 0; j < off.n; ++j) // buf.s has its final address now
+		kv_push(const char*, 0, seq, buf.s + off.a[j]);
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] indexing %ld selected sequence(s)\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), (long)seq.n);
+	ref = mm_idx_str(w, k, 0, 14, seq.n, seq.a, name.a);
+	free(buf.s); free(off.a); free(seq.a); free(name.a);
+	return ref;
+}
+
+static void mf_opt_init(mf_opt_t *mo)
+{
+	memset(mo, 0, sizeof(mf_opt_t));
+	mo->cutoff = 0.0001f, mo->n_threads = 4, mo->max_jobs = 2;
+	mo->chunk_size = 50000, mo->min_sample = 500000;
+	mf_csopt_init(&mo->cso);
+	mm_set_opt(0, &mo->ipt, &mo->opt);
+	mm_set_opt("sr", &mo->ipt, &mo->opt); // what containment_search.py/read_mapping.py pass to rm
+	mo->opt.flag |= MM_F_OUT_SAM | MM_F_CIGAR;
+	mo->opt.flag &= ~MM_F_NO_PRINT_2ND; // --secondary=yes
+	mo->opt.min_cnt = 3, mo->opt.bw = 15;
+}
+
+static int parse_opts(int argc, char *argv[], mf_opt_t *mo, int *ind)
+{ // shared by the command line and by the job lines of the server mode
+	const char *opt_str = "c:St:n:r:C:o:v:j:h";
+	ketopt_t o = KETOPT_INIT;
+	int c, long_read = 0, bw_set = 0;
+	while ((c = ketopt(&o, argc, argv, 1, opt_str, long_options)) >= 0) {
+		if (c == 'c') mo->cutoff = atof(o.arg);
+		else if (c == 'S') mo->strain_level = 1;
+		else if (c == 't') mo->n_threads = atoi(o.arg);
+		else if (c == 'n') mo->opt.min_cnt = atoi(o.arg);
+		else if (c == 'r') mo->opt.bw = atoi(o.arg), bw_set = 1;
+		else if (c == 'C') mo->fn_cs_out = o.arg;
+		else if (c == 'v') mm_verbose = atoi(o.arg);
+		else if (c == 'j') mo->max_jobs = atoi(o.arg);
+		else if (c == 'h') mo->help = 1;
+		else if (c == 300) filter = o.arg; // --filter
+		else if (c == 301) mo->fn_sock = o.arg; // --server
+		else if (c == 302) mo->fn_metrics = o.arg, mm_metrics_on = 1; // --metrics
+		else if (c == 303) { // --dedup
+			mo->opt.flag |= MM_F_DEDUP;
+			if (o.arg) mo->opt.dedup_cache = atoi(o.arg);
+		}
+		else if (c == 304) mo->converge = atoi(o.arg); // --converge
+		else if (c == 305) mo->chunk_size = mm_parse_num(o.arg); // --chunk-size
+		else if (c == 306) mo->min_sample = mm_parse_num(o.arg); // --min-sample
+		else if (c == 307) { // --band-vote
+			mo->opt.flag |= MM_F_BAND_VOTE;
+			if (o.arg) mo->opt.band_w = atoi(o.arg);
+		}
+		else if (c == 308) mo->fn_taxa = o.arg, mo->opt.flag |= MM_F_TAXON_ONCE; // --taxa
+		else if (c == 309) mo->taxon_rank = atoi(o.arg); // --taxon-rank
+		else if (c == 310) mo->opt.flag |= MM_F_OUT_HITS; // --hits-bin
+		else if (c == 311) mo->opt.pipeline_depth = atoi(o.arg); // --pipeline-depth
+		else if (c == 312) mo->opt.flag |= MM_F_LONG_READ, long_read = 1; // --long-read
+		else if (c == 313) mo->opt.flag |= MM_F_SEED_EVIDENCE; // --seed-evidence
+		else if (c == 314) mo->opt.max_edit_frac = (float)atof(o.arg); // --max-edit-frac
+		else if (c == 'o') {
+			if (strcmp(o.arg, "-") != 0) {
+				if (freopen(o.arg, "wb", stdout) == NULL) {
+					fprintf(stderr, "[ERROR]\033[1;31m failed to write the output to file '%s'\033[0m: %s\n", o.arg, strerror(errno));
+					return -1;
+				}
+			}
+		} else if (c == ':') {
+			fprintf(stderr, "[ERROR] missing option argument\n");
+			return -1;
+		} else if (c == '?') {
+			fprintf(stderr, "[ERROR] unknown option in \"%s\"\n", argv[o.i - 1]);
+			return -1;
+		}
+	}
+	if (long_read && !bw_set) mo->opt.bw = 500; // the bandwidth of -x map-ont
+	*ind = o.ind;
+	return 0;
+}
+
+static int run_sample(mf_catalog_t *c, const mf_shards_t *shards, mf_opt_t *mo, const char *fn_reads, int argc, char *argv[])
+{ // containment search, reference selection and mapping of one read set; SAM goes to stdout
+	mm_bseq_file_t *fp;
+	mm_bseq1_t *seq;
+	mm_idx_t *ref;
+	mm_metrics_t mt_total, *mt;
+	int32_t i;
+	int n_seq, n_sel, ret = 0;
+	double t_mt = mm_metrics_clock();
+
+	// load the reads once; they are used by both stages
+	if ((fp = mm_bseq_open(fn_reads)) == 0) {
+		fprintf(stderr, "[ERROR] failed to open file '%s': %s\n", fn_reads, strerror(errno));
+		return -1;
+	}
+	seq = mm_bseq_read3(fp, INT64_MAX, !(mo->opt.flag & MM_F_NO_QUAL), 0, 0, &n_seq);
+	mm_bseq_close(fp);
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] loaded %d reads\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), n_seq);
+	memset(&mt_total, 0, sizeof(mm_metrics_t));
+	mt_total.c[MM_MC_READS] = n_seq;
+	for (i = 0; i < n_seq; ++i)
+		mt_total.c[MM_MC_BASES] += seq[i].l_seq;
+	mm_metrics_lap(&mt_total, MM_MT_PARSE, &t_mt);
+
+	mt = (mm_metrics_t*)malloc(shards->idx.n * sizeof(mm_metrics_t));
+	memcpy(mt, shards->mt.a, shards->idx.n * sizeof(mm_metrics_t)); // start from the loading time
+	for (i = 0; i < c->n_taxa; ++i)
+		c->taxa[i].cnt = 0, c->taxa[i].score = 0., c->taxa[i].hit = c->taxa[i].sel = 0;
+	if (mo->converge > 0 && mo->chunk_size > 0) {
+		int n_done = score_converge(c, shards, mo, n_seq, seq, mt, &n_sel);
+		t_mt = mm_metrics_clock();
+		if (mm_verbose >= 3)
+			fprintf(stderr, "[M::%s::%.3f*%.2f] containment search used %d of %d reads (%.2f%%)\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0),
+					n_done, n_seq, n_seq? 100.0 * n_done / n_seq : 0.0);
+	} else {
+		count_reads(c, shards, mo, n_seq, seq, mt);
+		t_mt = mm_metrics_clock();
+		n_sel = select_taxa(c, mo);
+	}
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] selected %d taxa\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), n_sel);
+	if (mo->fn_cs_out && write_containment(c, mo->fn_cs_out) < 0) {
+		fprintf(stderr, "[ERROR] failed to write '%s': %s\n", mo->fn_cs_out, strerror(errno));
+		ret = -1;
+	}
+
+	mm_metrics_lap(&mt_total, MM_MT_MERGE, &t_mt);
+
+	// read mapping against the selected references
+	ref = ret == 0 && n_sel > 0? build_reference(c, shards->idx.n, shards->idx.a, mo->ipt.w, mo->ipt.k) : 0;
+	mm_metrics_lap(&mt_total, MM_MT_INDEX, &t_mt);
+	if (ref) {
+		mm_mapopt_t opt = mo->opt; // mid_occ is derived from each subset index
+		mm_mapopt_update(&opt, ref);
+		memset(&mm_map_metrics, 0, sizeof(mm_metrics_t));
+		if (mo->fn_taxa && mm_idx_taxa_read(ref, mo->fn_taxa, mo->taxon_rank) < 0) {
+			fprintf(stderr, "[ERROR] failed to open file '%s': %s\n", mo->fn_taxa, strerror(errno));
+			ret = -1;
+		} else if (((mo->opt.flag & MM_F_OUT_HITS)? mm_write_hits_hdr(ref, 1) : mm_write_sam_hdr(ref, 0, MM_VERSION, argc, argv)) != 0) ret = -1;
+		else if (mm_map_seqs(ref, n_seq, seq, &opt, mo->n_threads) < 0) ret = -1;
+		mm_metrics_add(&mt_total, &mm_map_metrics);
+		mm_idx_destroy(ref);
+	} else if (ret == 0) {
+		if (mm_verbose >= 2)
+			fprintf(stderr, "[WARNING]\033[1;31m no reference passed the cutoff; nothing to map\033[0m\n");
+		if (((mo->opt.flag & MM_F_OUT_HITS)? mm_write_hits_hdr(0, 1) : mm_write_sam_hdr(0, 0, MM_VERSION, argc, argv)) != 0) ret = -1;
+	}
+
+	for (i = 0; i < n_seq; ++i) {
+		free(seq[i].seq); free(seq[i].name);
+		if (seq[i].qual) free(seq[i].qual);
+	}
+	free(seq);
+	if (fflush(stdout) == EOF) {
+		perror("[ERROR] failed to write the results");
+		ret = -1;
+	}
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] mapped %s; filter calls: %d\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), fn_reads, filter_calls);
+	for (i = 0; i < (int)shards->idx.n; ++i)
+		mm_metrics_add(&mt_total, &mt[i]);
+	if (mo->fn_metrics && mm_metrics_dump(mo->fn_metrics, &mt_total, shards->idx.n, shards->name.a, mt) < 0) {
+		fprintf(stderr, "[ERROR] failed to write '%s': %s\n", mo->fn_metrics, strerror(errno));
+		ret = -1;
+	}
+	free(mt);
+	return ret;
+}
+
+static char *read_request(int fd)
+{ // one newline-terminated job line; NULL on EOF
+	kvec_t(char) s = {0,0,0};
+	char ch;
+	ssize_t r;
+	while ((r = read(fd, &ch, 1)) == 1 && ch != '\n')
+		kv_push(char, 0, s, ch);
+	if (r < 0 || (r == 0 && s.n == 0)) { // a partial line is dropped if the client stalls
+		if (r < 0 && mm_verbose >= 2)
+			fprintf(stderr, "[WARNING] dropped a job request: %s\n", strerror(errno));
+		free(s.a);
+		return 0;
+	}
+	if (s.n > 0 && s.a[s.n-1] == '\r') --s.n;
+	kv_push(char, 0, s, 0);
+	return s.a;
+}
+
+static void run_job(int fd, const char *line, mf_catalog_t *c, const mf_shards_t *shards, const mf_opt_t *mo0)
+{ // called in a forked child: the resident shards are shared copy-on-write with the server
+	kvec_t(char*) av = {0,0,0};
+	mf_opt_t mo = *mo0;
+	char *s, *p;
+	int ind, ret = -1;
+	if (dup2(fd, STDOUT_FILENO) < 0) _exit(1);
+	close(fd);
+	kv_push(char*, 0, av, (char*)"metafast");
+	s = strdup(line);
+	for (p = strtok(s, "\t"); p; p = strtok(0, "\t")) // arguments are tab-separated so that paths may contain spaces
+		kv_push(char*, 0, av, p);
+	mo.fn_cs_out = 0, mo.fn_sock = 0, mo.fn_metrics = 0;
+	if (parse_opts(av.n, av.a, &mo, &ind) == 0 && (int)av.n - ind == 1)
+		ret = run_sample(c, shards, &mo, av.a[ind], av.n, av.a);
+	else fprintf(stderr, "[ERROR] malformed job '%s'; expected [options]<TAB><reads.fq>\n", line);
+	_exit(ret == 0? 0 : 1);
+}
+
+static int serve(const char *fn_sock, mf_catalog_t *c, const mf_shards_t *shards, const mf_opt_t *mo)
+{ // accept jobs on a UNIX socket and run at most mo->max_jobs of them at a time
+	struct sockaddr_un addr;
+	struct stat st;
+	struct timeval tv = { MF_REQUEST_TIMEOUT, 0 };
+	int fd, n_running = 0, n_jobs = 0;
+	if (strlen(fn_sock) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "[ERROR] socket path '%s' is too long\n", fn_sock);
+		return -1;
+	}
+	if (lstat(fn_sock, &st) == 0 && !S_ISSOCK(st.st_mode)) { // only a stale socket is removed
+		fprintf(stderr, "[ERROR] '%s' exists and is not a socket\n", fn_sock);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, fn_sock);
+	unlink(fn_sock);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+		fprintf(stderr, "[ERROR] failed to listen on '%s': %s\n", fn_sock, strerror(errno));
+		return -1;
+	}
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] listening on '%s' with up to %d concurrent job(s)\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), fn_sock, mo->max_jobs);
+	for (;;) {
+		char *line;
+		pid_t pid;
+		int cfd;
+		while (n_running > 0 && waitpid(-1, 0, WNOHANG) > 0) --n_running; // reap finished jobs
+		while (n_running >= mo->max_jobs && waitpid(-1, 0, 0) > 0) --n_running; // bound the memory used by jobs
+		if ((cfd = accept(fd, 0, 0)) < 0) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "[ERROR] accept() failed: %s\n", strerror(errno));
+			break;
+		}
+		setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)); // the job line is read here; a stalled client must not block the others
+		if ((line = read_request(cfd)) == 0) {
+			close(cfd);
+			continue;
+		}
+		if (strcmp(line, "shutdown") == 0) {
+			free(line);
+			close(cfd);
+			break;
+		}
+		fflush(stdout); fflush(stderr);
+		if ((pid = fork()) == 0) {
+			close(fd);
+			run_job(cfd, line, c, shards, mo);
+		}
+		if (pid < 0) fprintf(stderr, "[ERROR] fork() failed: %s\n", strerror(errno));
+		else ++n_running, ++n_jobs;
+		free(line);
+		close(cfd);
+	}
+	while (n_running > 0 && waitpid(-1, 0, 0) > 0) --n_running;
+	close(fd);
+	unlink(fn_sock);
+	if (mm_verbose >= 3)
+		fprintf(stderr, "[M::%s::%.3f*%.2f] served %d job(s)\n", __func__, realtime() - mm_realtime0, cputime() / (realtime() - mm_realtime0), n_jobs);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	mf_opt_t mo;
+	mf_catalog_t cat;
+	mf_shards_t shards;
+	size_t j;
+	int ind, n_pos, ret;
+
+	mm_verbose = 3;
+	mm_realtime0 = realtime();
+	filter_calls = 0;
+	filter = (char*)"base-counting";
+	mf_opt_init(&mo);
+	if (parse_opts(argc, argv, &mo, &ind) < 0) return 1;
+	n_pos = mo.fn_sock? 3 : 4;
+	if (argc - ind != n_pos || mo.help) {
+		FILE *fp_help = mo.help? stdout : stderr;
+		fprintf(fp_help, "Usage: metafast [options] <mmi_dir> <db_info> <translation> <reads.fq>\n");
+		fprintf(fp_help, "       metafast [options] --server=SOCKET <mmi_dir> <db_info> <translation>\n");
+		fprintf(fp_help, "<db_info> may be a catalog compiled by `metafast-db compile`, which replaces <translation>\n");
+		fprintf(fp_help, "Options:\n");
+		fprintf(fp_help, "  Reference selection:\n");
+		fprintf(fp_help, "    -c FLOAT     minimal normalized containment score [%g]\n", mo.cutoff);
+		fprintf(fp_help, "    -S           keep all strains above the cutoff (one per species by default)\n");
+		fprintf(fp_help, "    -C FILE      also write the containment results to FILE []\n");
+		fprintf(fp_help, "    --converge=INT  score reads in random chunks and stop once the selection has not\n");
+		fprintf(fp_help, "                 changed for INT chunks; 0 to score all reads [%d]\n", mo.converge);
+		fprintf(fp_help, "    --chunk-size=NUM  number of reads per chunk with --converge [%ld]\n", (long)mo.chunk_size);
+		fprintf(fp_help, "    --min-sample=NUM  score at least NUM reads with --converge [%ld]\n", (long)mo.min_sample);
+		fprintf(fp_help, "  Mapping:\n");
+		fprintf(fp_help, "    -n INT       number of candidate locations verified per read [%d]\n", mo.opt.min_cnt);
+		fprintf(fp_help, "    -r INT       edit distance threshold of the pre-alignment filter; the chaining\n");
+		fprintf(fp_help, "                 bandwidth with --long-read [%d, or 500 with --long-read]\n", mo.opt.bw);
+		fprintf(fp_help, "    --filter=STR pre-alignment filter [%s]\n", filter);
+		fprintf(fp_help, "    --band-vote[=INT] take candidates from diagonal bands of width INT [-r]\n");
+		fprintf(fp_help, "    --seed-evidence  decide candidates from their seeds where these suffice; filter the rest\n");
+		fprintf(fp_help, "    --taxa=FILE  stop verifying the candidates of a taxon once one passes; FILE\n");
+		fprintf(fp_help, "                 is usually <db_info> []\n");
+		fprintf(fp_help, "    --taxon-rank=INT  with --taxa, one taxon per clade at this lineage rank; 0 for TaxIDs [%d]\n", mo.taxon_rank);
+		fprintf(fp_help, "    --dedup[=INT] score reads equal up to reverse complement once and map identical\n");
+		fprintf(fp_help, "                 reads once; remember INT distinct reads across mapping batches [%d]\n", mo.opt.dedup_cache);
+		fprintf(fp_help, "    --long-read  chain the seeds and align the chains tile by tile instead of filtering\n");
+		fprintf(fp_help, "                 read-length windows\n");
+		fprintf(fp_help, "    --max-edit-frac=FLOAT  with --long-read, drop alignments with more than FLOAT\n");
+		fprintf(fp_help, "                 edits per aligned base [%g]\n", mo.opt.max_edit_frac);
+		fprintf(fp_help, "  Input/Output:\n");
+		fprintf(fp_help, "    -o FILE      output alignments to FILE [stdout]\n");
+		fprintf(fp_help, "    --hits-bin   output fixed-width binary records of the accepted locations instead of SAM\n");
+		fprintf(fp_help, "    -t INT       number of threads per sample [%d]\n", mo.n_threads);
+		fprintf(fp_help, "    --pipeline-depth=INT  mapping batches of a sample in flight; with 3 or more, the\n");
+		fprintf(fp_help, "                 output of a batch overlaps the mapping of the next ones [2]\n");
+		fprintf(fp_help, "    --metrics=FILE  write per-stage and per-shard timers and counters to FILE in JSON\n");
+		fprintf(fp_help, "  Server mode:\n");
+		fprintf(fp_help, "    --server=STR keep the shards loaded and accept jobs on UNIX socket STR []\n");
+		fprintf(fp_help, "                 a job is one line of tab-separated options ending with the reads\n");
+		fprintf(fp_help, "                 path; its SAM is streamed back on the same connection. The\n");
+		fprintf(fp_help, "                 line 'shutdown' stops the server\n");
+		fprintf(fp_help, "    -j INT       maximal number of concurrent jobs [%d]\n", mo.max_jobs);
+		return mo.help? 0 : 1;
+	}
+
+	// accession -> taxid and taxid -> lineage
+	memset(&cat, 0, sizeof(mf_catalog_t));
+	if (mf_db_is_db(argv[ind + 1])) { // compiled by metafast-db; <translation> is not read
+		if (catalog_read_db(&cat, argv[ind + 1]) < 0) {
+			fprintf(stderr, "[ERROR] failed to load the catalog '%s'\n", argv[ind + 1]);
+			return 1;
+		}
+	} else {
+		cat.taxid2id = kh_init(str);
+		cat.acc2id = kh_init(str);
+		if (catalog_read_translation(&cat, argv[ind + 2]) < 0 || catalog_read_dbinfo(&cat, argv[ind + 1]) < 0) {
+			fprintf(stderr, "[ERROR] failed to read the translation table or db_info: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+	// the shards stay resident: they are scored and then used for reference extraction
+	memset(&shards, 0, sizeof(mf_shards_t));
+	if (load_shards(argv[ind], mo.n_threads, &shards) < 0) return 1;
+
+	if (mo.fn_sock) ret = serve(mo.fn_sock, &cat, &shards, &mo);
+	else ret = run_sample(&cat, &shards, &mo, argv[ind + 3], argc, argv);
+
+	for (j = 0; j < shards.idx.n; ++j) {
+		mm_idx_destroy(shards.idx.a[j]);
+		free(shards.name.a[j]);
+	}
+	free(shards.idx.a); free(shards.name.a); free(shards.mt.a);
+	catalog_destroy(&cat);
+	if (mm_verbose >= 3) {
+		fprintf(stderr, "[M::%s] Version: %s\n", __func__, MM_VERSION);
+		fprintf(stderr, "[M::%s] Real time: %.3f sec; CPU: %.3f sec; Peak RSS: %.3f GB\n", __func__, realtime() - mm_realtime0, cputime(), peakrss() / 1024.0 / 1024.0 / 1024.0);
+	}
+	return ret == 0? 0 : 1;
+}
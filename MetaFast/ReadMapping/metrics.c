@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include "mmpriv.h"
+#include "metrics.h"
+
+int mm_metrics_on = 0;
+mm_metrics_t mm_map_metrics;
+
+static const char *mm_mt_name[MM_MT_N] = { "parse", "index_load", "sketch", "lookup", "candidates", "filter", "output", "merge" };
+static const char *mm_mc_name[MM_MC_N] = { "reads", "bases", "minimizers", "anchors", "candidates", "filter_calls", "filter_pass", "dedup", "seed_accept", "seed_reject" };
+
+double mm_metrics_clock(void)
+{
+	return mm_metrics_on? realtime() : 0.0;
+}
+
+void mm_metrics_lap(mm_metrics_t *m, int stage, double *t)
+{
+	double t1;
+	if (!mm_metrics_on) return;
+	t1 = realtime();
+	m->t[stage] += t1 - *t;
+	*t = t1;
+}
+
+void mm_metrics_add(mm_metrics_t *dst, const mm_metrics_t *src)
+{
+	int i;
+	for (i = 0; i < MM_MT_N; ++i) dst->t[i] += src->t[i];
+	for (i = 0; i < MM_MC_N; ++i) dst->c[i] += src->c[i];
+}
+
+void mm_metrics_write(FILE *fp, const mm_metrics_t *m)
+{
+	int i;
+	fputs("{\"time\":{", fp);
+	for (i = 0; i < MM_MT_N; ++i)
+		fprintf(fp, "%s\"%s\":%.6f", i? "," : "", mm_mt_name[i], m->t[i]);
+	fputs("},\"count\":{", fp);
+	for (i = 0; i < MM_MC_N; ++i)
+		fprintf(fp, "%s\"%s\":%llu", i? "," : "", mm_mc_name[i], (unsigned long long)m->c[i]);
+	fputs("}}", fp);
+}
+
+static void write_json_str(FILE *fp, const char *s)
+{ // s as a JSON string; shard names are file names, which may hold quotes or backslashes
+	fputc('"', fp);
+	for (; *s; ++s) {
+		unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\') fputc('\\', fp), fputc(c, fp);
+		else if (c < 0x20) fprintf(fp, "\\u%.4x", c);
+		else fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+int mm_metrics_dump(const char *fn, const mm_metrics_t *total, int n_shard, char *const *name, const mm_metrics_t *shard)
+{
+	FILE *fp;
+	int i;
+	if ((fp = fopen(fn, "w")) == 0) return -1;
+	fputs("{\"total\":", fp);
+	mm_metrics_write(fp, total);
+	fputs(",\"shards\":[", fp);
+	for (i = 0; i < n_shard; ++i) {
+		fprintf(fp, "%s\n{\"name\":", i? "," : "");
+		write_json_str(fp, name[i]);
+		fputs(",\"metrics\":", fp);
+		mm_metrics_write(fp, &shard[i]);
+		fputc('}', fp);
+	}
+	fputs("]}\n", fp);
+	return fclose(fp) == 0? 0 : -1;
+}
@@ -0,0 +1,86 @@
+#ifndef MM_METRICS_H
+#define MM_METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// pipeline stages; wall-clock time of each is summed over all threads
+enum {
+	MM_MT_PARSE = 0, // reading and parsing queries
+	MM_MT_INDEX,     // loading shard indexes
+	MM_MT_SKETCH,    // minimizer sketching
+	MM_MT_LOOKUP,    // index lookup of minimizers
+	MM_MT_CAND,      // candidate generation from seed hits
+	MM_MT_FILTER,    // pre-alignment filtering of candidates
+	MM_MT_OUTPUT,    // formatting and writing results
+	MM_MT_MERGE,     // merging results across shards or index parts
+	MM_MT_N
+};
+
+enum {
+	MM_MC_READS = 0,
+	MM_MC_BASES,
+	MM_MC_MINIMIZERS,
+	MM_MC_ANCHORS,
+	MM_MC_CANDIDATES,
+	MM_MC_FILTER_CALLS,
+	MM_MC_FILTER_PASS,
+	MM_MC_DEDUP,     // reads whose result was replayed from an identical read
+	MM_MC_SEED_ACCEPT, // candidates accepted from their seeds without the filter
+	MM_MC_SEED_REJECT, // candidates rejected from their seeds without the filter
+	MM_MC_N
+};
+
+typedef struct {
+	double t[MM_MT_N]; // in seconds
+	uint64_t c[MM_MC_N];
+} mm_metrics_t;
+
+extern int mm_metrics_on;           // collect timers; counters are always collected
+extern mm_metrics_t mm_map_metrics; // totals of mm_map_file*(), mm_map_seqs() and mm_split_merge()
+
+/**
+ * Start a timer
+ *
+ * @return current wall-clock time, or 0 if mm_metrics_on is not set
+ */
+double mm_metrics_clock(void);
+
+/**
+ * Charge the time elapsed since *t to a stage and restart the timer
+ *
+ * @param m      metrics owned by the calling thread
+ * @param stage  one of MM_MT_*
+ * @param t      timer returned by mm_metrics_clock(); updated in place
+ */
+void mm_metrics_lap(mm_metrics_t *m, int stage, double *t);
+
+void mm_metrics_add(mm_metrics_t *dst, const mm_metrics_t *src);
+
+/**
+ * Write metrics as a JSON object, without a trailing newline
+ */
+void mm_metrics_write(FILE *fp, const mm_metrics_t *m);
+
+/**
+ * Write the JSON report of a run
+ *
+ * @param fn       output file name
+ * @param total    metrics aggregated over all shards
+ * @param n_shard  number of shards
+ * @param name     shard names
+ * @param shard    per-shard metrics
+ *
+ * @return 0 on success; -1 if fn can't be written
+ */
+int mm_metrics_dump(const char *fn, const mm_metrics_t *total, int n_shard, char *const *name, const mm_metrics_t *shard);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "ketopt.h"
+#include "catalog.h"
+
+/*
+ * metafast-db: compile the text metadata of a database (db_info, translation
+ * table, organism file names) into one catalog that cs, rm, metafast and the
+ * Python scripts map into memory instead of parsing the text on every run.
+ */
+
+static int main_compile(int argc, char *argv[])
+{
+	ketopt_t o = KETOPT_INIT;
+	const char *fn_out = 0, *fn_tr = 0, *dir_org = 0;
+	int c;
+	while ((c = ketopt(&o, argc, argv, 1, "o:t:d:", 0)) >= 0) {
+		if (c == 'o') fn_out = o.arg;
+		else if (c == 't') fn_tr = o.arg;
+		else if (c == 'd') dir_org = o.arg;
+	}
+	if (argc - o.ind != 1 || fn_out == 0) {
+		fprintf(stderr, "Usage: metafast-db compile [options] -o <out%s> <db_info>\n", MF_DB_SUFFIX);
+		fprintf(stderr, "Options:\n");
+		fprintf(stderr, "  -t FILE    translation table '<accession> <taxid>'; takes precedence over the TaxID column []\n");
+		fprintf(stderr, "  -d DIR     directory of the taxid_<TaxID>_genomic.fna.gz organism files []\n");
+		return 1;
+	}
+	if (mf_db_compile(fn_out, argv[o.ind], fn_tr, dir_org) < 0) {
+		fprintf(stderr, "[ERROR] failed to compile '%s' into '%s': %s\n", argv[o.ind], fn_out, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+static int main_view(int argc, char *argv[])
+{ // prints the catalog back in the db_info format, followed by the organism file of each accession
+	mf_db_t *db;
+	uint32_t i;
+	if (argc != 2) {
+		fprintf(stderr, "Usage: metafast-db view <catalog%s>\n", MF_DB_SUFFIX);
+		return 1;
+	}
+	if ((db = mf_db_load(argv[1])) == 0) {
+		fprintf(stderr, "[ERROR] '%s' is not a catalog\n", argv[1]);
+		return 1;
+	}
+	printf("Accesion\tLength\tTaxID\tLineage\tTaxID_Lineage\tFile\n");
+	for (i = 0; i < db->n_acc; ++i) {
+		const mf_db_acc_t *a = &db->acc[i];
+		const mf_db_taxon_t *t = &db->taxa[a->taxon];
+		printf("%s\t%llu\t%s\t%s\t%s\t%s\n", mf_db_str(db, a->name), (unsigned long long)a->len, mf_db_str(db, t->taxid),
+			   mf_db_str(db, t->name_lin), mf_db_str(db, t->tax_lin), mf_db_str(db, t->file));
+	}
+	mf_db_destroy(db);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: metafast-db <command> <arguments>\n");
+		fprintf(stderr, "Commands:\n");
+		fprintf(stderr, "  compile    compile db_info and the translation table into a catalog\n");
+		fprintf(stderr, "  view       print a catalog in the db_info format\n");
+		return 1;
+	}
+	if (strcmp(argv[1], "compile") == 0) return main_compile(argc - 1, argv + 1);
+	if (strcmp(argv[1], "view") == 0) return main_view(argc - 1, argv + 1);
+	fprintf(stderr, "[ERROR] unknown command '%s'\n", argv[1]);
+	return 1;
+}
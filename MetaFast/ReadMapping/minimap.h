@@ -36,6 +36,12 @@
 #define MM_F_NO_END_FLT    0x10000000
 #define MM_F_HARD_MLEVEL   0x20000000
 #define MM_F_SAM_HIT_ONLY  0x40000000
+#define MM_F_DEDUP         0x80000000LL // map identical reads once and replay the result
+#define MM_F_BAND_VOTE     0x100000000LL // candidates from diagonal-band voting instead of runs of equal diagonals
+#define MM_F_TAXON_ONCE    0x200000000LL // verify candidates of a taxon until one passes; see mm_idx_taxa_read()
+#define MM_F_OUT_HITS      0x400000000LL // write fixed-width binary records instead of SAM/PAF; see mm_hit_rec_t
+#define MM_F_LONG_READ     0x800000000LL // chain the seeds and align the chains tile by tile instead of filtering read-length windows
+#define MM_F_SEED_EVIDENCE 0x1000000000LL // accept or reject candidates from their anchors when these decide; filter only the others
 
 #define MM_I_HPC          0x1
 #define MM_I_NO_SEQ       0x2
@@ -60,6 +66,7 @@ typedef struct {
 	uint64_t offset; // offset in mm_idx_t::S
 	uint32_t len;    // length
 	uint32_t is_alt;
+	int32_t taxon;   // taxon group set by mm_idx_taxa_read(); -1 if unknown
 } mm_idx_seq_t;
 
 typedef struct {
@@ -71,6 +78,8 @@ typedef struct {
 	uint32_t *S;               // 4-bit packed sequence
 	struct mm_idx_bucket_s *B; // index (hidden)
 	struct mm_idx_intv_s *I;   // intervals (hidden)
+	struct mm_idx_pack_s *P;   // packed index built by mm_idx_pack() (hidden)
+	uint32_t pos_bits;         // if P is set, positions are packed as rid<<pos_bits | pos<<1 | strand
 	void *km, *h;
 } mm_idx_t;
 
@@ -94,12 +103,37 @@ typedef struct {
 	int32_t mlen, blen;     // seeded exact match length; seeded alignment block length
 	int32_t n_sub;          // number of suboptimal mappings
 	int32_t score0;         // initial chaining score (before chain merging/spliting)
-	uint32_t mapq:8, split:2, rev:1, inv:1, sam_pri:1, proper_frag:1, pe_thru:1, seg_split:1, seg_id:8, split_inv:1, is_alt:1, dummy:6;
+	uint32_t mapq:8, split:2, rev:1, inv:1, sam_pri:1, proper_frag:1, pe_thru:1, seg_split:1, seg_id:8, split_inv:1, is_alt:1, tiled:1, dummy:5; // tiled: p->cigar is a full alignment (MM_F_LONG_READ)
 	uint32_t hash;
 	float div;
 	mm_extra_t *p;
 } mm_reg1_t;
 
+/*
+ * Binary hit stream (MM_F_OUT_HITS), in the byte order of the host. It starts
+ * with the magic "MMH\1", followed by blocks led by mm_hit_blk_t:
+ *
+ *   MM_HIT_REFS: n reference sequences, each as uint32_t len, uint32_t l_name
+ *                and l_name bytes of the name; rid in later records indexes
+ *                the last such block (one per index part)
+ *   MM_HIT_RECS: n mm_hit_rec_t records, one per accepted location
+ */
+#define MM_HIT_MAGIC "MMH\1"
+#define MM_HIT_REFS  1
+#define MM_HIT_RECS  2
+
+typedef struct {
+	uint32_t type, n;
+} mm_hit_blk_t;
+
+typedef struct {
+	uint64_t qid;            // index of the read in the input, from 0
+	int32_t rid, pos;        // reference index; 0-based start on the reference
+	int32_t edits, qlen;     // edits reported by the filter, or -1 if unknown; read length
+	uint16_t flag, mapq;     // SAM FLAG bits 0x1, 0x2, 0x10, 0x40, 0x80, 0x100 and 0x800; mapping quality
+	uint32_t dummy;
+} mm_hit_rec_t;              // 32 bytes
+
 // indexing and mapping options
 typedef struct {
 	short k, w, flag, bucket_bits;
@@ -142,6 +176,7 @@ typedef struct {
 	int min_ksw_len;
 	int anchor_ext_len, anchor_ext_shift;
 	float max_clip_ratio; // drop an alignment if BOTH ends are clipped above this ratio
+	float max_edit_frac;  // with MM_F_LONG_READ, drop an alignment with more edits per aligned base
 
 	int pe_ori, pe_bonus;
 
@@ -151,6 +186,9 @@ typedef struct {
 	int32_t max_occ;
 	int64_t mini_batch_size; // size of a batch of query bases to process in parallel
 	int64_t max_sw_mat;
+	int32_t dedup_cache; // with MM_F_DEDUP, number of distinct reads remembered across batches
+	int32_t band_w;      // with MM_F_BAND_VOTE, width of the diagonal bands; 0 for the edit distance threshold (-r)
+	int32_t pipeline_depth; // mini-batches in flight, each read, mapped and written in turn; 0 for 2, or 3 with MM_F_2_IO_THREADS
 
 	const char *split_prefix;
 } mm_mapopt_t;
@@ -289,6 +327,21 @@ mm_idx_t *mm_idx_str(int w, int k, int is_hpc, int bucket_bits, int n, const cha
  */
 void mm_idx_stat(const mm_idx_t *idx);
 
+/**
+ * Replace the hash tables of an index with a packed, read-only layout
+ *
+ * Minimizers are kept as sorted 32-bit keys per bucket and positions as
+ * 32-bit integers, which takes about half of the memory of the hash tables
+ * for small genomes. mm_idx_get() looks up either layout; a packed index
+ * can't be dumped.
+ *
+ * @param mi         minimap2 index
+ *
+ * @return 0 if packed; -1 if the sequences are too many or too long for
+ *         32-bit positions, in which case mi is left untouched
+ */
+int mm_idx_pack(mm_idx_t *mi);
+
 /**
  * Destroy/deallocate an index
  *
@@ -375,6 +428,18 @@ int mm_idx_name2id(const mm_idx_t *mi, const char *name);
 int mm_idx_getseq(const mm_idx_t *mi, uint32_t rid, uint32_t st, uint32_t en, uint8_t *seq);
 
 int mm_idx_alt_read(mm_idx_t *mi, const char *fn);
+
+/**
+ * Group the reference sequences by taxon
+ *
+ * @param mi     minimap2 index
+ * @param fn     db_info table: accession, length, TaxID, lineage and TaxID lineage per line
+ * @param rank   0 to group by TaxID; otherwise by the first rank clades of the
+ *               TaxID lineage (e.g. 7 for species with a domain|...|species lineage)
+ *
+ * @return number of sequences assigned to a taxon; -1 if fn can't be opened
+ */
+int mm_idx_taxa_read(mm_idx_t *mi, const char *fn, int rank);
 int mm_idx_bed_read(mm_idx_t *mi, const char *fn, int read_junc);
 int mm_idx_bed_junc(const mm_idx_t *mi, int32_t ctg, int32_t st, int32_t en, uint8_t *s);
 
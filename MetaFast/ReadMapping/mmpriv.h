@@ -58,12 +58,24 @@ void mm_write_paf3(kstring_t *s, const mm_idx_t *mi, const mm_bseq1_t *t, const
 void mm_write_sam(kstring_t *s, const mm_idx_t *mi, const mm_bseq1_t *t, const mm_reg1_t *r, int n_regs, const mm_reg1_t *regs, int Edits_total);
 void mm_write_sam2(kstring_t *s, const mm_idx_t *mi, const mm_bseq1_t *t, int seg_idx, int reg_idx, int n_seg, const int *n_regs, const mm_reg1_t *const* regs, void *km, int opt_flag, int Edits_total);
 void mm_write_sam3(kstring_t *s, const mm_idx_t *mi, const mm_bseq1_t *t, int seg_idx, int reg_idx, int n_seg, const int *n_regss, const mm_reg1_t *const* regss, void *km, int opt_flag, int rep_len, int Edits_total);
+int mm_write_hits_hdr(const mm_idx_t *mi, int with_magic);
+void mm_hit_rec_set(mm_hit_rec_t *h, const mm_bseq1_t *t, int seg_idx, int n_seg, const mm_reg1_t *r);
+void mm_write_hits(int n, const mm_hit_rec_t *h);
 
 void mm_idxopt_init(mm_idxopt_t *opt);
-const uint64_t *mm_idx_get(const mm_idx_t *mi, uint64_t minier, int *n);
+const void *mm_idx_get(const mm_idx_t *mi, uint64_t minier, int *n);
 int32_t mm_idx_cal_max_occ(const mm_idx_t *mi, float f);
+
+static inline uint64_t mm_idx_hit(const mm_idx_t *mi, const void *cr, int i)
+{ // i-th position of mm_idx_get() as rid<<32 | pos<<1 | strand, unpacked if the index is packed
+	uint32_t x;
+	if (mi->P == 0) return ((const uint64_t*)cr)[i];
+	x = ((const uint32_t*)cr)[i];
+	return (uint64_t)(x >> mi->pos_bits) << 32 | (x & ((1U << mi->pos_bits) - 1));
+}
 mm128_t *mm_chain_dp(int max_dist_x, int max_dist_y, int bw, int max_skip, int max_iter, int min_cnt, int min_sc, float gap_scale, int is_cdna, int n_segs, int64_t n, mm128_t *a, int *n_u_, uint64_t **_u, void *km);
 mm_reg1_t *mm_align_skeleton(void *km, const mm_mapopt_t *opt, const mm_idx_t *mi, int qlen, const char *qstr, int *n_regs_, mm_reg1_t *regs, mm128_t *a);
+mm_reg1_t *mm_align_tiled(void *km, const mm_mapopt_t *opt, const mm_idx_t *mi, int qlen, const char *qstr, int *n_regs_, mm_reg1_t *regs, mm128_t *a, uint64_t *n_aligned); // long reads; MM_F_LONG_READ
 
 mm_reg1_t *mm_gen_regs(void *km, uint32_t hash, int qlen, int n_u, uint64_t *u, mm128_t *a);
 void mm_mark_alt(const mm_idx_t *mi, int n, mm_reg1_t *r);
@@ -90,6 +102,9 @@ mm_idx_t *mm_split_merge_prep(const char *prefix, int n_splits, FILE **fp, uint3
 int mm_split_merge(int n_segs, const char **fn, const mm_mapopt_t *opt, int n_split_idx);
 void mm_split_rm_tmp(const char *prefix, int n_splits);
 
+// map reads that are already in memory; seq[] is left allocated (paired-end mates are reverse-complemented in place and restored)
+int mm_map_seqs(const mm_idx_t *idx, int n_seq, mm_bseq1_t *seq, const mm_mapopt_t *opt, int n_threads);
+
 void mm_err_puts(const char *str);
 void mm_err_fwrite(const void *p, size_t size, size_t nitems, FILE *fp);
 void mm_err_fread(void *p, size_t size, size_t nitems, FILE *fp);
@@ -45,7 +45,9 @@ void mm_mapopt_init(mm_mapopt_t *opt)
 	opt->min_ksw_len = 200;
 	opt->anchor_ext_len = 20, opt->anchor_ext_shift = 6;
 	opt->max_clip_ratio = 1.0f;
+	opt->max_edit_frac = 0.25f;
 	opt->mini_batch_size = 500000000;
+	opt->dedup_cache = 100000;
 
 	opt->pe_ori = 0; // FF
 	opt->pe_bonus = 33;
@@ -90,10 +92,13 @@ int mm_set_opt(const char *preset, mm_idxopt_t *io, mm_mapopt_t *mo)
 		//mo->occ_dist = 500;
 		//mo->min_mid_occ = 50, mo->max_mid_occ = 500;
 		mo->min_dp_max = 200;
+		mo->flag |= MM_F_LONG_READ;
 	} else if (strcmp(preset, "map10k") == 0 || strcmp(preset, "map-pb") == 0) {
 		io->flag |= MM_I_HPC, io->k = 19;
+		mo->flag |= MM_F_LONG_READ;
 	} else if (strcmp(preset, "map-ont") == 0) {
 		io->flag = 0, io->k = 15;
+		mo->flag |= MM_F_LONG_READ;
 	} else if (strcmp(preset, "asm5") == 0) {
 		io->flag = 0, io->k = 19, io->w = 19;
 		mo->a = 1, mo->b = 19, mo->q = 39, mo->q2 = 81, mo->e = 3, mo->e2 = 1, mo->zdrop = mo->zdrop_inv = 200;
@@ -2,6 +2,7 @@ from libc.stdint cimport uint8_t, int8_t
 from libc.stdlib cimport free
 cimport cmappy
 import sys
+import struct
 
 __version__ = '2.17'
 
@@ -260,6 +261,30 @@ def fastx_read(fn, read_comment=False):
 			yield name, seq, qual
 	cmappy.mm_fastx_close(ks)
 
+HIT_DTYPE = [('qid', '=u8'), ('rid', '=i4'), ('pos', '=i4'), ('edits', '=i4'), ('qlen', '=i4'), ('flag', '=u2'), ('mapq', '=u2'), ('dummy', '=u4')]
+
+def hits_read(fn):
+	with open(fn, 'rb') as fp:
+		if fp.read(4) != b'MMH\1':
+			raise ValueError("not a --hits-bin stream")
+		refs = []
+		while True:
+			h = fp.read(8)
+			if len(h) < 8: break
+			t, n = struct.unpack('=II', h)
+			if t == 1: # MM_HIT_REFS
+				refs = []
+				for i in range(n):
+					l, l_name = struct.unpack('=II', fp.read(8))
+					refs.append((fp.read(l_name).decode(), l))
+			elif t == 2: # MM_HIT_RECS
+				buf = fp.read(n * 32)
+				if len(buf) < n * 32:
+					raise ValueError("truncated --hits-bin stream")
+				yield refs, memoryview(buf)
+			else:
+				raise ValueError("unknown block type {}".format(t))
+
 def revcomp(seq):
 	l = len(seq)
 	bseq = seq if isinstance(seq, bytes) else seq.encode()
@@ -35,6 +35,10 @@ def metalign_parseargs():  # handle user arguments
 	parser.add_argument('--translation',  default = 'AUTO', help='Accession to taxid for subset DB generation')
 	parser.add_argument('--filter', default = 'base-counting', choices=['adjacency-filter', 'base-counting', 'edlib', 'grim_original', 'grim_original_tweak', 'hd', 'magnet', 'qgram', 'shd', 'shouji', 'sneakysnake'], help='algorithm for read mapping')
 	parser.add_argument('--edit_dist_threshold', type=int, default=15, help='-r edit distance threshold for minimap2.')
+	parser.add_argument('--taxon_once', action='store_true', help='Stop verifying the candidate locations of a read on a taxon once one passes the filter.')
+	parser.add_argument('--seed_evidence', action='store_true', help='Accept or reject the candidate locations whose seeds decide them without running the filter.')
+	parser.add_argument('--fused', action='store_true', help='Run containment search and read mapping in one metafast process, without intermediate files.')
+	parser.add_argument('--server', default='NONE', help='Submit the sample to a running `metafast --server` on this UNIX socket (implies --fused).')
 	args = parser.parse_args()
 	return args
 
@@ -79,7 +83,16 @@ def main():
 	args.infiles = [args.reads]  # read_mapping expects a list
 
 	# Run the database selection and map/profile routines
-	select.select_main(args)  # runs containment_search routine
+	if args.server != 'NONE':  # the server already holds the shards and translation table
+		args.fused = True
+	elif args.fused and (args.mmi_dir == 'AUTO' or args.translation == 'AUTO'):
+		sys.exit('--fused requires --mmi_dir and --translation.')
+	if args.fused:  # metafast selects references and maps in memory
+		args.dbinfo = args.dbinfo_in
+		if not os.path.exists(args.temp_dir):
+			os.makedirs(args.temp_dir)
+	else:
+		select.select_main(args)  # runs containment_search routine
 	mapper.map_main(args)  # runs read_mapping routine
 	if not args.keep_temp_files:  # clean up
 		subprocess.Popen(['rm', '-r', args.temp_dir]).wait()
@@ -0,0 +1,164 @@
+#! /usr/bin/env python
+# End-to-end benchmark on a simulated community: times every stage and the full pipeline and scores the profiles
+# against the simulated abundances. Run from a directory next to MetaFast/, as the other scripts.
+import argparse, json, os, subprocess, sys, time
+import mfdb
+
+
+SCRIPTS = '../MetaFast/Scripts/'
+RANKS = ['superkingdom', 'phylum', 'class', 'order', 'family', 'genus', 'species', 'strain']
+
+
+def bench_parseargs():  # handle user arguments
+	parser = argparse.ArgumentParser(description='Benchmarks the MetaFast stages on a simulated community.')
+	parser.add_argument('data', help='Path to data/ directory with organism_files/ and db_info.txt')
+	parser.add_argument('--mmi_dir', default='AUTO', help='Directory containing all mmi-files. Default: data/, or built with cs build-db if --translation is missing.')
+	parser.add_argument('--translation', default='AUTO', help='Accession to taxid table. Default: data/translate/translate_sorted.csv')
+	parser.add_argument('--out_dir', default='Results/Benchmark', help='Directory for reads, intermediate files and results. Default: Results/Benchmark')
+	parser.add_argument('--output', default='AUTO', help='JSON report. Default: out_dir/bench.json')
+	parser.add_argument('--organisms', type=int, default=0, help='Number of organisms in the community. Default: 0 (all organism files).')
+	parser.add_argument('--reads', type=int, default=100000, help='Number of reads. Default: 100000')
+	parser.add_argument('--read_len', type=int, default=150, help='Read length. Default: 150')
+	parser.add_argument('--error_rate', type=float, default=0.01, help='Substitution probability of every read position. Default: 0.01')
+	parser.add_argument('--seed', type=int, default=1, help='Seed of the simulation. Default: 1')
+	parser.add_argument('--threads', type=int, default=4, help='Number of compute threads. Default: 4')
+	parser.add_argument('--minimap_n', type=int, default=3)
+	parser.add_argument('--filter', default='base-counting', choices=['adjacency-filter', 'base-counting', 'edlib', 'grim_original', 'grim_original_tweak', 'hd', 'magnet', 'qgram', 'shd', 'shouji', 'sneakysnake'])
+	parser.add_argument('--edit_dist_threshold', type=int, default=15, help='-r edit distance threshold for minimap2.')
+	parser.add_argument('--rank', default='species', choices=RANKS, help='Rank at which the profiles are scored. Default: species')
+	parser.add_argument('--fused', action='store_true', help='Run the full pipeline with MetaFast.py --fused.')
+	args = parser.parse_args()
+	return args
+
+
+# Runs one stage; wall and CPU time and peak RSS cover the stage and all its child processes
+def run_stage(name, command, stdout=None):
+	print('[bench] ' + name + ': ' + ' '.join(command))
+	sys.stdout.flush()
+	start = time.time()
+	proc = subprocess.Popen(command, stdout=stdout)
+	pid, status, usage = os.wait4(proc.pid, 0)
+	proc.returncode = os.waitstatus_to_exitcode(status)
+	wall = time.time() - start
+	if proc.returncode != 0:
+		sys.exit('Error: stage ' + name + ' failed with exit code ' + str(proc.returncode))
+	return {'wall_s': round(wall, 3), 'cpu_s': round(usage.ru_utime + usage.ru_stime, 3),
+		'peak_rss_mb': round(usage.ru_maxrss / 1024.0, 1)}  # ru_maxrss is in kB on Linux
+
+
+def read_lineages(fn):  # TaxID -> TaxID_Lineage from db_info or its catalog
+	taxid2lin = {}
+	if mfdb.is_catalog(fn):
+		db = mfdb.Catalog(fn)
+		for i in range(db.n_taxa):
+			taxon = db.taxon(i)
+			taxid2lin[taxon.taxid] = taxon.tax_lin
+		db.close()
+		return taxid2lin
+	with(open(fn, 'r')) as infile:
+		infile.readline()  # skip header line
+		for line in infile:
+			splits = line.strip().split('\t')
+			if len(splits) >= 5:
+				taxid2lin[splits[2]] = splits[4]
+	return taxid2lin
+
+
+def read_truth(args, taxid2lin):  # abundances of the simulated organisms, summed up at args.rank
+	truth, level = {}, RANKS.index(args.rank)
+	with(open(args.truth, 'r')) as infile:
+		infile.readline()  # skip header line
+		for line in infile:
+			taxid, reads, abundance = line.strip().split('\t')
+			lineage = taxid2lin.get(taxid, '').split('|')
+			clade = lineage[level] if level < len(lineage) else ''
+			if clade != '':  # organisms without a label at the rank can't be profiled at it either
+				truth[clade] = truth.get(clade, 0.0) + float(abundance)
+	return truth
+
+
+def read_profile(fn, rank):  # TaxID -> abundance of the CAMI profile lines at rank
+	profile = {}
+	with(open(fn, 'r')) as infile:
+		for line in infile:
+			splits = line.strip().split('\t')
+			if line.startswith('@') or len(splits) < 5 or splits[1] != rank:
+				continue
+			profile[splits[0]] = float(splits[4]) / 100.0
+	return profile
+
+
+def score_profile(truth, profile):
+	tp = len([t for t in profile if t in truth])
+	l1 = sum([abs(profile.get(t, 0.0) - truth.get(t, 0.0)) for t in set(truth) | set(profile)])
+	return {'l1': round(l1, 5), 'precision': round(tp / float(max(len(profile), 1)), 5),
+		'recall': round(tp / float(max(len(truth), 1)), 5), 'true_taxa': len(truth), 'profiled_taxa': len(profile)}
+
+
+def bench_main(args = None):
+	if args == None:
+		args = bench_parseargs()
+	if not args.data.endswith('/'):
+		args.data += '/'
+	if not args.out_dir.endswith('/'):
+		args.out_dir += '/'
+	if not os.path.exists(args.out_dir):
+		os.makedirs(args.out_dir)
+	if args.output == 'AUTO':
+		args.output = args.out_dir + 'bench.json'
+	args.dbinfo = args.data + 'db_info.txt'
+	if not os.path.exists(args.dbinfo):
+		sys.exit('Error: ' + args.dbinfo + ' not found; the profiles need the lineages of the database.')
+	args.reads_file, args.truth = args.out_dir + 'reads.fq', args.out_dir + 'truth.tsv'
+	py = sys.executable
+	stages = {}
+	report = {'community': {'organisms': args.organisms, 'reads': args.reads, 'read_len': args.read_len,
+		'error_rate': args.error_rate, 'seed': args.seed}, 'threads': args.threads, 'filter': args.filter,
+		'edit_dist_threshold': args.edit_dist_threshold, 'rank': args.rank, 'stages': stages}
+
+	stages['simulate'] = run_stage('simulate', [py, SCRIPTS + 'simulate_community.py', args.data + 'organism_files/',
+		'--organisms', str(args.organisms), '--reads', str(args.reads), '--read_len', str(args.read_len),
+		'--error_rate', str(args.error_rate), '--seed', str(args.seed), '--output', args.reads_file, '--truth', args.truth])
+	if args.translation == 'AUTO':
+		args.translation = args.data + 'translate/translate_sorted.csv'
+	if args.mmi_dir == 'AUTO':
+		args.mmi_dir = args.data
+	if not os.path.exists(args.translation):  # no prebuilt shards: index the organism files first
+		args.mmi_dir = args.out_dir + 'db/'
+		args.translation = args.mmi_dir + 'translate_sorted.csv'
+		stages['build_db'] = run_stage('build_db', ['../MetaFast/ContainmentSearch/cs', 'build-db', '-t', str(args.threads),
+			args.data + 'organism_files/', args.mmi_dir])
+
+	# the three stages one after the other, as ReproducibleEvaluation/MetaFast-Stages.sh runs them
+	cs_dir = args.out_dir + 'ContainmentSearch/'
+	stages['containment_search'] = run_stage('containment_search', [py, SCRIPTS + 'containment_search.py', args.reads_file,
+		args.data, '--mmi_dir', args.mmi_dir, '--translation', args.translation, '--temp_dir', cs_dir, '--keep_temp_files',
+		'--threads', str(args.threads), '--minimap_n', str(args.minimap_n)])
+	with(open(args.out_dir + 'mapped.sam', 'w')) as samfile:
+		stages['read_mapping'] = run_stage('read_mapping', ['../MetaFast/ReadMapping/rm', '-ax', 'sr', '-t', str(args.threads),
+			'-2', '-n', str(args.minimap_n), '-r', str(args.edit_dist_threshold), '--filter=' + args.filter, '--secondary=yes',
+			cs_dir + 'subset_db.fna', args.reads_file], stdout=samfile)
+	stages['profiling'] = run_stage('profiling', [py, SCRIPTS + 'read_mapping.py', args.out_dir + 'mapped.sam', args.data,
+		'--input_type', 'sam', '--dbinfo', cs_dir + 'subset_db_info.txt', '--output', args.out_dir + 'profile_stages.tsv'])
+
+	pipeline = [py, SCRIPTS + 'MetaFast.py', args.reads_file, args.data, '--mmi_dir', args.mmi_dir, '--translation',
+		args.translation, '--temp_dir', args.out_dir + 'MetaFast/', '--threads', str(args.threads), '--minimap_n',
+		str(args.minimap_n), '--filter', args.filter, '--edit_dist_threshold', str(args.edit_dist_threshold),
+		'--output', args.out_dir + 'profile.tsv']
+	stages['pipeline'] = run_stage('pipeline', pipeline + (['--fused'] if args.fused else []))
+
+	for name, stage in stages.items():
+		if name != 'build_db':  # indexing doesn't depend on the reads
+			stage['reads_per_s'] = round(args.reads / max(stage['wall_s'], 1e-3), 1)
+	truth = read_truth(args, read_lineages(args.dbinfo))
+	stages['profiling']['accuracy'] = score_profile(truth, read_profile(args.out_dir + 'profile_stages.tsv', args.rank))
+	stages['pipeline']['accuracy'] = score_profile(truth, read_profile(args.out_dir + 'profile.tsv', args.rank))
+	with(open(args.output, 'w')) as outfile:
+		json.dump(report, outfile, indent=2)
+		outfile.write('\n')
+	print(json.dumps(report, indent=2))
+
+
+if __name__ == '__main__':
+	args = bench_parseargs()
+	bench_main(args)
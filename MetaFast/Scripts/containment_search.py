@@ -1,5 +1,6 @@
 #! /usr/bin/env python
 import argparse, math, os, subprocess, sys, tempfile, shutil
+import mfdb
 
 
 def select_parseargs():    # handle user arguments
@@ -10,7 +11,7 @@ def select_parseargs():    # handle user arguments
 	parser.add_argument('--cutoff', type=int, default=0.0001, help='Seed count cutoff value. Default is 0.0001.')
 	parser.add_argument('--db', default='AUTO', help='Where to write subset database. Default: temp_dir/subset_db.fna')
 	parser.add_argument('--db_dir', default='AUTO', help='Directory with all organism files in the full database.')
-	parser.add_argument('--dbinfo_in', default='AUTO', help='Specify location of db_info file. Default is data/db_info.txt')
+	parser.add_argument('--dbinfo_in', default='AUTO', help='Specify location of db_info file or of its catalog from metafast-db compile. Default is data/db_info.txt')
 	parser.add_argument('--dbinfo_out', default='AUTO',
 		help='Where to write subset db_info. Default: temp_dir/subset_db_info.txt')
 	parser.add_argument('--input_type', default='AUTO', choices=['fastq', 'fasta', 'AUTO'],
@@ -25,12 +26,24 @@ def select_parseargs():    # handle user arguments
 	parser.add_argument('--translation',  default = 'AUTO', help='Accession to taxid for subset DB generation')
 	parser.add_argument('--filter', default='base-counting', choices=['adjacency-filter', 'base-counting', 'edlib', 'grim_original', 'grim_original_tweak', 'hd', 'magnet', 'qgram', 'shd', 'shouji', 'sneakysnake'])
 	parser.add_argument('--edit_dist_threshold', type=int, default=15, help='-r edit distance threshold for minimap2.')
+	parser.add_argument('--sketch', action='store_true', help='Estimate containment from FracMinHash sketches next to the mmi-files (cs --build-sketch) instead of seeding the reads.')
+	parser.add_argument('--prune', type=float, default=0.0, help='Skip mmi-files with a smaller estimated fraction of minimizers in the reads before seeding. Default: 0 (seed every file).')
 	args = parser.parse_args()
 	return args
 
 
 def read_dbinfo(args):
 	taxid2info = {}
+	if mfdb.is_catalog(args.dbinfo_in):  # compiled by metafast-db; no text to parse
+		db = mfdb.Catalog(args.dbinfo_in)
+		for acc, acclen, i in db.accessions():
+			taxon = db.taxon(i)
+			if taxon.taxid not in taxid2info:
+				taxid2info[taxon.taxid] = [[acc], str(taxon.length), taxon.name_lin, taxon.tax_lin]
+			else:
+				taxid2info[taxon.taxid][0].append(acc)
+		db.close()
+		return taxid2info
 	with(open(args.dbinfo_in, 'r')) as infile:
 		infile.readline()  # skip header line
 		for line in infile:
@@ -44,9 +57,19 @@ def read_dbinfo(args):
 				taxid2info[taxid][0].append(acc)
 	return taxid2info
 
+def organism_taxid(args, organism):
+	if mfdb.is_catalog(args.dbinfo_in):  # organism files are indexed in the catalog when compiled with -d
+		db = mfdb.Catalog(args.dbinfo_in)
+		i = db.file2taxon(organism)
+		taxid = db.taxon(i).taxid if i >= 0 else None
+		db.close()
+		if taxid is not None:
+			return taxid
+	return organism.split('taxid_')[1].split('_genomic.fna')[0].replace('_', '.')
+
 def run_minimap_and_cutoff(args, taxid2info):
 	if args.metalign_results == 'NONE':
-		seed_count = subprocess.check_output(["../MetaFast/ContainmentSearch/cs", "-n", str(args.minimap_n), args.mmi_dir, 
+		seed_count = subprocess.check_output(["../MetaFast/ContainmentSearch/cs", "-n", str(args.minimap_n)] + (["--sketch"] if getattr(args, 'sketch', False) else []) + (["--prune", str(args.prune)] if getattr(args, 'prune', 0.0) > 0 else []) + ["--cache", args.temp_dir + "cs_cache"] + [args.mmi_dir, 
 		args.reads, args.translation, args.temp_dir + "ContainmentResults.csv"]).decode('UTF-8').splitlines()[-1]
 		print(seed_count)
 
@@ -61,8 +84,7 @@ def run_minimap_and_cutoff(args, taxid2info):
 			organism, containment_index = splits[0], float(splits[-1])
 			if containment_index >= args.cutoff:
 				if not args.strain_level:
-					taxid = organism.split('taxid_')[1].split(
-						'_genomic.fna')[0].replace('_', '.')
+					taxid = organism_taxid(args, organism)
 					species = taxid2info[taxid][3].split('|')[-2]
 					if species not in species_included or species == '':
 						species_included[species] = 1
@@ -84,8 +106,7 @@ def make_db_and_dbinfo(args, organisms_to_include, taxid2info):
 		outfile.write('Accesion\tLength\tTaxID\tLineage\tTaxID_Lineage\n')
 		outfile.write('Unmapped\t0\tUnmapped\t|||||||Unmapped\t|||||||Unmapped\n')
 		for organism in organisms_to_include:
-			taxid = organism.split('taxid_')[1].split(
-				'_genomic.fna')[0].replace('_', '.')
+			taxid = organism_taxid(args, organism)
 			length = taxid2info[taxid][1]
 			namelin, taxlin = taxid2info[taxid][2], taxid2info[taxid][3]
 			for acc in taxid2info[taxid][0]:
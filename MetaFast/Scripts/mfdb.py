@@ -0,0 +1,80 @@
+#! /usr/bin/env python
+# Reader of the database catalogs compiled by `metafast-db compile`; see ReadMapping/catalog.h for the layout
+import bisect, collections, mmap, struct
+
+
+MAGIC = b'MFD\x01'
+HDR = struct.Struct('<4sIIIQ')
+TAXON = struct.Struct('<QIIIIIi')
+ACC = struct.Struct('<IIQ')
+Taxon = collections.namedtuple('Taxon', ['taxid', 'length', 'name_lin', 'tax_lin', 'file', 'n_acc', 'rank'])
+
+
+def is_catalog(fn):
+	try:
+		with open(fn, 'rb') as f:
+			return f.read(4) == MAGIC
+	except (IOError, OSError):
+		return False
+
+
+class _Names(object):  # sorted names of a table, as a sequence for bisect
+	def __init__(self, db, n, get):
+		self.db, self.n, self.get = db, n, get
+	def __len__(self):
+		return self.n
+	def __getitem__(self, i):
+		return self.db.string(self.get(i))
+
+
+class Catalog(object):
+	def __init__(self, fn):
+		with open(fn, 'rb') as f:
+			self.buf = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+		magic, self.n_taxa, self.n_acc, self.n_file, l_str = HDR.unpack_from(self.buf, 0)
+		if magic != MAGIC:
+			raise ValueError(fn + ' is not a catalog')
+		self.off_taxa = HDR.size
+		self.off_acc = self.off_taxa + self.n_taxa * TAXON.size
+		self.off_file = self.off_acc + self.n_acc * ACC.size
+		self.off_str = self.off_file + self.n_file * 4
+		self.acc_names = _Names(self, self.n_acc, lambda i: ACC.unpack_from(self.buf, self.off_acc + i * ACC.size)[0])
+		self.taxid_names = _Names(self, self.n_taxa, lambda i: TAXON.unpack_from(self.buf, self.off_taxa + i * TAXON.size)[1])
+		self.file_names = _Names(self, self.n_file, lambda i: TAXON.unpack_from(self.buf, self.off_taxa + self.file_taxon(i) * TAXON.size)[4])
+
+	def close(self):
+		self.buf.close()
+
+	def string(self, off):
+		start = self.off_str + off
+		return self.buf[start:self.buf.find(b'\0', start)].decode()
+
+	def taxon(self, i):
+		length, taxid, name_lin, tax_lin, fn, n_acc, rank = TAXON.unpack_from(self.buf, self.off_taxa + i * TAXON.size)
+		return Taxon(self.string(taxid), length, self.string(name_lin), self.string(tax_lin), self.string(fn), n_acc, rank)
+
+	def accession(self, i):  # (accession, length, index of its taxon)
+		name, taxon, length = ACC.unpack_from(self.buf, self.off_acc + i * ACC.size)
+		return self.string(name), length, taxon
+
+	def file_taxon(self, i):
+		return struct.unpack_from('<I', self.buf, self.off_file + i * 4)[0]
+
+	def _find(self, names, key):
+		i = bisect.bisect_left(names, key)
+		return i if i < len(names) and names[i] == key else -1
+
+	def acc2taxon(self, acc):  # index of the taxon of an accession; -1 if absent
+		i = self._find(self.acc_names, acc)
+		return self.accession(i)[2] if i >= 0 else -1
+
+	def taxid2taxon(self, taxid):
+		return self._find(self.taxid_names, taxid)
+
+	def file2taxon(self, fn):  # directories in fn are ignored
+		i = self._find(self.file_names, fn.split('/')[-1])
+		return self.file_taxon(i) if i >= 0 else -1
+
+	def accessions(self):  # all accessions, sorted
+		for i in range(self.n_acc):
+			yield self.accession(i)
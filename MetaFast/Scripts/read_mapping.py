@@ -1,5 +1,6 @@
 #! /usr/bin/env python
-import argparse, os, subprocess, sys, time
+import argparse, os, socket, subprocess, sys, time
+import mfdb
 
 
 start = time.time()  # start a program timer
@@ -22,7 +23,7 @@ def profile_parseargs():  # handle user arguments
 	parser.add_argument('infiles', nargs='+', help='sam or reads file(s) (space-delimited if multiple). Required.')
 	parser.add_argument('data', help='Path to data/ directory with the files from setup_data.sh')
 	parser.add_argument('--db', default='NONE', help='Path to database from containment_search. Required if read files given')
-	parser.add_argument('--dbinfo', default='AUTO', help='Location of db_info file. Default: data/db_info.txt')
+	parser.add_argument('--dbinfo', default='AUTO', help='Location of db_info file or of its catalog from metafast-db compile. Default: data/db_info.txt')
 	parser.add_argument('--input_type', default='AUTO', choices=['fastq', 'fasta', 'sam', 'AUTO'],
 		help='Type of input file (fastq/fasta/sam). Default: try to automatically determine')
 	parser.add_argument('--length_normalize', action='store_true', help='Normalize abundances by genome length.')
@@ -43,6 +44,8 @@ def profile_parseargs():  # handle user arguments
 	parser.add_argument('--verbose', action='store_true', help='Print verbose output.')
 	parser.add_argument('--filter', default='base-counting', choices=['adjacency-filter', 'base-counting', 'edlib', 'grim_original', 'grim_original_tweak', 'hd', 'magnet', 'qgram', 'shd', 'shouji', 'sneakysnake'])
 	parser.add_argument('--edit_dist_threshold', type=int, default=15, help='-r edit distance threshold for minimap2.')
+	parser.add_argument('--taxon_once', action='store_true', help='Stop verifying the candidate locations of a read on a taxon once one passes the filter.')
+	parser.add_argument('--seed_evidence', action='store_true', help='Accept or reject the candidate locations whose seeds decide them without running the filter.')
 	args = parser.parse_args()
 	return args
 
@@ -66,20 +69,29 @@ def get_taxid_rank(taxlin):
 def get_acc2info(args):
 	echo('Reading dbinfo file...', args.verbose)
 	acc2info, taxid2info = {}, {}
-	with(open(args.dbinfo, 'r')) as infofile:
-		infofile.readline()  # skip header line
-		for line in infofile:
-			acc, acclen, taxid, namelin, taxlin = line.strip().split('\t')
-			rank = get_taxid_rank(taxlin)
-			if rank == 'strain' and acc != 'Unmapped':
-				taxid += '.1'  # CAMI formatting specification
-				taxlin += '.1'
-			acclen = int(acclen)
-			acc2info[acc] = [acclen, taxid, namelin, taxlin]
-			if taxid in taxid2info:
-				taxid2info[taxid][0] += acclen
-			else:
-				taxid2info[taxid] = [acclen, rank, namelin, taxlin]
+	if mfdb.is_catalog(args.dbinfo):  # compiled by metafast-db; no text to parse
+		db = mfdb.Catalog(args.dbinfo)
+		taxa = [db.taxon(i) for i in range(db.n_taxa)]
+		lines = [(acc, acclen, taxa[i].taxid, taxa[i].name_lin, taxa[i].tax_lin) for acc, acclen, i in db.accessions()]
+		db.close()
+	else:
+		with(open(args.dbinfo, 'r')) as infofile:
+			infofile.readline()  # skip header line
+			lines = [line.strip().split('\t') for line in infofile]
+	for acc, acclen, taxid, namelin, taxlin in lines:
+		rank = get_taxid_rank(taxlin)
+		if rank == 'strain' and acc != 'Unmapped':
+			taxid += '.1'  # CAMI formatting specification
+			taxlin += '.1'
+		acclen = int(acclen)
+		acc2info[acc] = [acclen, taxid, namelin, taxlin]
+		if taxid in taxid2info:
+			taxid2info[taxid][0] += acclen
+		else:
+			taxid2info[taxid] = [acclen, rank, namelin, taxlin]
+	if 'Unmapped' not in acc2info:  # the full db_info used with --fused has no placeholder
+		acc2info['Unmapped'] = [0, 'Unmapped', '|||||||Unmapped', '|||||||Unmapped']
+		taxid2info['Unmapped'] = [0, 'strain', '|||||||Unmapped', '|||||||Unmapped']
 	return acc2info, taxid2info
 
 
@@ -411,13 +423,40 @@ def compute_abundances(args, infile, acc2info, tax2info):
 
 	if args.input_type == 'sam': # input stream from sam file
 		instream = open(infile, 'r')
+	elif getattr(args, 'fused', False):  # metafast selects the references and maps in one process
+		command = ['-t', str(args.threads), '-n', str(args.minimap_n), '-r', str(args.edit_dist_threshold),
+			'--filter='+str(args.filter), '-c', str(args.cutoff)]
+		if args.strain_level:
+			command.append('-S')
+		if getattr(args, 'taxon_once', False):
+			command.append('--taxa=' + os.path.abspath(args.dbinfo_in))
+		if getattr(args, 'seed_evidence', False):
+			command.append('--seed-evidence')
+		if args.keep_temp_files:
+			command.extend(['-C', os.path.abspath(args.temp_dir + 'ContainmentResults.csv')])
+		if getattr(args, 'server', 'NONE') != 'NONE':  # submit a job to a resident server; it streams SAM back
+			conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+			conn.connect(args.server)
+			conn.sendall(('\t'.join(command + [os.path.abspath(infile)]) + '\n').encode('utf-8'))
+			instream = iter(conn.makefile('rb').readline, b'')
+		else:
+			mapper = subprocess.Popen(['../MetaFast/ReadMapping/metafast'] + command
+				+ [args.mmi_dir, args.dbinfo_in, args.translation, infile], stdout=subprocess.PIPE, bufsize=1)
+			instream = iter(mapper.stdout.readline, "")
 	else:  # run minimap2 and stream its output as input
-		mapper = subprocess.Popen(['../MetaFast/ReadMapping/rm', '-ax', 'sr', '-t', '1', '-2', '-n', '3', '-r', str(args.edit_dist_threshold), '--filter='+str(args.filter), '--secondary=yes', args.db, infile], stdout=subprocess.PIPE, bufsize=1)
+		command = ['../MetaFast/ReadMapping/rm', '-ax', 'sr', '-t', '1', '-2', '-n', '3', '-r', str(args.edit_dist_threshold), '--filter='+str(args.filter), '--secondary=yes']
+		if getattr(args, 'taxon_once', False):
+			command.append('--taxa=' + args.dbinfo)
+		if getattr(args, 'seed_evidence', False):
+			command.append('--seed-evidence')
+		mapper = subprocess.Popen(command + [args.db, infile], stdout=subprocess.PIPE, bufsize=1)
 		instream = iter(mapper.stdout.readline, "")
 	taxids2abs, multimapped, low_mem_mmap = map_and_process(args,
 		instream, acc2info, tax2info)
 	if args.input_type == 'sam':
 		instream.close()
+	elif getattr(args, 'server', 'NONE') != 'NONE':
+		conn.close()
 	else:
 		mapper.stdout.close()
 		mapper.wait()
@@ -499,7 +538,7 @@ def map_main(args = None):
 		args = profile_parseargs()
 	if args.pct_id > 1.0 or args.pct_id < 0.0:
 		sys.exit('Error: --pct_id must be between 0.0 and 1.0, inclusive.')
-	if args.db == 'NONE' and not args.infiles[0].endswith('sam'):
+	if args.db == 'NONE' and not args.infiles[0].endswith('sam') and not getattr(args, 'fused', False):
 		sys.exit('Error: --db must be specified unless sam files are provided.')
 	if not args.data.endswith('/'):
 		args.data += '/'
@@ -0,0 +1,127 @@
+#! /usr/bin/env python
+# Simulates a metagenomic read set from the organism files of a database, with the error model of
+# filters/razers3/simulate_reads.cpp: every read position is substituted with its own probability
+import argparse, bisect, gzip, math, os, random, sys
+
+
+COMPLEMENT = str.maketrans('ACGT', 'TGCA')
+NON_ACGT = str.maketrans('', '', 'ACGT')
+
+
+def simulate_parseargs():  # handle user arguments
+	parser = argparse.ArgumentParser(description='Simulates reads of a random community drawn from the organism files of a database.')
+	parser.add_argument('db_dir', help='Directory with the taxid_<TaxID>_genomic.fna.gz organism files.')
+	parser.add_argument('--organisms', type=int, default=0, help='Number of organisms in the community. Default: 0 (all organism files).')
+	parser.add_argument('--reads', type=int, default=100000, help='Number of reads. Default: 100000')
+	parser.add_argument('--read_len', type=int, default=150, help='Read length. Default: 150')
+	parser.add_argument('--error_rate', type=float, default=0.01, help='Substitution probability of every read position. Default: 0.01')
+	parser.add_argument('--error_dist', default='NONE', help='File with one substitution probability per read position, as read by simulate_reads; overrides --read_len and --error_rate.')
+	parser.add_argument('--abundance', default='lognormal', choices=['lognormal', 'uniform'], help='Distribution of the relative abundances. Default: lognormal')
+	parser.add_argument('--seed', type=int, default=1, help='Seed of the random generator; equal seeds give equal read sets. Default: 1')
+	parser.add_argument('--output', default='reads.fq', help='Output reads file. Default: reads.fq')
+	parser.add_argument('--truth', default='truth.tsv', help='Output file with the number of reads of each organism. Default: truth.tsv')
+	args = parser.parse_args()
+	return args
+
+
+def organism_taxid(fname):  # taxid_<TaxID with '.' replaced by '_'>_genomic.fna.gz -> TaxID
+	base = fname.split('.')[0]
+	if base.startswith('taxid_') and base.endswith('_genomic'):
+		return base[len('taxid_'):-len('_genomic')].replace('_', '.')
+	return base
+
+
+def read_contigs(fname, min_len):  # [name, sequence] of all contigs that can hold a read
+	contigs, name, seq = [], '', []
+	opener = gzip.open if fname.endswith('.gz') else open
+	with(opener(fname, 'rt')) as infile:
+		for line in infile:
+			if line.startswith('>'):
+				if name != '':
+					contigs.append([name, ''.join(seq).upper()])
+				name, seq = line[1:].split()[0], []
+			else:
+				seq.append(line.strip())
+	if name != '':
+		contigs.append([name, ''.join(seq).upper()])
+	return [c for c in contigs if len(c[1]) >= min_len]
+
+
+def read_error_dist(args):
+	if args.error_dist == 'NONE':
+		return [args.error_rate] * args.read_len
+	with(open(args.error_dist, 'r')) as infile:
+		return [float(x) for x in infile.read().split()]
+
+
+def draw_community(args, rng):  # organism files of the community with their relative abundances
+	organisms = sorted([f for f in os.listdir(args.db_dir) if not f.startswith('.')])
+	if args.organisms > 0:
+		if args.organisms > len(organisms):
+			sys.exit('Error: --organisms exceeds the ' + str(len(organisms)) + ' organism files in ' + args.db_dir)
+		organisms = sorted(rng.sample(organisms, args.organisms))
+	if args.abundance == 'lognormal':  # a few dominant organisms and a long tail, as in real samples
+		weights = [math.exp(rng.gauss(0.0, 1.0)) for o in organisms]
+	else:
+		weights = [1.0] * len(organisms)
+	total = sum(weights)
+	return organisms, [w / total for w in weights]
+
+
+def simulate_read(rng, contigs, cum_len, error_dist):
+	read_len = len(error_dist)
+	while True:  # contigs are weighted by length, so that every genome position is equally likely
+		name, seq = contigs[bisect.bisect_right(cum_len, rng.random() * cum_len[-1])]
+		pos = rng.randint(0, len(seq) - read_len)
+		read = seq[pos:pos + read_len]
+		if read.translate(NON_ACGT) == '':  # reads with N are drawn again
+			break
+	strand = '+'
+	if rng.randint(0, 1) == 1:
+		read, strand = read.translate(COMPLEMENT)[::-1], '-'
+	bases, quals = list(read), ['I'] * read_len  # quality 40 on matches and 0 on substitutions
+	for j in range(read_len):
+		if rng.random() < error_dist[j]:
+			bases[j] = 'ACGT'[('ACGT'.index(bases[j]) + rng.randint(1, 3)) & 3]
+			quals[j] = '!'
+	return name, pos, strand, ''.join(bases), ''.join(quals)
+
+
+def simulate_main(args = None):
+	if args == None:
+		args = simulate_parseargs()
+	if not args.db_dir.endswith('/'):
+		args.db_dir += '/'
+	rng = random.Random(args.seed)
+	error_dist = read_error_dist(args)
+	organisms, abundances = draw_community(args, rng)
+	genomes, cum_abundance, total = [], [], 0.0
+	for organism, abundance in zip(organisms, abundances):
+		contigs = read_contigs(args.db_dir + organism, len(error_dist))
+		if len(contigs) == 0:
+			sys.exit('Error: ' + organism + ' has no contig of at least ' + str(len(error_dist)) + ' bases.')
+		cum_len, length = [], 0
+		for contig in contigs:
+			length += len(contig[1])
+			cum_len.append(length)
+		genomes.append([organism_taxid(organism), contigs, cum_len])
+		total += abundance
+		cum_abundance.append(total)
+
+	counts = [0] * len(genomes)
+	with(open(args.output, 'w')) as outfile:
+		for i in range(args.reads):
+			g = min(bisect.bisect_right(cum_abundance, rng.random() * total), len(genomes) - 1)
+			counts[g] += 1
+			name, pos, strand, read, qual = simulate_read(rng, genomes[g][1], genomes[g][2], error_dist)
+			outfile.write('@read' + str(i) + ' ' + genomes[g][0] + ' ' + name + ':' + str(pos) + strand + '\n')
+			outfile.write(read + '\n+\n' + qual + '\n')
+	with(open(args.truth, 'w')) as outfile:
+		outfile.write('TaxID\tReads\tAbundance\n')
+		for g in range(len(genomes)):
+			outfile.write(genomes[g][0] + '\t' + str(counts[g]) + '\t' + str(counts[g] / float(max(args.reads, 1))) + '\n')
+
+
+if __name__ == '__main__':
+	args = simulate_parseargs()
+	simulate_main(args)